@@ -111,6 +111,8 @@ static bool FLAGS_reuse_logs = false;
 
 static int FLAGS_bits_per_key = 16;
 
+static double FLAGS_bloom_bits_per_level = 1.0;
+
 static int FLAGS_keys_per_datatable = 65536;
 
 static int FLAGS_dram_node = 0;
@@ -710,6 +712,7 @@ class Benchmark {
     options.filter_policy = filter_policy_;
     options.reuse_logs = FLAGS_reuse_logs;
 	options.bits_per_key = FLAGS_bits_per_key;
+	options.bloom_bits_per_level = FLAGS_bloom_bits_per_level;
 	options.keys_per_datatable = FLAGS_keys_per_datatable;
 	options.dram_node = FLAGS_dram_node;
 	options.nvm_node = FLAGS_nvm_node;
@@ -965,6 +968,7 @@ int main(int argc, char** argv) {
   FLAGS_nvm_node = leveldb::Options().nvm_node;
   FLAGS_nvm_next_node = leveldb::Options().nvm_next_node;
   FLAGS_bits_per_key = leveldb::Options().bits_per_key;
+  FLAGS_bloom_bits_per_level = leveldb::Options().bloom_bits_per_level;
   std::string default_db_path;
 
   for (int i = 1; i < argc; i++) {
@@ -1016,6 +1020,8 @@ int main(int argc, char** argv) {
 	  FLAGS_nvm_next_node = n;
 	} else if (sscanf(argv[i], "--bits_per_key=%d%c", &n, &junk) == 1) {
 	  FLAGS_bits_per_key = n;
+	} else if (sscanf(argv[i], "--bloom_bits_per_level=%lf%c", &d, &junk) == 1) {
+	  FLAGS_bloom_bits_per_level = d;
     } else {
       std::fprintf(stderr, "Invalid flag '%s'\n", argv[i]);
       std::exit(1);
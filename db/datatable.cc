@@ -2,6 +2,11 @@
 // Use datatable to replace sstable in NVM
 
 #include "db/datatable.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
 #include "db/dbformat.h"
 #include "leveldb/comparator.h"
 #include "leveldb/env.h"
@@ -18,26 +23,141 @@ static Slice GetLengthPrefixedSlice(const char* data) {
   return Slice(p, len);
 }
 
-DataTable::DataTable(const InternalKeyComparator& comparator, MemTable* mem, const Options& options_)
-  : arena_(&(mem->arena_)),
+// Tables hold fewer keys the higher they are, extra bits cost the least
+// DRAM there.
+double DataTable::FilterBitsPerKey(const Options& options, int level) {
+  const int deepest = config::kNumLevels - 2;
+  const int above = deepest - std::min(level, deepest);
+  return options.bits_per_key + options.bloom_bits_per_level * above;
+}
+
+DataTable::DataTable(const InternalKeyComparator& comparator, MemTable* mem, const Options& options_,
+                     WorkerPool* workers)
+  : arena_(&(mem->arena_), workers),
+  slab_(&arena_, &epoch_),
   comparator_(comparator),
-  bloom_(options_.use_datatable_bloom?  new MergeableBloom(options_) : nullptr),
-	table_(comparator_, &arena_, &(mem->table_), options_, bloom_),
+  level_(0),
+  bloom_options_(&options_),
+  bloom_(nullptr),
+  cuckoo_(nullptr),
+	table_(comparator_, &arena_, &(mem->table_), options_),
   IsLastTable(false),
-  refs_(0) {}
+  refs_(0) {
+  if (options_.use_datatable_bloom) {
+    MergeableBloom* bloom =
+        mem->bloom() != nullptr
+            ? MergeableBloom::Resize(options_, FilterBitsPerKey(options_, 0),
+                                     mem->bloom(), mem->NumEntries())
+            : NewFilterFromKeys();
+    bloom_.store(bloom, std::memory_order_relaxed);
+  }
+  BuildFence();
+}
+
+// the last table grows node by node out of blocks of 4MB
+static const size_t kLastTableBlockSize = 4 * 1024 * 1024;
 
-DataTable::DataTable(const InternalKeyComparator& comparator)
+DataTable::DataTable(const InternalKeyComparator& comparator, const Options& options_)
   : comparator_(comparator),
+    arena_(kLastTableBlockSize, false),
+    slab_(&arena_, &epoch_),
+    level_(config::kNumLevels - 1),
+    bloom_options_(&options_),
     bloom_(nullptr),
-    table_(comparator_),
+    cuckoo_(nullptr),
+    table_(comparator_, &arena_, &slab_, true),
     IsLastTable(true),
-    refs_(0) {}
+    refs_(0) {
+  if (options_.use_datatable_bloom) {
+    CuckooFilter* filter = NewLastTableFilter(0);
+    cuckoo_.store(filter, std::memory_order_relaxed);
+    table_.SetFilter(filter);
+  }
+}
+
+DataTable::DataTable(const InternalKeyComparator& comparator, const Options& options_,
+                     const DataTableLayout& layout, int level, size_t size)
+  : comparator_(comparator),
+    arena_(layout.blocks, kLastTableBlockSize),
+    slab_(&arena_, &epoch_),
+    level_(level),
+    bloom_options_(&options_),
+    bloom_(nullptr),
+    cuckoo_(nullptr),
+    table_(comparator_, &arena_,
+           level == config::kNumLevels - 1 ? &slab_ : nullptr,
+           level == config::kNumLevels - 1, size),
+    IsLastTable(level == config::kNumLevels - 1),
+    refs_(0) {
+  if (options_.use_datatable_bloom && !IsLastTable) {
+    MergeableBloom* bloom = MergeableBloom::Load(options_, layout.bloom);
+    if (bloom == nullptr) {
+      // the filter was not persisted, rebuild it from the keys
+      bloom = NewFilterFromKeys();
+    }
+    bloom_.store(bloom, std::memory_order_relaxed);
+  } else if (options_.use_datatable_bloom) {
+    CuckooFilter* filter =
+        CuckooFilter::Load(layout.bloom, bloom_options_->dram_node);
+    if (filter == nullptr) {
+      // the filter was not persisted, rebuild it from the keys
+      filter = NewLastTableFilter(0);
+    }
+    cuckoo_.store(filter, std::memory_order_relaxed);
+    table_.SetFilter(filter);
+  }
+  BuildFence();
+}
 
 DataTable::~DataTable() {
   assert(refs_ == 0);
-  if (bloom_ != nullptr) {
-    delete bloom_;
+  delete bloom_.load(std::memory_order_relaxed);
+  delete cuckoo_.load(std::memory_order_relaxed);
+}
+
+MergeableBloom* DataTable::NewFilterFromKeys() {
+  mTable::Iterator iter(&table_);
+  size_t keys = 0;
+  for (iter.SeekToFirst(); iter.Valid(); iter.Next()) {
+    keys++;
   }
+  MergeableBloom* bloom = new MergeableBloom(
+      *bloom_options_, keys, FilterBitsPerKey(*bloom_options_, level_));
+  for (iter.SeekToFirst(); iter.Valid(); iter.Next()) {
+    uint32_t len;
+    const char* p = GetVarint32Ptr(iter.key(), iter.key() + 5, &len);
+    bloom->AddKey(Slice(p, len - 8));
+  }
+  return bloom;
+}
+
+void DataTable::BuildFence() {
+  if (!IsLastTable) {
+    table_.SetFence(table_.NewFence(bloom_options_->dram_node));
+  }
+}
+
+CuckooFilter* DataTable::NewLastTableFilter(size_t keys) {
+  std::vector<uint32_t> hashes;
+  Slice last;
+  mTable::Iterator iter(&table_);
+  for (iter.SeekToFirst(); iter.Valid(); iter.Next()) {
+    uint32_t len;
+    const char* p = GetVarint32Ptr(iter.key(), iter.key() + 5, &len);
+    Slice user_key(p, len - 8);
+    if (hashes.empty() ||
+        comparator_.comparator.user_comparator()->Compare(user_key, last) != 0) {
+      hashes.push_back(MergeableBloom::BloomHash(user_key));
+    }
+    last = user_key;
+  }
+  // Twice the room that is needed, so that it is rebuilt rarely
+  CuckooFilter* filter =
+      new CuckooFilter(2 * (hashes.size() + keys), bloom_options_->dram_node);
+  for (uint32_t hash : hashes) {
+    filter->Add(hash);
+  }
+  return filter;
 }
 
 size_t DataTable::ApproximateMemoryUsage() { return table_.GetSize(); }
@@ -54,7 +174,9 @@ static const char* EncodeKey(std::string* scratch, const Slice& target) {
 
 class DataTableIterator : public Iterator {
  public:
-  explicit DataTableIterator(mTable* table) : iter_(table) {}
+  // Pins "epoch", if not null, while the iterator is live
+  DataTableIterator(mTable* table, Epoch* epoch)
+      : guard_(epoch), iter_(table) {}
 
   DataTableIterator(const DataTableIterator&) = delete;
   DataTableIterator& operator=(const DataTableIterator&) = delete;
@@ -62,7 +184,11 @@ class DataTableIterator : public Iterator {
   ~DataTableIterator() override = default;
 
   bool Valid() const override { return iter_.Valid(); }
-  void Seek(const Slice& k) override { iter_.Seek(EncodeKey(&tmp_, k)); }
+  void Seek(const Slice& k) override {
+    // Keeps the fence the search starts at
+    Epoch::Guard guard(FilterLimbo()->epoch());
+    iter_.Seek(EncodeKey(&tmp_, k));
+  }
   void SeekToFirst() override { iter_.SeekToFirst(); }
   void SeekToLast() override { iter_.SeekToLast(); }
   void Next() override { iter_.Next(); }
@@ -76,68 +202,221 @@ class DataTableIterator : public Iterator {
   Status status() const override { return Status::OK(); }
 
  private:
+  Epoch::Guard guard_;
   mTable::Iterator iter_;
   std::string tmp_;  // For passing to EncodeKey
 };
 
-Iterator* DataTable::NewIterator() { return new DataTableIterator(&table_); }
+// Nodes of the last table are reused once they are dropped, the readers
+// keep the ones they may reach from it
+Iterator* DataTable::NewIterator() {
+  return new DataTableIterator(&table_, IsLastTable ? &epoch_ : nullptr);
+}
 
 bool DataTable::Get(const LookupKey& key, std::string* value, Status& s) {
-  if (bloom_ != nullptr) {
-    Slice tmpkey = key.user_key();
-    if(!(bloom_->KeyMayMatch(tmpkey))) {
-      return false;
+  Epoch::Guard guard(FilterLimbo()->epoch());
+  return MayContain(key) && GetUnfiltered(key, value, s);
+}
+
+bool DataTable::MayContain(const LookupKey& key) const {
+  MergeableBloom* bloom = bloom_.load(std::memory_order_acquire);
+  if (bloom != nullptr) {
+    return bloom->KeyMayMatch(key.hash());
+  }
+  CuckooFilter* filter = cuckoo_.load(std::memory_order_acquire);
+  return filter == nullptr || filter->KeyMayMatch(key.hash());
+}
+
+void DataTable::PrefetchFilter(const LookupKey& key) const {
+  MergeableBloom* bloom = bloom_.load(std::memory_order_acquire);
+  if (bloom != nullptr) {
+    bloom->Prefetch(key.hash());
+  }
+  CuckooFilter* filter = cuckoo_.load(std::memory_order_acquire);
+  if (filter != nullptr) {
+    filter->Prefetch(key.hash());
+  }
+}
+
+// GetUnfiltered() of "key" from the entry a search for it reached, with
+// *value pointing at the value bytes in the entry
+static bool GetFromEntry(const Comparator* ucmp, const char* entry,
+                         const LookupKey& key, Slice* value, Status& s) {
+  // entry format is:
+  //    klength  varint32
+  //    userkey  char[klength]
+  //    tag      uint64
+  //    vlength  varint32
+  //    value    char[vlength]
+  // Check that it belongs to same user key.  We do not check the
+  // sequence number since the Seek() call above should have skipped
+  // all entries with overly large sequence numbers.
+  uint32_t key_length;
+  const char* key_ptr = GetVarint32Ptr(entry, entry + 5, &key_length);
+  if (ucmp->Compare(Slice(key_ptr, key_length - 8), key.user_key()) == 0) {
+    // Correct user key
+    const uint64_t tag = DecodeFixed64(key_ptr + key_length - 8);
+    switch (static_cast<ValueType>(tag & 0xff)) {
+      case kTypeValue: {
+        *value = GetLengthPrefixedSlice(key_ptr + key_length);
+        return true;
+      }
+      case kTypeDeletion:
+        s = Status::NotFound(Slice());
+        return true;
     }
   }
+  return false;
+}
+
+bool DataTable::Find(const LookupKey& key, Slice* value, Status& s) {
   Slice memkey = key.memtable_key();
   mTable::Iterator iter(&table_);
   iter.Seek(memkey.data());
-  if (iter.Valid()) {
-    // entry format is:
-    //    klength  varint32
-    //    userkey  char[klength]
-    //    tag      uint64
-    //    vlength  varint32
-    //    value    char[vlength]
-    // Check that it belongs to same user key.  We do not check the
-    // sequence number since the Seek() call above should have skipped
-    // all entries with overly large sequence numbers.
-    const char* entry = iter.key();
-    uint32_t key_length;
-    const char* key_ptr = GetVarint32Ptr(entry, entry + 5, &key_length);
-    if (comparator_.comparator.user_comparator()->Compare(
-            Slice(key_ptr, key_length - 8), key.user_key()) == 0) {
-      // Correct user key
-      const uint64_t tag = DecodeFixed64(key_ptr + key_length - 8);
-      switch (static_cast<ValueType>(tag & 0xff)) {
-        case kTypeValue: {
-          Slice v = GetLengthPrefixedSlice(key_ptr + key_length);
-          value->assign(v.data(), v.size());
-          return true;
-        }
-        case kTypeDeletion:
-          s = Status::NotFound(Slice());
-          return true;
+  return iter.Valid() &&
+         GetFromEntry(comparator_.comparator.user_comparator(), iter.key(),
+                      key, value, s);
+}
+
+bool DataTable::GetUnfiltered(const LookupKey& key, std::string* value,
+                              Status& s) {
+  Epoch::Guard guard(IsLastTable ? &epoch_ : nullptr);
+  Slice v;
+  if (!Find(key, &v, s)) {
+    return false;
+  }
+  if (s.ok()) {
+    value->assign(v.data(), v.size());
+  }
+  return true;
+}
+
+static void ExitEpoch(void* arg1, void* arg2) {
+  reinterpret_cast<Epoch*>(arg1)->Exit(reinterpret_cast<uintptr_t>(arg2));
+}
+
+bool DataTable::GetUnfiltered(const LookupKey& key, PinnableSlice* value,
+                              Status& s) {
+  Epoch* epoch = IsLastTable ? &epoch_ : nullptr;
+  const uint64_t token = epoch != nullptr ? epoch->Enter() : 0;
+  Slice v;
+  const bool found = Find(key, &v, s);
+  if (found && s.ok()) {
+    value->PinSlice(v);
+    if (epoch != nullptr) {
+      value->RegisterCleanup(&ExitEpoch, epoch,
+                             reinterpret_cast<void*>(token));
+    }
+  } else if (epoch != nullptr) {
+    epoch->Exit(token);
+  }
+  return found;
+}
+
+void DataTable::MultiGetUnfiltered(KeyLookup* const* lookups, int n) {
+  std::vector<const char*> targets(n);
+  for (int i = 0; i < n; i++) {
+    targets[i] = lookups[i]->key->memtable_key().data();
+  }
+  std::vector<const char*> entries(n);
+  Epoch::Guard guard(IsLastTable ? &epoch_ : nullptr);
+  table_.SeekMany(targets.data(), n, entries.data());
+  for (int i = 0; i < n; i++) {
+    KeyLookup* l = lookups[i];
+    Slice v;
+    if (entries[i] != nullptr &&
+        GetFromEntry(comparator_.comparator.user_comparator(), entries[i],
+                     *l->key, &v, *l->status)) {
+      l->found = true;
+      if (l->status->ok()) {
+        l->value->assign(v.data(), v.size());
       }
     }
   }
-  return false;
 }
 
-Status DataTable::Compact(DataTable* dtable, SequenceNumber snum) {
+// Searches that may have started from the fence of "table" keep it
+static void ClearFence(mTable* table) {
+  mTable::Fence* fence = table->SetFence(nullptr);
+  if (fence != nullptr) {
+    FilterLimbo()->Retire(fence);
+  }
+}
+
+Status DataTable::Compact(DataTable* dtable, SequenceNumber snum,
+                          WorkerPool* workers, NvmJournal* journal) {
 	if(dtable != nullptr) {
+    table_.SetJournal(journal);
     if (IsLastTable) {
-      table_.LastTableCompact(&(dtable->table_), snum);
+      CuckooFilter* filter = cuckoo_.load(std::memory_order_relaxed);
+      MergeableBloom* small = dtable->bloom_.load(std::memory_order_relaxed);
+      // Every key of smalltable may be new to this table
+      const size_t keys = small != nullptr ? small->NumKeys() : 0;
+      if (filter != nullptr && !filter->HasRoomFor(keys)) {
+        CuckooFilter* larger = NewLastTableFilter(keys);
+        cuckoo_.store(larger, std::memory_order_release);
+        table_.SetFilter(larger);
+        FilterLimbo()->Retire(filter);
+      }
+      table_.LastTableCompact(&(dtable->table_), snum, workers);
     } else {
-      if (bloom_ != nullptr) {
-        bloom_->Merge(dtable->bloom_);
+      level_ = std::max(level_, dtable->level_) + 1;
+      MergeableBloom* bloom = bloom_.load(std::memory_order_relaxed);
+      MergeableBloom* small = dtable->bloom_.load(std::memory_order_relaxed);
+      if (bloom != nullptr && small != nullptr) {
+        // Readers find the keys of smalltable in the filter before they
+        // can find them in this table
+        const double bits = FilterBitsPerKey(*bloom_options_, level_);
+        if (bloom->CanAbsorb(small, bits)) {
+          bloom->Merge(small);
+        } else {
+          bloom_.store(MergeableBloom::Union(*bloom_options_, bits, bloom, small),
+                       std::memory_order_release);
+          FilterLimbo()->Retire(bloom);
+        }
       }
-      table_.Compact(&(dtable->table_), snum);
+      // Neither table may be searched from a fence while nodes move
+      ClearFence(&table_);
+      ClearFence(&dtable->table_);
+      table_.Compact(&(dtable->table_), snum, workers);
+      BuildFence();
     }
+    table_.SetJournal(nullptr);
 		return Status::OK();
 	} else {
 		return Status::Corruption("Compaction has sth wrong!");
 	}
 }
 
+void DataTable::Sync() {
+  for (size_t i = 0; i < arena_.blocks_.size(); i++) {
+    nvm_pool->Sync(arena_.blocks_[i], arena_.block_size_[i]);
+  }
+  MergeableBloom* bloom = bloom_.load(std::memory_order_relaxed);
+  if (bloom != nullptr) {
+    bloom->Persist();
+  }
+  CuckooFilter* filter = cuckoo_.load(std::memory_order_relaxed);
+  if (filter != nullptr) {
+    filter->Persist();
+  }
+}
+
+void DataTable::GetLayout(DataTableLayout* layout) {
+  layout->blocks.clear();
+  layout->bloom = NvmRegion();
+  if (nvm_pool == nullptr) {
+    return;
+  }
+  arena_.GetRegions(&layout->blocks);
+  MergeableBloom* bloom = bloom_.load(std::memory_order_relaxed);
+  if (bloom != nullptr) {
+    layout->bloom = bloom->PersistedRegion();
+  }
+  CuckooFilter* filter = cuckoo_.load(std::memory_order_relaxed);
+  if (filter != nullptr) {
+    layout->bloom = filter->PersistedRegion();
+  }
+}
+
 }	//namespace leveldb
\ No newline at end of file
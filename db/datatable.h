@@ -4,16 +4,24 @@
 #ifndef STORAGE_LEVELDB_DB_DATATABLE_H_
 #define STORAGE_LEVELDB_DB_DATATABLE_H_
 
+#include <atomic>
 #include <string>
+#include <vector>
 
 #include "db/dbformat.h"
 #include "db/skiplist.h"
 #include "leveldb/db.h"
+#include "leveldb/pinnable_slice.h"
 #include "leveldb/status.h"
 #include "util/arena.h"
+#include "util/cuckoofilter.h"
+#include "util/epoch.h"
 #include "db/memtable.h"
 #include "leveldb/options.h"
 #include "util/mergeablebloom.h"
+#include "util/nvm_pool.h"
+#include "util/slab_allocator.h"
+#include "util/worker_pool.h"
 
 namespace leveldb {
 
@@ -21,10 +29,26 @@ class InternalKeyComparator;
 class DataTableIterator;
 //typedef SkipList<char*, KeyComparator> dTable;
 
+// Where a datatable lives in the nvm pool.  Recorded in the MANIFEST so
+// that the table can be remapped when the DB is reopened.
+struct DataTableLayout {
+  std::vector<NvmRegion> blocks;  // arena blocks, blocks[0] starts with head_
+  NvmRegion bloom;                // persisted filter, size 0 if none.  The
+                                  // cuckoo filter of the last table.
+};
+
 class DataTable {
  public:
-  explicit DataTable(const InternalKeyComparator& comparator, MemTable* mem, const Options& options_);
-  explicit DataTable(const InternalKeyComparator& comparator);
+  // Flush "mem", splitting the copy over "workers".  The bloom filter is
+  // the one "mem" filled as keys were added, folded to its number of keys.
+  explicit DataTable(const InternalKeyComparator& comparator, MemTable* mem, const Options& options_,
+                     WorkerPool* workers);
+  // An empty last table
+  explicit DataTable(const InternalKeyComparator& comparator, const Options& options_);
+  // Remap a datatable of "level" from the nvm pool, "size" is its recorded
+  // file size
+  explicit DataTable(const InternalKeyComparator& comparator, const Options& options_,
+                     const DataTableLayout& layout, int level, size_t size);
 
   DataTable(const DataTable&) = delete;
   DataTable& operator=(const DataTable&) = delete;
@@ -64,19 +88,76 @@ class DataTable {
   // Some get operation will start with the jumpflag node instead of the start of skiplist
   bool Get(const LookupKey& key, std::string* value, Status& s);
 
-  Status Compact(DataTable* smalltable, SequenceNumber snum);
+  // False if the filter rules key out.  Probing the filters of several
+  // tables is cheaper after PrefetchFilter() on all of them.
+  // REQUIRES: FilterLimbo()->epoch() is pinned
+  bool MayContain(const LookupKey& key) const;
+  void PrefetchFilter(const LookupKey& key) const;
+
+  // Get() for callers that checked MayContain() already.  The search
+  // starts at the DRAM fence of the table, which the same pin keeps.
+  bool GetUnfiltered(const LookupKey& key, std::string* value, Status& s);
+  // GetUnfiltered() that points *value at the value bytes in this table.
+  // They stay in place while the table is referenced, except in the last
+  // table, whose nodes are reused: *value then pins its readers' epoch.
+  bool GetUnfiltered(const LookupKey& key, PinnableSlice* value, Status& s);
+  // GetUnfiltered() for each of lookups[0,n), setting found where it
+  // would return true.  Keys in order search fastest.
+  void MultiGetUnfiltered(KeyLookup* const* lookups, int n);
+
+  // Merge "smalltable" into this table, which moves down a level.  Its
+  // filter is replaced by a larger one if it gets too full for that level
+  // or for the keys copied into the last table.  Lookups in either table
+  // walk the levels of the fence on NVM until the merge is done.  If "workers" is non-null
+  // the merge is split into key ranges that run on it.  The links it
+  // overwrites are saved in "journal" if that is non-null.
+  Status Compact(DataTable* smalltable, SequenceNumber snum,
+                 WorkerPool* workers = nullptr, NvmJournal* journal = nullptr);
+
+  // Write the table and its filter back to the nvm pool.
+  // REQUIRES: nvm_pool != nullptr
+  void Sync();
+
+  // Not OK if the table could not be remapped from or written to the nvm
+  // pool, see Arena::status().  Such a table must not reach the MANIFEST.
+  Status status() const { return arena_.status(); }
+
+  // Store the pool regions of this table in *layout.
+  // Leaves *layout empty if the table is not backed by the nvm pool.
+  void GetLayout(DataTableLayout* layout);
+
+  // Bits per key of the bloom filter of a table in "level"
+  static double FilterBitsPerKey(const Options& options, int level);
 
  private:
 
   friend class DataTableIterator;
   friend class DataTableBackwardIterator;
 
+  // The value or deletion of key in the table, with *value pointing at the
+  // value bytes.  REQUIRES: the readers' epoch is pinned in the last table
+  bool Find(const LookupKey& key, Slice* value, Status& s);
+  // A cuckoo filter of the user keys in the last table, with room for
+  // "keys" more
+  CuckooFilter* NewLastTableFilter(size_t keys);
+  // A bloom filter of the user keys in the table, built from the table
+  // when no filter of them was kept
+  MergeableBloom* NewFilterFromKeys();
+  // Let searches of table_ start at a fence of its nodes in DRAM.  The
+  // last table changes with every compaction and keeps none.
+  void BuildFence();
+
   KeyComparator comparator_;
   int refs_;
+  int level_;                     // 0 when flushed, +1 per Compact()
+  const Options* bloom_options_;  // Sizes the bloom filter, if any
 
  public:
   Arena arena_;
-  MergeableBloom* bloom_;
+  Epoch epoch_;         // Pinned by the readers of the last table
+  SlabAllocator slab_;  // Only used by the last table
+  std::atomic<MergeableBloom*> bloom_;
+  std::atomic<CuckooFilter*> cuckoo_;  // Only used by the last table
   mTable table_;
   bool IsLastTable;
 };
@@ -0,0 +1,667 @@
+// Add by MioDB
+
+#include "db/datatable.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "db/dbformat.h"
+#include "db/global.h"
+#include "db/memtable.h"
+#include "leveldb/comparator.h"
+#include "leveldb/iterator.h"
+#include "leveldb/pinnable_slice.h"
+#include "util/coding.h"
+#include "util/random.h"
+#include "util/testutil.h"
+#include "util/worker_pool.h"
+
+namespace leveldb {
+
+class DataTableTest : public testing::Test {
+ public:
+  DataTableTest()
+      : icmp_(BytewiseComparator()), workers_(3), rnd_(301), seq_(0) {}
+
+  // Flush a memtable that holds every n-th of the first "keys" keys,
+  // starting at "offset", to a datatable.  Every key is written "versions"
+  // times.  The memtable fills the table's bloom filter.
+  DataTable* NewTable(int keys, int n, int offset, int versions = 1) {
+    MemTable* mem = new MemTable(icmp_, 8 << 20, options_);
+    mem->Ref();
+    for (int i = offset; i < keys; i += n) {
+      std::string key = Key(i);
+      for (int v = 0; v < versions; v++) {
+        seq_++;
+        entries_++;
+        if (rnd_.OneIn(10)) {
+          mem->Add(seq_, kTypeDeletion, key, Slice());
+          model_.erase(key);
+        } else {
+          std::string value = key + "." + std::to_string(seq_);
+          mem->Add(seq_, kTypeValue, key, value);
+          model_[key] = value;
+        }
+      }
+    }
+    DataTable* dt = new DataTable(icmp_, mem, options_, &workers_);
+    dt->Ref();
+    mem->Unref();
+    return dt;
+  }
+
+  // Flush a memtable that deletes every n-th of the first "keys" keys.
+  // The table's bloom filter is built from its keys.
+  DataTable* DeletionTable(int keys, int n) {
+    MemTable* mem = new MemTable(icmp_, 8 << 20);
+    mem->Ref();
+    for (int i = 0; i < keys; i += n) {
+      mem->Add(++seq_, kTypeDeletion, Key(i), Slice());
+      model_.erase(Key(i));
+    }
+    DataTable* dt = new DataTable(icmp_, mem, options_, &workers_);
+    dt->Ref();
+    mem->Unref();
+    return dt;
+  }
+
+  static std::string Key(int i) {
+    char buf[20];
+    std::snprintf(buf, sizeof(buf), "key%08d", i);
+    return buf;
+  }
+
+  static std::vector<std::string> Contents(DataTable* dt) {
+    std::vector<std::string> result;
+    Iterator* iter = dt->NewIterator();
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+      result.push_back(iter->key().ToString() + "=" + iter->value().ToString());
+    }
+    delete iter;
+    return result;
+  }
+
+  // Number of entries in dt, REQUIRES: they are in internal key order
+  int CountOrdered(DataTable* dt) {
+    int count = 0;
+    std::string last;
+    Iterator* iter = dt->NewIterator();
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+      if (count > 0) {
+        EXPECT_LT(icmp_.Compare(last, iter->key()), 0);
+      }
+      last = iter->key().ToString();
+      count++;
+    }
+    delete iter;
+    return count;
+  }
+
+  // Where a seek to each of the first "keys" keys lands
+  static std::vector<std::string> SeekAll(DataTable* dt, int keys) {
+    std::vector<std::string> result;
+    Iterator* iter = dt->NewIterator();
+    for (int i = 0; i < keys; i++) {
+      InternalKey target(Key(i), kMaxSequenceNumber, kValueTypeForSeek);
+      iter->Seek(target.Encode());
+      result.push_back(iter->Valid() ? iter->key().ToString() : "(end)");
+    }
+    delete iter;
+    return result;
+  }
+
+  // Every key reads as in model_
+  void CheckReads(DataTable* dt, int keys) {
+    for (int i = 0; i < keys; i++) {
+      std::string key = Key(i);
+      LookupKey lkey(key, kMaxSequenceNumber);
+      std::string value;
+      Status s;
+      bool found = dt->Get(lkey, &value, s);
+      auto it = model_.find(key);
+      if (it == model_.end()) {
+        ASSERT_TRUE(!found || s.IsNotFound()) << key;
+      } else {
+        ASSERT_TRUE(found && s.ok()) << key;
+        ASSERT_EQ(it->second, value);
+      }
+    }
+  }
+
+  InternalKeyComparator icmp_;
+  Options options_;
+  WorkerPool workers_;
+  Random rnd_;
+  SequenceNumber seq_;
+  int entries_ = 0;  // Entries written by NewTable()
+  std::map<std::string, std::string> model_;
+};
+
+TEST_F(DataTableTest, FilterGrowsWithTable) {
+  const int kKeys = 60000;
+  DataTable* old_table = NewTable(kKeys, 2, 0);
+  DataTable* new_table = NewTable(kKeys, 2, 1);
+  MergeableBloom* bloom = old_table->bloom_.load();
+  ASSERT_EQ(kKeys / 2, bloom->NumKeys());
+  const size_t size = bloom->ByteSize();
+
+  ASSERT_LEVELDB_OK(old_table->Compact(new_table, kMaxSequenceNumber));
+  bloom = old_table->bloom_.load();
+  ASSERT_EQ(kKeys, bloom->NumKeys());
+  ASSERT_GT(bloom->ByteSize(), size);
+  CheckReads(old_table, kKeys);
+
+  new_table->Unref();
+  old_table->Unref();
+}
+
+// The filter a memtable fills as keys arrive is the one that a flush
+// would build from the keys
+TEST_F(DataTableTest, FlushKeepsMemtableFilter) {
+  const int kKeys = 20000;
+  DataTable* filled = NewTable(kKeys, 1, 0);
+  DataTable* built = DeletionTable(kKeys, 1);
+  MergeableBloom* bloom = filled->bloom_.load();
+  ASSERT_EQ(kKeys, bloom->NumKeys());
+  ASSERT_EQ(built->bloom_.load()->ByteSize(), bloom->ByteSize());
+  ASSERT_EQ(0, memcmp(built->bloom_.load()->GetResult(), bloom->GetResult(),
+                      bloom->ByteSize()));
+
+  built->Unref();
+  filled->Unref();
+}
+
+// Seeks that start at the fence land where those from the head do
+TEST_F(DataTableTest, FenceSeeks) {
+  const int kKeys = 60000;
+  DataTable* dt = NewTable(kKeys, 2, 0, 2);
+  mTable::Fence* fence = dt->table_.SetFence(nullptr);
+  ASSERT_TRUE(fence != nullptr);
+  ASSERT_GT(fence->NumNodes(), kKeys / 256);
+  std::vector<std::string> expected = SeekAll(dt, kKeys);
+  dt->table_.SetFence(fence);
+  ASSERT_EQ(expected, SeekAll(dt, kKeys));
+
+  // The merge leaves a fence of the nodes of both tables
+  DataTable* odd = NewTable(kKeys, 2, 1);
+  ASSERT_LEVELDB_OK(dt->Compact(odd, kMaxSequenceNumber, &workers_));
+  fence = dt->table_.SetFence(nullptr);
+  ASSERT_TRUE(fence != nullptr);
+  expected = SeekAll(dt, kKeys);
+  dt->table_.SetFence(fence);
+  ASSERT_EQ(expected, SeekAll(dt, kKeys));
+  CheckReads(dt, kKeys);
+
+  odd->Unref();
+  dt->Unref();
+}
+
+// Lookups that search in lockstep find what one at a time do
+TEST_F(DataTableTest, MultiGet) {
+  const int kKeys = 20000;
+  DataTable* dt = NewTable(kKeys, 1, 0, 2);
+  Epoch::Guard filters(FilterLimbo()->epoch());
+  std::vector<int> order;
+  for (int i = 0; i < kKeys + 100; i += 3) {
+    order.push_back(i);
+  }
+  for (int pass = 0; pass < 2; pass++) {
+    // Sorted first, then shuffled, also without the fence
+    if (pass == 1) {
+      std::shuffle(order.begin(), order.end(), std::mt19937(301));
+      delete dt->table_.SetFence(nullptr);
+    }
+    const int n = order.size();
+    std::deque<LookupKey> keys;
+    std::vector<std::string> values(n);
+    std::vector<Status> statuses(n);
+    std::vector<KeyLookup> lookups(n);
+    std::vector<KeyLookup*> batch(n);
+    for (int i = 0; i < n; i++) {
+      keys.emplace_back(Key(order[i]), kMaxSequenceNumber);
+      lookups[i] = KeyLookup{&keys.back(), &values[i], &statuses[i], false};
+      batch[i] = &lookups[i];
+    }
+    dt->MultiGetUnfiltered(batch.data(), n);
+    for (int i = 0; i < n; i++) {
+      std::string value;
+      Status s;
+      ASSERT_EQ(dt->GetUnfiltered(keys[i], &value, s), lookups[i].found);
+      ASSERT_EQ(s.ToString(), statuses[i].ToString());
+      ASSERT_EQ(value, values[i]);
+    }
+  }
+  dt->Unref();
+}
+
+// Pinned values are those a copy gets, in the last table they keep the
+// nodes a compaction drops from being reused
+TEST_F(DataTableTest, PinnedGet) {
+  const int kKeys = 10000;
+  DataTable* dt = NewTable(kKeys, 1, 0);
+  Epoch::Guard filters(FilterLimbo()->epoch());
+  for (int i = 0; i < kKeys; i += 7) {
+    LookupKey lkey(Key(i), kMaxSequenceNumber);
+    std::string copy;
+    Status copy_status;
+    PinnableSlice pinned;
+    Status s;
+    ASSERT_EQ(dt->GetUnfiltered(lkey, &copy, copy_status),
+              dt->GetUnfiltered(lkey, &pinned, s));
+    ASSERT_EQ(copy_status.ToString(), s.ToString());
+    ASSERT_EQ(copy, pinned.ToString());
+    // The table is referenced, nothing else to pin
+    ASSERT_FALSE(pinned.IsPinned());
+  }
+
+  DataTable* last = new DataTable(icmp_, options_);
+  last->Ref();
+  ASSERT_LEVELDB_OK(last->Compact(dt, kMaxSequenceNumber));
+  dt->Unref();
+  const std::string key = model_.begin()->first;
+  const std::string value = model_.begin()->second;
+  LookupKey lkey(key, kMaxSequenceNumber);
+  PinnableSlice pinned;
+  Status s;
+  ASSERT_TRUE(last->GetUnfiltered(lkey, &pinned, s));
+  ASSERT_LEVELDB_OK(s);
+  ASSERT_TRUE(pinned.IsPinned());
+
+  DataTable* deletions = DeletionTable(kKeys, 1);
+  ASSERT_LEVELDB_OK(last->Compact(deletions, kMaxSequenceNumber));
+  deletions->Unref();
+  last->slab_.Reclaim();
+  ASSERT_GT(last->slab_.RetiredBytes(), 0);
+  ASSERT_EQ(value, pinned.ToString());
+  pinned.Reset();
+  last->slab_.Reclaim();
+  ASSERT_EQ(0, last->slab_.RetiredBytes());
+  last->Unref();
+}
+
+// User keys in the order of "cmp" after a flush of all of them
+static std::vector<std::string> FlushedOrder(
+    const Comparator* cmp, const std::vector<std::string>& keys) {
+  InternalKeyComparator icmp(cmp);
+  Options options;
+  WorkerPool workers(1);
+  MemTable* mem = new MemTable(icmp, 4 << 20);
+  mem->Ref();
+  SequenceNumber seq = 0;
+  for (const std::string& key : keys) {
+    mem->Add(++seq, kTypeValue, key, key);
+  }
+  DataTable* dt = new DataTable(icmp, mem, options, &workers);
+  dt->Ref();
+  mem->Unref();
+  std::vector<std::string> result;
+  Iterator* iter = dt->NewIterator();
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    result.push_back(ExtractUserKey(iter->key()).ToString());
+  }
+  // Every key is found where a search from its prefix leads
+  for (const std::string& key : keys) {
+    InternalKey target(key, kMaxSequenceNumber, kValueTypeForSeek);
+    iter->Seek(target.Encode());
+    EXPECT_TRUE(iter->Valid() && ExtractUserKey(iter->key()) == key) << key;
+  }
+  delete iter;
+  dt->Unref();
+  return result;
+}
+
+// Keys that the prefixes of the nodes do not tell apart, or that are
+// not ordered like them
+TEST_F(DataTableTest, PrefixOrder) {
+  class ReverseComparator : public Comparator {
+   public:
+    const char* Name() const override { return "test.Reverse"; }
+    int Compare(const Slice& a, const Slice& b) const override {
+      return BytewiseComparator()->Compare(b, a);
+    }
+    void FindShortestSeparator(std::string*, const Slice&) const override {}
+    void FindShortSuccessor(std::string*) const override {}
+  };
+  ReverseComparator reverse;
+
+  std::vector<std::string> keys;
+  for (int i = 0; i < 2000; i++) {
+    // Shorter than, as long as and longer than the prefix
+    keys.push_back(std::to_string(i));
+    keys.push_back(std::string(16 - 4, 'p') + std::to_string(1000 + i));
+    keys.push_back(std::string(16, 'q') + std::to_string(i));
+    const std::string zero("z\0", 2);
+    keys.push_back(zero + std::to_string(i));
+    keys.push_back(zero + std::to_string(i) + std::string(20, '\0'));
+  }
+  std::vector<std::string> sorted = keys;
+  std::sort(sorted.begin(), sorted.end());
+  ASSERT_EQ(sorted, FlushedOrder(BytewiseComparator(), keys));
+  std::reverse(sorted.begin(), sorted.end());
+  ASSERT_EQ(sorted, FlushedOrder(&reverse, keys));
+}
+
+// The inlined bytewise comparisons order keys like the user comparator
+TEST_F(DataTableTest, BytewiseCompare) {
+  InternalKeyComparator icmp(BytewiseComparator());
+  KeyComparator cmp(icmp);
+  ASSERT_TRUE(cmp.prefix_order);
+  Random rnd(301);
+  std::vector<std::string> keys;
+  for (int i = 0; i < 300; i++) {
+    // Few distinct bytes, so that keys share prefixes and user keys
+    std::string user;
+    const int len = rnd.Skewed(5);
+    for (int j = 0; j < len; j++) {
+      user.push_back("ab\0\xff"[rnd.Uniform(4)]);
+    }
+    std::string key;
+    PutVarint32(&key, user.size() + 8);
+    key.append(user);
+    PutFixed64(&key, (uint64_t{rnd.Uniform(8)} << 8) | kTypeValue);
+    keys.push_back(key);
+  }
+  auto sign = [](int r) { return (r > 0) - (r < 0); };
+  for (const std::string& a : keys) {
+    for (const std::string& b : keys) {
+      Slice ea(a), eb(b), ia, ib;
+      ASSERT_TRUE(GetLengthPrefixedSlice(&ea, &ia));
+      ASSERT_TRUE(GetLengthPrefixedSlice(&eb, &ib));
+      ASSERT_EQ(sign(cmp.UserCompare(a.data(), b.data())),
+                sign(cmp(a.data(), b.data())));
+      ASSERT_EQ(icmp.NewCompare(ia, ib, true, 4),
+                cmp.NewCompare(a.data(), b.data(), true, 4));
+      ASSERT_EQ(icmp.NewCompare(ia, ib), cmp.NewCompare(a.data(), b.data()));
+    }
+  }
+}
+
+TEST_F(DataTableTest, ParallelCompact) {
+  const int kKeys = 60000;
+  // The same tables merged on one thread and split into ranges
+  DataTable* serial_old = NewTable(kKeys, 2, 0);
+  DataTable* serial_new = NewTable(kKeys, 3, 0);
+  std::map<std::string, std::string> model = model_;
+  seq_ = 0;
+  rnd_ = Random(301);
+  model_.clear();
+  DataTable* old_table = NewTable(kKeys, 2, 0);
+  DataTable* new_table = NewTable(kKeys, 3, 0);
+  ASSERT_TRUE(model == model_);
+
+  ASSERT_LEVELDB_OK(serial_old->Compact(serial_new, kMaxSequenceNumber));
+  ASSERT_LEVELDB_OK(old_table->Compact(new_table, kMaxSequenceNumber, &workers_));
+  ASSERT_TRUE(Contents(serial_old) == Contents(old_table));
+  CheckReads(old_table, kKeys);
+
+  serial_new->Unref();
+  serial_old->Unref();
+  new_table->Unref();
+  old_table->Unref();
+}
+
+TEST_F(DataTableTest, ParallelLastTableCompact) {
+  const int kKeys = 60000;
+  DataTable* serial_last = new DataTable(icmp_, options_);
+  DataTable* last = new DataTable(icmp_, options_);
+  serial_last->Ref();
+  last->Ref();
+  DataTable* first = NewTable(kKeys, 2, 0);
+  ASSERT_LEVELDB_OK(serial_last->Compact(first, kMaxSequenceNumber));
+  ASSERT_LEVELDB_OK(last->Compact(first, kMaxSequenceNumber));
+  first->Unref();
+
+  for (int offset = 1; offset < 3; offset++) {
+    DataTable* table = NewTable(kKeys, 3, offset);
+    ASSERT_LEVELDB_OK(serial_last->Compact(table, kMaxSequenceNumber));
+    ASSERT_LEVELDB_OK(last->Compact(table, kMaxSequenceNumber, &workers_));
+    table->Unref();
+    ASSERT_TRUE(Contents(serial_last) == Contents(last));
+    CheckReads(last, kKeys);
+  }
+
+  serial_last->Unref();
+  last->Unref();
+}
+
+TEST_F(DataTableTest, SpliceDisjointTables) {
+  const int kKeys = 60000;
+  // A short table, a tall one in front of it and another one behind
+  DataTable* table = NewTable(kKeys + 10, 1, kKeys);
+  DataTable* front = NewTable(kKeys, 1, 0);
+  DataTable* back = NewTable(3 * kKeys, 1, 2 * kKeys);
+  std::vector<std::string> expected = Contents(front);
+  for (const std::string& entry : Contents(table)) expected.push_back(entry);
+  for (const std::string& entry : Contents(back)) expected.push_back(entry);
+
+  ASSERT_LEVELDB_OK(table->Compact(front, kMaxSequenceNumber, &workers_));
+  ASSERT_LT(table->table_.wa, 1024);  // Only the seam was linked
+  ASSERT_LEVELDB_OK(table->Compact(back, kMaxSequenceNumber, &workers_));
+  ASSERT_LT(table->table_.wa, 1024);
+  ASSERT_TRUE(expected == Contents(table));
+  CheckReads(table, 3 * kKeys);
+
+  // Overlapping tables are still merged
+  DataTable* overlap = NewTable(3 * kKeys, 7, 3);
+  ASSERT_LEVELDB_OK(table->Compact(overlap, kMaxSequenceNumber, &workers_));
+  CheckReads(table, 3 * kKeys);
+
+  front->Unref();
+  back->Unref();
+  overlap->Unref();
+  table->Unref();
+}
+
+// Versions newer than the snapshot are all kept, so the merges insert
+// keys that sort before the node they inserted last.
+TEST_F(DataTableTest, CompactKeepsVersionsAfterSnapshot) {
+  const int kKeys = 60000;
+  DataTable* serial = NewTable(kKeys, 2, 0, 2);
+  DataTable* serial_new = NewTable(kKeys, 3, 0, 3);
+  seq_ = 0;
+  rnd_ = Random(301);
+  DataTable* parallel = NewTable(kKeys, 2, 0, 2);
+  DataTable* parallel_new = NewTable(kKeys, 3, 0, 3);
+  const int entries = entries_ / 2;
+  ASSERT_LEVELDB_OK(serial->Compact(serial_new, 0));
+  ASSERT_LEVELDB_OK(parallel->Compact(parallel_new, 0, &workers_));
+  ASSERT_EQ(entries, CountOrdered(serial));
+  ASSERT_TRUE(Contents(serial) == Contents(parallel));
+  serial_new->Unref();
+  parallel_new->Unref();
+
+  // The last table copies them again
+  DataTable* serial_last = new DataTable(icmp_, options_);
+  DataTable* last = new DataTable(icmp_, options_);
+  serial_last->Ref();
+  last->Ref();
+  DataTable* first = NewTable(kKeys, 5, 0, 2);
+  ASSERT_LEVELDB_OK(serial_last->Compact(first, 0));
+  ASSERT_LEVELDB_OK(last->Compact(first, 0));
+  ASSERT_LEVELDB_OK(serial_last->Compact(serial, 0));
+  ASSERT_LEVELDB_OK(last->Compact(parallel, 0, &workers_));
+  ASSERT_EQ(CountOrdered(first) + entries, CountOrdered(serial_last));
+  ASSERT_TRUE(Contents(serial_last) == Contents(last));
+  first->Unref();
+
+  serial->Unref();
+  parallel->Unref();
+  serial_last->Unref();
+  last->Unref();
+}
+
+TEST_F(DataTableTest, LastTableDropsDeletions) {
+  const int kKeys = 30000;
+  DataTable* serial_last = new DataTable(icmp_, options_);
+  DataTable* last = new DataTable(icmp_, options_);
+  serial_last->Ref();
+  last->Ref();
+  DataTable* first = NewTable(kKeys, 1, 0, 2);
+  ASSERT_LEVELDB_OK(serial_last->Compact(first, kMaxSequenceNumber));
+  ASSERT_LEVELDB_OK(last->Compact(first, kMaxSequenceNumber, &workers_));
+  first->Unref();
+  // Only the live version of every key is left
+  ASSERT_EQ(model_.size(), CountOrdered(last));
+  ASSERT_GT(last->table_.reclaimed, 0);
+
+  // A snapshot older than the deletions keeps them
+  const int live = CountOrdered(last);
+  const SequenceNumber snapshot = seq_;
+  DataTable* deletions = DeletionTable(kKeys, 3);
+  ASSERT_LEVELDB_OK(serial_last->Compact(deletions, snapshot));
+  ASSERT_LEVELDB_OK(last->Compact(deletions, snapshot, &workers_));
+  deletions->Unref();
+  ASSERT_EQ(live + kKeys / 3, CountOrdered(last));
+  ASSERT_TRUE(Contents(serial_last) == Contents(last));
+  CheckReads(last, kKeys);
+
+  // Without it they go together with the versions they shadow
+  deletions = DeletionTable(kKeys, 5);
+  ASSERT_LEVELDB_OK(serial_last->Compact(deletions, kMaxSequenceNumber));
+  ASSERT_LEVELDB_OK(last->Compact(deletions, kMaxSequenceNumber, &workers_));
+  deletions->Unref();
+  ASSERT_GE(last->table_.reclaimed, static_cast<size_t>(kKeys / 5));
+  // The ranges may also drop versions that the deletions kept above
+  // shadow next to their bounds
+  for (DataTable* dt : {serial_last, last}) {
+    for (const std::string& entry : Contents(dt)) {
+      const int i = std::stoi(entry.substr(3, 8));
+      ASSERT_NE(0, i % 5) << entry;
+    }
+    CheckReads(dt, kKeys);
+  }
+
+  serial_last->Unref();
+  last->Unref();
+}
+
+// Merges that replace the smallest key move smallest to the new version
+TEST_F(DataTableTest, SmallestFollowsOverwrites) {
+  DataTable* mid = NewTable(100, 1, 0);
+  DataTable* last = new DataTable(icmp_, options_);
+  last->Ref();
+  DataTable* dt = NewTable(100, 1, 0);
+  ASSERT_LEVELDB_OK(last->Compact(dt, kMaxSequenceNumber));
+  dt->Unref();
+  for (int round = 0; round < 20; round++) {
+    dt = NewTable(100, 1, 0);
+    ASSERT_LEVELDB_OK(mid->Compact(dt, kMaxSequenceNumber));
+    dt->Unref();
+    dt = NewTable(100, 1, 0);
+    ASSERT_LEVELDB_OK(last->Compact(dt, kMaxSequenceNumber));
+    dt->Unref();
+    for (DataTable* table : {mid, last}) {
+      ASSERT_EQ(table->table_.head_->Next(0), table->table_.smallest);
+    }
+  }
+  mid->Unref();
+  last->Unref();
+}
+
+TEST_F(DataTableTest, LastTableFilterFollowsKeys) {
+  const int kKeys = 30000;
+  DataTable* serial_last = new DataTable(icmp_, options_);
+  DataTable* last = new DataTable(icmp_, options_);
+  serial_last->Ref();
+  last->Ref();
+  DataTable* first = NewTable(kKeys, 1, 0, 2);
+  ASSERT_LEVELDB_OK(serial_last->Compact(first, kMaxSequenceNumber));
+  ASSERT_LEVELDB_OK(last->Compact(first, kMaxSequenceNumber, &workers_));
+  first->Unref();
+  DataTable* deletions = DeletionTable(kKeys, 5);
+  ASSERT_LEVELDB_OK(serial_last->Compact(deletions, kMaxSequenceNumber));
+  ASSERT_LEVELDB_OK(last->Compact(deletions, kMaxSequenceNumber, &workers_));
+  deletions->Unref();
+
+  // Keys left the filter together with their last version
+  Epoch::Guard guard(FilterLimbo()->epoch());
+  for (DataTable* dt : {serial_last, last}) {
+    int absent = 0;
+    int filtered = 0;
+    for (int i = 0; i < kKeys; i++) {
+      LookupKey lkey(Key(i), kMaxSequenceNumber);
+      if (model_.count(Key(i)) != 0) {
+        ASSERT_TRUE(dt->MayContain(lkey)) << i;
+      } else {
+        absent++;
+        if (!dt->MayContain(lkey)) filtered++;
+      }
+    }
+    ASSERT_GE(absent, kKeys / 5);
+    ASSERT_GE(filtered, absent * 99 / 100);
+  }
+
+  serial_last->Unref();
+  last->Unref();
+}
+
+// Readers look keys up in the newer table first, like a Version does, and
+// scan the older one while the compaction moves nodes between them.
+TEST_F(DataTableTest, ReadsDuringCompact) {
+  const int kKeys = 30000;
+  for (bool parallel : {false, true}) {
+    model_.clear();
+    DataTable* old_table = NewTable(kKeys, 2, 0, 2);
+    DataTable* new_table = NewTable(kKeys, 3, 0, 2);
+    std::atomic<bool> done(false);
+    std::atomic<int> bad(0);
+    auto lookup = [&](uint32_t seed) {
+      Random rnd(seed);
+      do {
+        const std::string key = Key(rnd.Uniform(kKeys));
+        LookupKey lkey(key, kMaxSequenceNumber);
+        std::string value;
+        Status s;
+        const bool found = new_table->Get(lkey, &value, s) ||
+                           old_table->Get(lkey, &value, s);
+        auto it = model_.find(key);
+        if (it == model_.end() ? found && s.ok()
+                               : !found || !s.ok() || it->second != value) {
+          bad++;
+        }
+      } while (!done.load(std::memory_order_acquire));
+    };
+    auto scan = [&]() {
+      do {
+        std::string last;
+        Iterator* iter = old_table->NewIterator();
+        for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+          if (!last.empty() && icmp_.Compare(last, iter->key()) >= 0) {
+            bad++;
+          }
+          last = iter->key().ToString();
+        }
+        delete iter;
+      } while (!done.load(std::memory_order_acquire));
+    };
+    std::thread readers[] = {std::thread(lookup, 1), std::thread(lookup, 2),
+                             std::thread(scan)};
+    Status s = parallel ? old_table->Compact(new_table, kMaxSequenceNumber,
+                                             &workers_)
+                        : old_table->Compact(new_table, kMaxSequenceNumber);
+    done.store(true, std::memory_order_release);
+    for (std::thread& t : readers) {
+      t.join();
+    }
+    ASSERT_LEVELDB_OK(s);
+    ASSERT_EQ(0, bad.load()) << (parallel ? "parallel" : "serial");
+    CheckReads(old_table, kKeys);
+    new_table->Unref();
+    old_table->Unref();
+  }
+}
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -8,6 +8,7 @@
 #include <atomic>
 #include <cstdint>
 #include <cstdio>
+#include <deque>
 #include <set>
 #include <string>
 #include <vector>
@@ -35,6 +36,7 @@
 #include "util/coding.h"
 #include "util/logging.h"
 #include "util/mutexlock.h"
+#include "util/nvm_log.h"
 #include "db/global.h"
 #include "numa.h"
 
@@ -45,15 +47,78 @@ const int kNumNonTableCacheFiles = 10;
 // Information kept for every waiting writer
 struct DBImpl::Writer {
   explicit Writer(port::Mutex* mu)
-      : batch(nullptr), sync(false), done(false), cv(mu) {}
+      : batch(nullptr),
+        sync(false),
+        done(false),
+        insert_into(nullptr),
+        leader(nullptr),
+        pending_inserts(0),
+        cv(mu) {}
 
   Status status;
   WriteBatch* batch;
   bool sync;
   bool done;
+
+  // Set by the group leader when this writer is to insert its own batch
+  // (allow_concurrent_memtable_write)
+  MemTable* insert_into;
+  Writer* leader;
+  // Group members that have not finished inserting, kept by the leader
+  int pending_inserts;
+
   port::CondVar cv;
 };
 
+// A batch group between the log and the memtable stage of a pipelined write
+struct DBImpl::WriteGroup {
+  std::vector<Writer*> writers;  // writers[0] leads the group
+  MemTable* mem;                 // Memtable matching the log written to
+  SequenceNumber last_sequence;  // Published once the group is applied
+  size_t bytes;                  // MemTableCharge() of the group
+};
+
+// A memtable has this much room past write_buffer_size for the write
+// groups let in before it reached that size.  Its arena is a single block,
+// which a flush copies as a whole, so no group may take more.
+static const size_t kMemTableSlack = 2 * 1024 * 1024;
+
+// Most memtable arena bytes that applying "batch" takes
+static size_t MemTableCharge(const WriteBatch* batch) {
+  return WriteBatchInternal::ByteSize(batch) +
+         WriteBatchInternal::Count(batch) * MemTable::MaxEntryOverhead();
+}
+
+// Arena size of a memtable that first takes a group of "charge" bytes.  A
+// batch larger than the slack gets a memtable large enough for it.
+static size_t MemTableCapacity(const Options& options, size_t charge) {
+  return options.write_buffer_size + std::max(charge, kMemTableSlack);
+}
+
+// The memtables and version that a read looks at.  Readers pin one with
+// atomic operations only, see AcquireSuperVersion().
+struct DBImpl::SuperVersion {
+  MemTable* mem;
+  MemTable* imm;  // nullptr if there is no immutable memtable
+  Version* current;
+  std::atomic<int> refs;
+
+  // Read slot value of a thread that is using the super version it took
+  // out of the slot.  An empty slot (nullptr) means nothing is cached.
+  static SuperVersion* const kInUse;
+};
+
+namespace {
+
+char super_version_in_use;
+
+std::atomic<uint64_t> next_db_id(0);
+
+}  // namespace
+
+DBImpl::SuperVersion* const DBImpl::SuperVersion::kInUse =
+    reinterpret_cast<DBImpl::SuperVersion*>(&super_version_in_use);
+
 struct DBImpl::CompactionState {
   // Files produced by compaction
   struct Output {
@@ -106,6 +171,8 @@ Options SanitizeOptions(const std::string& dbname,
   ClipToRange(&result.write_buffer_size, 64 << 10, 1 << 30);
   ClipToRange(&result.max_file_size, 1 << 20, 1 << 30);
   ClipToRange(&result.block_size, 1 << 10, 4 << 20);
+  ClipToRange(&result.flush_threads, 1, 64);
+  ClipToRange(&result.compaction_threads, 1, 64);
   if (result.info_log == nullptr) {
     // Open a log file in the same directory as the db
     src.env->CreateDir(dbname);  // In case it does not exist
@@ -151,12 +218,18 @@ DBImpl::DBImpl(const Options& raw_options, const std::string& dbname)
       logfile_number_(0),
       log_(nullptr),
       seed_(0),
+      super_version_(nullptr),
+      id_(next_db_id.fetch_add(1, std::memory_order_relaxed)),
       tmp_batch_(new WriteBatch),
+      pending_memtable_bytes_(0),
       //background_compaction_scheduled_(false),
       manual_compaction_(nullptr),
       //modify by mio
       versions_(new VersionSet(dbname_, &options_, /*table_cache_,*/
-                               &internal_comparator_)) {
+                               &internal_comparator_)),
+      nvm_pool_(nullptr),
+      flush_workers_(new WorkerPool(options_.flush_threads - 1)),
+      compaction_workers_(new WorkerPool(options_.compaction_threads - 1)) {
   
   for (int i = 0; i < config::kNumLevels; i++) {
     background_compaction_scheduled_[i] = false;
@@ -177,6 +250,13 @@ DBImpl::~DBImpl() {
       counter++;
     }
   }
+  for (std::atomic<SuperVersion*>* slot : read_slots_) {
+    SuperVersion* cached = slot->load(std::memory_order_relaxed);
+    assert(cached != SuperVersion::kInUse);
+    if (cached != nullptr) UnrefSuperVersionLocked(cached);
+    delete slot;
+  }
+  if (super_version_ != nullptr) UnrefSuperVersionLocked(super_version_);
   mutex_.Unlock();
 
   if (db_lock_ != nullptr) {
@@ -184,6 +264,8 @@ DBImpl::~DBImpl() {
   }
 
   delete versions_;
+  delete flush_workers_;
+  delete compaction_workers_;
   if (mem_ != nullptr) mem_->Unref();
   if (imm_ != nullptr) imm_->Unref();
   delete tmp_batch_;
@@ -191,6 +273,14 @@ DBImpl::~DBImpl() {
   delete logfile_;
   //delete by mio
   //delete table_cache_;
+  if (nvm_pool_ != nullptr) {
+    // All datatables are gone, their data stays in the pool file.  Blooms
+    // they retired free their regions into nvm_pool, which must still be
+    // this pool when they do.
+    FilterLimbo()->Drain();
+    delete nvm_pool_;
+    nvm_pool = nullptr;
+  }
 
   if (owns_info_log_) {
     delete options_.info_log;
@@ -336,12 +426,14 @@ Status DBImpl::Recover(VersionEdit* edit, bool* save_manifest) {
     return s;
   }
 
+  bool created = false;
   if (!env_->FileExists(CurrentFileName(dbname_))) {
     if (options_.create_if_missing) {
       s = NewDB();
       if (!s.ok()) {
         return s;
       }
+      created = true;
     } else {
       return Status::InvalidArgument(
           dbname_, "does not exist (create_if_missing is false)");
@@ -353,6 +445,19 @@ Status DBImpl::Recover(VersionEdit* edit, bool* save_manifest) {
     }
   }
 
+  if (!options_.nvm_pool_path.empty()) {
+    if (nvm_pool != nullptr) {
+      return Status::InvalidArgument(options_.nvm_pool_path,
+                                     "an nvm pool is already open");
+    }
+    s = NvmPool::Open(options_.nvm_pool_path, options_.nvm_pool_size,
+                      created, &nvm_pool_);
+    if (!s.ok()) {
+      return s;
+    }
+    nvm_pool = nvm_pool_;
+  }
+
   s = versions_->Recover(save_manifest);
   if (!s.ok()) {
     return s;
@@ -373,24 +478,17 @@ Status DBImpl::Recover(VersionEdit* edit, bool* save_manifest) {
   if (!s.ok()) {
     return s;
   }
-  std::set<uint64_t> expected;
-  versions_->AddLiveFiles(&expected);
+  // Datatables live in memory or in the nvm pool, there are no table files
+  // to check for.
   uint64_t number;
   FileType type;
   std::vector<uint64_t> logs;
   for (size_t i = 0; i < filenames.size(); i++) {
     if (ParseFileName(filenames[i], &number, &type)) {
-      expected.erase(number);
       if (type == kLogFile && ((number >= min_log) || (number == prev_log)))
         logs.push_back(number);
     }
   }
-  if (!expected.empty()) {
-    char buf[50];
-    std::snprintf(buf, sizeof(buf), "%d missing files; e.g.",
-                  static_cast<int>(expected.size()));
-    return Status::Corruption(buf, TableFileName(dbname_, *(expected.begin())));
-  }
 
   // Recover in the order in which the logs were generated
   std::sort(logs.begin(), logs.end());
@@ -468,9 +566,23 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
       continue;
     }
     WriteBatchInternal::SetContents(&batch, record);
+    const size_t charge = MemTableCharge(&batch);
 
+    if (mem != nullptr &&
+        mem->ApproximateMemoryUsage() + charge > mem->Capacity()) {
+      // A batch larger than the slack, it goes into a memtable of its own
+      compactions++;
+      *save_manifest = true;
+      status = WriteLevel0Table(mem, edit);
+      mem->Unref();
+      mem = nullptr;
+      if (!status.ok()) {
+        break;
+      }
+    }
     if (mem == nullptr) {
-      mem = new MemTable(internal_comparator_, options_.write_buffer_size + 2 * 1024 * 1024);
+      mem = new MemTable(internal_comparator_,
+                         MemTableCapacity(options_, charge), options_);
       mem->Ref();
     }
     status = WriteBatchInternal::InsertInto(&batch, mem);
@@ -500,8 +612,10 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
 
   delete file;
 
-  // See if we should keep reusing the last log file.
-  if (status.ok() && options_.reuse_logs && last_log && compactions == 0) {
+  // See if we should keep reusing the last log file.  An nvm log cannot be
+  // appended to after it has been closed.
+  if (status.ok() && options_.reuse_logs && !options_.use_nvm_log &&
+      last_log && compactions == 0) {
     assert(logfile_ == nullptr);
     assert(log_ == nullptr);
     assert(mem_ == nullptr);
@@ -516,7 +630,8 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
         mem = nullptr;
       } else {
         // mem can be nullptr if lognum exists but was empty.
-        mem_ = new MemTable(internal_comparator_, options_.write_buffer_size + 2 * 1024 * 1024);
+        mem_ = new MemTable(internal_comparator_,
+                            MemTableCapacity(options_, 0), options_);
         mem_->Ref();
       }
     }
@@ -534,9 +649,23 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
   return status;
 }
 
+Status DBImpl::NewLogFile(uint64_t log_number, WritableFile** result) {
+  const std::string fname = LogFileName(dbname_, log_number);
+  if (options_.use_nvm_log) {
+    // A log holds about one memtable's worth of records
+    return NvmLogFile::Open(fname, options_.write_buffer_size + 2 * 1024 * 1024,
+                            result);
+  }
+  return env_->NewWritableFile(fname, result);
+}
+
 Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit) {
   mutex_.AssertHeld();
   const uint64_t start_micros = env_->NowMicros();
+  if (mem->NumEntries() == 0) {
+    // A forced switch of an empty memtable, there is no table to write
+    return Status::OK();
+  }
   FileMetaData meta;
   meta.number = versions_->NewFileNumber();
   pending_outputs_.insert(meta.number);
@@ -549,32 +678,48 @@ Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit) {
     mutex_.Unlock();
     // modify by mio 2020/7/3
     //s = BuildTable(dbname_, env_, options_, table_cache_, iter, &meta);
-    //uint64_t start = env_->NowMicros();
-    DataTable* newdt = new DataTable(internal_comparator_, mem, options_);
-	//uint64_t end = env_->NowMicros();
+    const uint64_t build_start = env_->NowMicros();
+    DataTable* newdt = new DataTable(internal_comparator_, mem, options_,
+                                     flush_workers_);
+    const uint64_t build_end = env_->NowMicros();
+    s = newdt->status();
+    if (s.ok() && nvm_pool != nullptr) {
+      // The table must be durable before the MANIFEST refers to it
+      newdt->Sync();
+    }
+    const uint64_t sync_end = env_->NowMicros();
 	dumptime += newdt->table_.dumptime;
     //std::cout << "newdt: " << newdt << " smallest: " << newdt->table_.smallest->key << std::endl;
     wa += newdt->table_.wa;
     meta.dt = newdt;
 
     uint32_t len;
-    const char* p = newdt->table_.smallest->key;
+    const char* p = newdt->table_.smallest->key();
     p = GetVarint32Ptr(p, p + 5, &len);
     meta.smallest.DecodeFrom(Slice(p, len));
     //std::cout << "smallest: " << meta.smallest.user_key().data() << std::endl;
 
-    p = newdt->table_.largest[0]->key;
+    p = newdt->table_.largest[0]->key();
     p = GetVarint32Ptr(p, p + 5, &len);
     meta.largest.DecodeFrom(Slice(p, len));
     //std::cout << "largest: " << meta.largest.user_key().data() << std::endl << std::endl;
 
     meta.file_size = newdt->ApproximateMemoryUsage();
-    s = Status::OK();
+    if (s.ok() && shutting_down_.load(std::memory_order_acquire)) {
+      // No version will take the table over, it is deleted below
+      s = Status::IOError("Deleting DB during memtable compaction");
+    }
     if (s.ok() && meta.file_size > 0) {
       edit->AddFile(0, meta.number, meta.file_size, meta.smallest,
                     meta.largest, meta.dt);
     }
     mutex_.Lock();
+    flush_stats_.count++;
+    flush_stats_.bytes += newdt->arena_.MemoryUsage();
+    flush_stats_.index_micros += newdt->table_.dumptime;
+    flush_stats_.copy_micros +=
+        build_end - build_start - newdt->table_.dumptime;
+    flush_stats_.sync_micros += sync_end - build_end;
   }
 
   Log(options_.info_log, "Level-0 table #%llu: %lld bytes %s",
@@ -588,6 +733,9 @@ Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit) {
   //stats.bytes_written = meta.file_size;
   stats.bytes_written = meta.dt->table_.wa;
   stats_[0].Add(stats);
+  if (!s.ok()) {
+    delete meta.dt;
+  }
 
   // nvm space
   /*if (!nvm_node_has_changed) {
@@ -612,10 +760,6 @@ void DBImpl::CompactMemTable() {
   //uint64_t end = env_->NowMicros();
   //dumptime += (end - start);
 
-  if (s.ok() && shutting_down_.load(std::memory_order_acquire)) {
-    s = Status::IOError("Deleting DB during memtable compaction");
-  }
-
   // Replace immutable memtable with the generated Table
   if (s.ok()) {
     edit.SetPrevLogNumber(0);
@@ -629,6 +773,7 @@ void DBImpl::CompactMemTable() {
     imm_->Unref();
     imm_ = nullptr;
     has_imm_.store(false, std::memory_order_release);
+    InstallSuperVersion();
     RemoveObsoleteFiles();
   } else {
     RecordBackgroundError(s);
@@ -636,20 +781,10 @@ void DBImpl::CompactMemTable() {
 }
 
 void DBImpl::CompactRange(const Slice* begin, const Slice* end) {
-  int max_level_with_files = 1;
-  {
-    MutexLock l(&mutex_);
-    Version* base = versions_->current();
-    for (int level = 1; level < config::kNumLevels; level++) {
-      if (base->OverlapInLevel(level, begin, end)) {
-        max_level_with_files = level;
-      }
-    }
-  }
+  // Datatables are merged whole once their level fills, there are no key
+  // range compactions for BackgroundCompaction() to run.  Waiting for one
+  // through TEST_CompactRange() would never return.
   TEST_CompactMemTable();  // TODO(sanjay): Skip if memtable does not overlap
-  for (int level = 0; level < max_level_with_files; level++) {
-    TEST_CompactRange(level, begin, end);
-  }
 }
 
 void DBImpl::TEST_CompactRange(int level, const Slice* begin,
@@ -820,6 +955,13 @@ void DBImpl::CleanupCompaction(CompactionState* compact) {
   delete compact;
 }
 
+WorkerPool* DBImpl::CompactionWorkers(DataTable* dt) {
+  if (dt->ApproximateMemoryUsage() < options_.parallel_compaction_size) {
+    return nullptr;
+  }
+  return compaction_workers_;
+}
+
 Status DBImpl::OpenCompactionOutputFile(CompactionState* compact) {
   assert(compact != nullptr);
   assert(compact->builder == nullptr);
@@ -906,13 +1048,13 @@ Status DBImpl::InstallCompactionResults(CompactionState* compact) {
   //compact->compaction->AddInputDeletions(compact->compaction->edit());
   const int level = compact->compaction->level();
   if (level == config::kNumLevels - 2) {
-    compact->compaction->edit()->RemoveFile(level, compact->compaction->input(0, 0)->dt);
+    compact->compaction->edit()->RemoveFile(level, compact->compaction->input(0, 0)->number);
     if (compact->compaction->input(0, 1) != nullptr) {
-      compact->compaction->edit()->RemoveFile(level + 1, compact->compaction->input(0, 1)->dt);
+      compact->compaction->edit()->RemoveFile(level + 1, compact->compaction->input(0, 1)->number);
     }
   } else {
-    compact->compaction->edit()->RemoveFile(level, compact->compaction->input(0, 0)->dt);
-    compact->compaction->edit()->RemoveFile(level, compact->compaction->input(0, 1)->dt);
+    compact->compaction->edit()->RemoveFile(level, compact->compaction->input(0, 0)->number);
+    compact->compaction->edit()->RemoveFile(level, compact->compaction->input(0, 1)->number);
   }
   
   for (size_t i = 0; i < compact->outputs.size(); i++) {
@@ -921,7 +1063,11 @@ Status DBImpl::InstallCompactionResults(CompactionState* compact) {
                                               out.smallest, out.largest, out.dt);
   }
   //std::cout << "LogAndApply in DoCompactionWork" << std::endl;
-  return versions_->LogAndApply(compact->compaction->edit(), &mutex_);
+  Status s = versions_->LogAndApply(compact->compaction->edit(), &mutex_);
+  if (s.ok()) {
+    InstallSuperVersion();
+  }
+  return s;
 }
 
 Status DBImpl::DoCompactionWork(CompactionState* compact) {
@@ -956,6 +1102,8 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
   SequenceNumber last_sequence_for_key = kMaxSequenceNumber;
   // modify by mio
   size_t readsum;
+  size_t reclaimed = 0;
+  NvmJournal* journal = nullptr;
   if (!shutting_down_.load(std::memory_order_acquire)) {
   //while (input->Valid() && !shutting_down_.load(std::memory_order_acquire)) {
     // Prioritize immutable compaction work
@@ -975,10 +1123,24 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
 
     int level = compact->compaction->level();
     CompactionState::Output out;
+    out.dt = nullptr;
     out.smallest.Clear();
     out.largest.Clear();
 
-    if (level == config::kNumLevels - 2) {
+    // Both kinds of compaction modify tables that the MANIFEST refers to,
+    // the table that is merged into the other one leaves it
+    if (nvm_pool != nullptr) {
+      const bool last = (level == config::kNumLevels - 2);
+      FileMetaData* absorbed = compact->compaction->input(0, last ? 0 : 1);
+      FileMetaData* target = compact->compaction->input(0, last ? 1 : 0);
+      status = nvm_pool->BeginUpdate(absorbed->number,
+                                     target != nullptr ? target->number : 0,
+                                     &journal);
+    }
+
+    if (!status.ok()) {
+      // No room for the journal, nothing was merged
+    } else if (level == config::kNumLevels - 2) {
       FileMetaData* largefmd = compact->compaction->input(0, 1);
       FileMetaData* smallfmd = compact->compaction->input(0, 0);
       
@@ -986,7 +1148,7 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
       
 
       if (largefmd == nullptr) {
-        largedt = new DataTable(internal_comparator_);
+        largedt = new DataTable(internal_comparator_, options_);
         out.number = versions_->NewFileNumber();
       } else {
         largedt = largefmd->dt;
@@ -999,22 +1161,35 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
       //std::cout << "Last Compaction in level" << level << " start" << std::endl;
       //std::cout << "smalltable: " << smalldt << " smallestkey: " << smalldt->table_.smallest->key << std::endl;
       //std::cout << "largetable: " << largedt << std::endl;
-      status = largedt->Compact(smalldt, compact->smallest_snapshot);
+      status = largedt->Compact(smalldt, compact->smallest_snapshot,
+                                CompactionWorkers(smalldt), journal);
+      if (status.ok()) {
+        status = largedt->status();
+      }
 	    wa += largedt->table_.wa;
+      reclaimed = largedt->table_.reclaimed;
       //std::cout << "Last Compaction complete" << std::endl;
 
-      out.dt = largedt;
-      
-      uint32_t len;
-      const char* p = largedt->table_.smallest->key;
-      p = GetVarint32Ptr(p, p + 5, &len);
-      out.smallest.DecodeFrom(Slice(p, len));
+      if (largedt->table_.smallest == nullptr) {
+        // Every key was deleted, the last level is left empty
+        if (largefmd == nullptr) {
+          delete largedt;
+        }
+        out.dt = nullptr;
+      } else {
+        out.dt = largedt;
 
-      p = largedt->table_.largest[0]->key;
-      p = GetVarint32Ptr(p, p + 5, &len);
-      out.largest.DecodeFrom(Slice(p, len));
+        uint32_t len;
+        const char* p = largedt->table_.smallest->key();
+        p = GetVarint32Ptr(p, p + 5, &len);
+        out.smallest.DecodeFrom(Slice(p, len));
 
-      out.file_size = largedt->ApproximateMemoryUsage();
+        p = largedt->table_.largest[0]->key();
+        p = GetVarint32Ptr(p, p + 5, &len);
+        out.largest.DecodeFrom(Slice(p, len));
+
+        out.file_size = largedt->ApproximateMemoryUsage();
+      }
       // nvm space
       /*if (!nvm_node_has_changed) {
         long tmp;
@@ -1029,30 +1204,41 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
       FileMetaData* newfmd = compact->compaction->input(0, 1);
       DataTable* olddt = oldfmd->dt;
       DataTable* newdt = newfmd->dt;
+      // The merged table keeps the number of the table it was merged into
+      out.number = oldfmd->number;
 
       readsum = 0;  // wrong, needs skiplist function support
 
       //std::cout << "Normal Compaction in level" << level << " start" << std::endl;
       //std::cout << "oldtable: " << olddt << " largestkey: " << olddt->table_.largest[0]->key << std::endl;
       //std::cout << "newtable: " << newdt << " smallestkey: " << newdt->table_.smallest->key << std::endl;
-      status = olddt->Compact(newdt, compact->smallest_snapshot);
+      status = olddt->Compact(newdt, compact->smallest_snapshot,
+                              CompactionWorkers(newdt), journal);
+      if (status.ok()) {
+        status = olddt->status();
+      }
 	    wa += olddt->table_.wa;
       //std::cout << "Normal Compaction complete" << std::endl;
 
       out.dt = olddt;
 
       uint32_t len;
-      const char* p = olddt->table_.smallest->key;
+      const char* p = olddt->table_.smallest->key();
       p = GetVarint32Ptr(p, p + 5, &len);
       out.smallest.DecodeFrom(Slice(p, len));
 
-      p = olddt->table_.largest[0]->key;
+      p = olddt->table_.largest[0]->key();
       p = GetVarint32Ptr(p, p + 5, &len);
       out.largest.DecodeFrom(Slice(p, len));
 
       out.file_size = olddt->ApproximateMemoryUsage();
     }
-    compact->outputs.push_back(out);
+    if (out.dt != nullptr) {
+      if (status.ok() && nvm_pool != nullptr) {
+        out.dt->Sync();
+      }
+      compact->outputs.push_back(out);
+    }
     
     /*Slice key = input->key();
     if (compact->compaction->ShouldStopBefore(key) &&
@@ -1136,7 +1322,10 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
     input->Next();*/
   }
 
-  if (status.ok() && shutting_down_.load(std::memory_order_acquire)) {
+  // Tables in the pool have already been merged in place, the MANIFEST has
+  // to catch up with them even when the DB is going away.
+  if (status.ok() && journal == nullptr &&
+      shutting_down_.load(std::memory_order_acquire)) {
     status = Status::IOError("Deleting DB during compaction");
   }
   /*if (status.ok() && compact->builder != nullptr) {
@@ -1161,6 +1350,7 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
     //stats.bytes_written += compact->outputs[i].file_size;
     stats.bytes_written += compact->outputs[i].dt->table_.wa;
   }
+  stats.bytes_reclaimed = reclaimed;
 
   mutex_.Lock();
   stats_[compact->compaction->level() + 1].Add(stats);
@@ -1168,6 +1358,10 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
   if (status.ok()) {
     status = InstallCompactionResults(compact);
   }
+  if (journal != nullptr) {
+    // Unless the MANIFEST records the merge, the next Open() rolls it back
+    nvm_pool->EndUpdate(journal, status.ok());
+  }
   if (!status.ok()) {
     RecordBackgroundError(status);
   }
@@ -1176,54 +1370,33 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
   return status;
 }
 
-namespace {
-
-struct IterState {
-  port::Mutex* const mu;
-  Version* const version GUARDED_BY(mu);
-  MemTable* const mem GUARDED_BY(mu);
-  MemTable* const imm GUARDED_BY(mu);
-
-  IterState(port::Mutex* mutex, MemTable* mem, MemTable* imm, Version* version)
-      : mu(mutex), version(version), mem(mem), imm(imm) {}
-};
-
-static void CleanupIteratorState(void* arg1, void* arg2) {
-  IterState* state = reinterpret_cast<IterState*>(arg1);
-  state->mu->Lock();
-  state->mem->Unref();
-  if (state->imm != nullptr) state->imm->Unref();
-  state->version->Unref();
-  state->mu->Unlock();
-  delete state;
+void DBImpl::CleanupSuperVersion(void* arg1, void* arg2) {
+  DBImpl* db = reinterpret_cast<DBImpl*>(arg1);
+  db->UnrefSuperVersion(reinterpret_cast<SuperVersion*>(arg2));
 }
 
-}  // anonymous namespace
-
 Iterator* DBImpl::NewInternalIterator(const ReadOptions& options,
                                       SequenceNumber* latest_snapshot,
                                       uint32_t* seed) {
-  mutex_.Lock();
+  SuperVersion* sv = AcquireSuperVersion();
   *latest_snapshot = versions_->LastSequence();
 
   // Collect together all needed child iterators
   std::vector<Iterator*> list;
-  list.push_back(mem_->NewIterator());
-  mem_->Ref();
-  if (imm_ != nullptr) {
-    list.push_back(imm_->NewIterator());
-    imm_->Ref();
+  list.push_back(sv->mem->NewIterator());
+  if (sv->imm != nullptr) {
+    list.push_back(sv->imm->NewIterator());
   }
-  versions_->current()->AddIterators(options, &list);
+  sv->current->AddIterators(options, &list);
   Iterator* internal_iter =
       NewMergingIterator(&internal_comparator_, &list[0], list.size());
-  versions_->current()->Ref();
 
-  IterState* cleanup = new IterState(&mutex_, mem_, imm_, versions_->current());
-  internal_iter->RegisterCleanup(CleanupIteratorState, cleanup, nullptr);
+  // The iterator keeps its own reference
+  sv->refs.fetch_add(1, std::memory_order_relaxed);
+  internal_iter->RegisterCleanup(CleanupSuperVersion, this, sv);
+  ReturnSuperVersion(sv);
 
-  *seed = ++seed_;
-  mutex_.Unlock();
+  *seed = seed_.fetch_add(1, std::memory_order_relaxed) + 1;
   return internal_iter;
 }
 
@@ -1241,7 +1414,7 @@ int64_t DBImpl::TEST_MaxNextLevelOverlappingBytes() {
 Status DBImpl::Get(const ReadOptions& options, const Slice& key,
                    std::string* value) {
   Status s;
-  MutexLock l(&mutex_);
+  SuperVersion* sv = AcquireSuperVersion();
   SequenceNumber snapshot;
   if (options.snapshot != nullptr) {
     snapshot =
@@ -1250,30 +1423,16 @@ Status DBImpl::Get(const ReadOptions& options, const Slice& key,
     snapshot = versions_->LastSequence();
   }
 
-  MemTable* mem = mem_;
-  MemTable* imm = imm_;
-  Version* current = versions_->current();
-  mem->Ref();
-  if (imm != nullptr) imm->Ref();
-  current->Ref();
-
-  bool have_stat_update = false;
   Version::GetStats stats;
 
-  // Unlock while reading from files and memtables
-  {
-    mutex_.Unlock();
-    // First look in the memtable, then in the immutable memtable (if any).
-    LookupKey lkey(key, snapshot);
-    if (mem->Get(lkey, value, &s)) {
-      // Done
-    } else if (imm != nullptr && imm->Get(lkey, value, &s)) {
-      // Done
-    } else {
-      s = current->Get(options, lkey, value, &stats);
-      have_stat_update = true;
-    }
-    mutex_.Lock();
+  // First look in the memtable, then in the immutable memtable (if any).
+  LookupKey lkey(key, snapshot);
+  if (sv->mem->Get(lkey, value, &s)) {
+    // Done
+  } else if (sv->imm != nullptr && sv->imm->Get(lkey, value, &s)) {
+    // Done
+  } else {
+    s = sv->current->Get(options, lkey, value, &stats);
   }
 
   /*if (have_stat_update && current->UpdateStats(stats)) {
@@ -1281,12 +1440,192 @@ Status DBImpl::Get(const ReadOptions& options, const Slice& key,
       MaybeScheduleCompaction(i);
     }
   }*/
-  mem->Unref();
-  if (imm != nullptr) imm->Unref();
-  current->Unref();
+  ReturnSuperVersion(sv);
   return s;
 }
 
+Status DBImpl::Get(const ReadOptions& options, const Slice& key,
+                   PinnableSlice* value) {
+  value->Reset();
+  Status s;
+  SuperVersion* sv = AcquireSuperVersion();
+  SequenceNumber snapshot;
+  if (options.snapshot != nullptr) {
+    snapshot =
+        static_cast<const SnapshotImpl*>(options.snapshot)->sequence_number();
+  } else {
+    snapshot = versions_->LastSequence();
+  }
+
+  Version::GetStats stats;
+  LookupKey lkey(key, snapshot);
+  Slice v;
+  if (sv->mem->Get(lkey, &v, &s)) {
+    value->PinSlice(v);
+  } else if (sv->imm != nullptr && sv->imm->Get(lkey, &v, &s)) {
+    value->PinSlice(v);
+  } else {
+    s = sv->current->Get(options, lkey, value, &stats);
+  }
+
+  if (s.ok()) {
+    // The tables of sv keep the value in place
+    sv->refs.fetch_add(1, std::memory_order_relaxed);
+    value->RegisterCleanup(CleanupSuperVersion, this, sv);
+  } else {
+    value->Reset();
+  }
+  ReturnSuperVersion(sv);
+  return s;
+}
+
+void DBImpl::MultiGet(const ReadOptions& options,
+                      const std::vector<Slice>& keys,
+                      std::vector<std::string>* values,
+                      std::vector<Status>* statuses) {
+  const int n = static_cast<int>(keys.size());
+  values->assign(n, std::string());
+  statuses->assign(n, Status());
+  SuperVersion* sv = AcquireSuperVersion();
+  SequenceNumber snapshot;
+  if (options.snapshot != nullptr) {
+    snapshot =
+        static_cast<const SnapshotImpl*>(options.snapshot)->sequence_number();
+  } else {
+    snapshot = versions_->LastSequence();
+  }
+
+  std::deque<LookupKey> lkeys;
+  std::vector<KeyLookup> lookups(n);
+  std::vector<KeyLookup*> pending(n);
+  for (int i = 0; i < n; i++) {
+    lkeys.emplace_back(keys[i], snapshot);
+    lookups[i] = KeyLookup{&lkeys.back(), &(*values)[i], &(*statuses)[i],
+                           false};
+    pending[i] = &lookups[i];
+  }
+  // Searches of neighbouring keys that run together share the nodes near
+  // the top of the lists
+  const Comparator* ucmp = internal_comparator_.user_comparator();
+  std::stable_sort(pending.begin(), pending.end(),
+                   [ucmp](const KeyLookup* a, const KeyLookup* b) {
+                     return ucmp->Compare(a->key->user_key(),
+                                          b->key->user_key()) < 0;
+                   });
+
+  // Same order as Get(): the memtable, the immutable memtable, the tables
+  auto drop_found = [&pending]() {
+    pending.erase(std::remove_if(pending.begin(), pending.end(),
+                                 [](const KeyLookup* l) { return l->found; }),
+                  pending.end());
+  };
+  sv->mem->MultiGet(pending.data(), static_cast<int>(pending.size()));
+  drop_found();
+  if (sv->imm != nullptr && !pending.empty()) {
+    sv->imm->MultiGet(pending.data(), static_cast<int>(pending.size()));
+    drop_found();
+  }
+  if (!pending.empty()) {
+    sv->current->MultiGet(options, pending.data(),
+                          static_cast<int>(pending.size()));
+  }
+  ReturnSuperVersion(sv);
+}
+
+void DBImpl::InstallSuperVersion() {
+  mutex_.AssertHeld();
+  SuperVersion* sv = new SuperVersion;
+  sv->mem = mem_;
+  sv->imm = imm_;
+  sv->current = versions_->current();
+  sv->refs.store(1, std::memory_order_relaxed);
+  sv->mem->Ref();
+  if (sv->imm != nullptr) sv->imm->Ref();
+  sv->current->Ref();
+
+  SuperVersion* old = super_version_;
+  super_version_ = sv;
+  // Take back the references cached by readers.  A slot that is in use
+  // is emptied as well, its reader drops the reference when done.
+  for (std::atomic<SuperVersion*>* slot : read_slots_) {
+    SuperVersion* cached = slot->exchange(nullptr, std::memory_order_acq_rel);
+    if (cached != nullptr && cached != SuperVersion::kInUse) {
+      UnrefSuperVersionLocked(cached);
+    }
+  }
+  if (old != nullptr) UnrefSuperVersionLocked(old);
+}
+
+DBImpl::SuperVersion* DBImpl::AcquireSuperVersion() {
+  std::atomic<SuperVersion*>* slot = ReadSlot();
+  SuperVersion* sv = slot->exchange(SuperVersion::kInUse,
+                                    std::memory_order_acquire);
+  assert(sv != SuperVersion::kInUse);
+  if (sv == nullptr) {
+    // First read since the last install
+    MutexLock l(&mutex_);
+    sv = super_version_;
+    sv->refs.fetch_add(1, std::memory_order_relaxed);
+  }
+  return sv;
+}
+
+void DBImpl::ReturnSuperVersion(SuperVersion* sv) {
+  std::atomic<SuperVersion*>* slot = ReadSlot();
+  SuperVersion* expected = SuperVersion::kInUse;
+  if (!slot->compare_exchange_strong(expected, sv,
+                                     std::memory_order_release)) {
+    // A newer super version was installed meanwhile
+    assert(expected == nullptr);
+    UnrefSuperVersion(sv);
+  }
+}
+
+void DBImpl::UnrefSuperVersion(SuperVersion* sv) {
+  if (sv->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    MutexLock l(&mutex_);
+    FreeSuperVersion(sv);
+  }
+}
+
+void DBImpl::UnrefSuperVersionLocked(SuperVersion* sv) {
+  mutex_.AssertHeld();
+  if (sv->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    FreeSuperVersion(sv);
+  }
+}
+
+void DBImpl::FreeSuperVersion(SuperVersion* sv) {
+  mutex_.AssertHeld();
+  sv->mem->Unref();
+  if (sv->imm != nullptr) sv->imm->Unref();
+  sv->current->Unref();
+  delete sv;
+}
+
+std::atomic<DBImpl::SuperVersion*>* DBImpl::ReadSlot() {
+  struct Entry {
+    uint64_t db;
+    std::atomic<SuperVersion*>* slot;
+  };
+  // Entries of closed DBs are never matched again.  Dropping entries only
+  // costs a new slot, the old one stays with its DB until it is closed.
+  static thread_local std::vector<Entry> entries;
+  for (const Entry& e : entries) {
+    if (e.db == id_) return e.slot;
+  }
+  if (entries.size() >= 16) {
+    entries.clear();
+  }
+  std::atomic<SuperVersion*>* slot = new std::atomic<SuperVersion*>(nullptr);
+  {
+    MutexLock l(&mutex_);
+    read_slots_.push_back(slot);
+  }
+  entries.push_back(Entry{id_, slot});
+  return slot;
+}
+
 Iterator* DBImpl::NewIterator(const ReadOptions& options) {
   SequenceNumber latest_snapshot;
   uint32_t seed;
@@ -1335,20 +1674,57 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* updates) {
 
   MutexLock l(&mutex_);
   writers_.push_back(&w);
-  while (!w.done && &w != writers_.front()) {
+  while (!w.done && w.insert_into == nullptr && &w != writers_.front()) {
     w.cv.Wait();
   }
+  if (w.insert_into != nullptr) {
+    // The leader has logged our batch, apply it alongside the rest of the
+    // group and wait for the leader to finish the group.
+    MemTable* mem = w.insert_into;
+    w.insert_into = nullptr;
+    mutex_.Unlock();
+    Status s = WriteBatchInternal::InsertInto(w.batch, mem, true);
+    mutex_.Lock();
+    if (!s.ok() && w.leader->status.ok()) {
+      w.leader->status = s;
+    }
+    if (--w.leader->pending_inserts == 0) {
+      w.leader->cv.Signal();
+    }
+    while (!w.done) {
+      w.cv.Wait();
+    }
+  }
   if (w.done) {
     return w.status;
   }
+  if (options_.enable_pipelined_write && updates != nullptr) {
+    return PipelinedWrite(options, &w);
+  }
 
   // May temporarily unlock and wait.
-  Status status = MakeRoomForWrite(updates == nullptr);
+  Status status = MakeRoomForWrite(
+      updates == nullptr, updates == nullptr ? 0 : MemTableCharge(updates));
   uint64_t last_sequence = versions_->LastSequence();
   Writer* last_writer = &w;
   if (status.ok() && updates != nullptr) {  // nullptr batch is for compactions
     WriteBatch* write_batch = BuildBatchGroup(&last_writer);
     WriteBatchInternal::SetSequence(write_batch, last_sequence + 1);
+    const bool concurrent = options_.allow_concurrent_memtable_write;
+    std::vector<Writer*> group;  // Starts with &w
+    if (concurrent && last_writer != &w) {
+      // Every writer inserts its own batch, give each its part of the
+      // group's sequence numbers
+      SequenceNumber seq = last_sequence + 1;
+      for (Writer* member : writers_) {
+        group.push_back(member);
+        if (member->batch != nullptr) {
+          WriteBatchInternal::SetSequence(member->batch, seq);
+          seq += WriteBatchInternal::Count(member->batch);
+        }
+        if (member == last_writer) break;
+      }
+    }
     last_sequence += WriteBatchInternal::Count(write_batch);
 
     // Add to log and apply to memtable.  We can release the lock
@@ -1366,7 +1742,13 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* updates) {
         }
       }
       if (status.ok()) {
-        status = WriteBatchInternal::InsertInto(write_batch, mem_);
+        if (!concurrent) {
+          status = WriteBatchInternal::InsertInto(write_batch, mem_);
+        } else if (last_writer == &w) {
+          status = WriteBatchInternal::InsertInto(w.batch, mem_, true);
+        } else {
+          status = InsertGroupConcurrently(group, mem_);
+        }
       }
       mutex_.Lock();
       if (sync_error) {
@@ -1400,6 +1782,150 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* updates) {
   return status;
 }
 
+Status DBImpl::InsertGroupConcurrently(const std::vector<Writer*>& group,
+                                       MemTable* mem) {
+  Writer* leader = group[0];
+  mutex_.Lock();
+  leader->status = Status::OK();
+  leader->pending_inserts = 0;
+  for (size_t i = 1; i < group.size(); i++) {
+    Writer* member = group[i];
+    if (member->batch != nullptr) {
+      member->insert_into = mem;
+      member->leader = leader;
+      leader->pending_inserts++;
+      member->cv.Signal();
+    }
+  }
+  mutex_.Unlock();
+
+  Status s = WriteBatchInternal::InsertInto(leader->batch, mem, true);
+
+  mutex_.Lock();
+  while (leader->pending_inserts > 0) {
+    leader->cv.Wait();
+  }
+  if (s.ok()) {
+    s = leader->status;
+  }
+  mutex_.Unlock();
+  return s;
+}
+
+Status DBImpl::PipelinedWrite(const WriteOptions& options, Writer* w) {
+  mutex_.AssertHeld();
+  WriteGroup group;
+  Writer* last_writer = w;
+  // May temporarily unlock and wait.
+  Status status = MakeRoomForWrite(false, MemTableCharge(w->batch));
+  if (status.ok()) {
+    WriteBatch* write_batch = BuildBatchGroup(&last_writer);
+
+    // Groups still in the memtable stage have taken sequence numbers that
+    // are not published yet, continue after the last of them.
+    SequenceNumber last_sequence =
+        memtable_writers_.empty() ? versions_->LastSequence()
+                                  : memtable_writers_.back()->last_sequence;
+    WriteBatchInternal::SetSequence(write_batch, last_sequence + 1);
+
+    // write_batch may be tmp_batch_, which the next group reuses as soon
+    // as this one leaves the log stage.  The memtable stage applies every
+    // member's own batch instead, each with its part of the sequence.
+    for (Writer* member : writers_) {
+      assert(member->batch != nullptr);
+      group.writers.push_back(member);
+      WriteBatchInternal::SetSequence(member->batch, last_sequence + 1);
+      last_sequence += WriteBatchInternal::Count(member->batch);
+      if (member == last_writer) break;
+    }
+    group.mem = mem_;
+    group.last_sequence = last_sequence;
+    group.bytes = MemTableCharge(write_batch);
+    // Join the memtable stage before logging, MakeRoomForWrite() must not
+    // switch the log or retire group.mem while the lock is released.
+    memtable_writers_.push_back(&group);
+    pending_memtable_bytes_ += group.bytes;
+
+    mutex_.Unlock();
+    status = log_->AddRecord(WriteBatchInternal::Contents(write_batch));
+    bool sync_error = false;
+    if (status.ok() && options.sync) {
+      status = logfile_->Sync();
+      if (!status.ok()) {
+        sync_error = true;
+      }
+    }
+    mutex_.Lock();
+    if (sync_error) {
+      // The state of the log file is indeterminate: the log record we
+      // just added may or may not show up when the DB is re-opened.
+      // So we force the DB into a mode where all future writes fail.
+      RecordBackgroundError(status);
+    }
+    if (write_batch == tmp_batch_) tmp_batch_->Clear();
+  }
+
+  // Leave the log stage and let the next group start logging
+  while (true) {
+    Writer* ready = writers_.front();
+    writers_.pop_front();
+    if (!status.ok() && ready != w) {
+      ready->status = status;
+      ready->done = true;
+      ready->cv.Signal();
+    }
+    if (ready == last_writer) break;
+  }
+  if (!writers_.empty()) {
+    writers_.front()->cv.Signal();
+  }
+  if (group.writers.empty()) {
+    return status;
+  }
+
+  // Apply the group once every group logged before it is applied, so that
+  // sequence numbers are published in order.  A group whose log record
+  // failed only waits for its turn to leave.
+  while (memtable_writers_.front() != &group) {
+    w->cv.Wait();
+  }
+  const bool logged = status.ok();
+  if (logged) {
+    mutex_.Unlock();
+    if (options_.allow_concurrent_memtable_write && group.writers.size() > 1) {
+      status = InsertGroupConcurrently(group.writers, group.mem);
+    } else {
+      const bool concurrent = options_.allow_concurrent_memtable_write;
+      for (size_t i = 0; i < group.writers.size() && status.ok(); i++) {
+        status = WriteBatchInternal::InsertInto(group.writers[i]->batch,
+                                                group.mem, concurrent);
+      }
+    }
+    mutex_.Lock();
+    versions_->SetLastSequence(group.last_sequence);
+  }
+  memtable_writers_.pop_front();
+  pending_memtable_bytes_ -= group.bytes;
+  if (!memtable_writers_.empty()) {
+    memtable_writers_.front()->writers[0]->cv.Signal();
+  } else {
+    // MakeRoomForWrite() may be waiting to retire group.mem
+    background_work_finished_signal_.SignalAll();
+  }
+  if (!logged) {
+    // The other members were told in the log stage
+    return status;
+  }
+
+  for (size_t i = 1; i < group.writers.size(); i++) {
+    Writer* ready = group.writers[i];
+    ready->status = status;
+    ready->done = true;
+    ready->cv.Signal();
+  }
+  return status;
+}
+
 // REQUIRES: Writer list must be non-empty
 // REQUIRES: First writer must have a non-null batch
 WriteBatch* DBImpl::BuildBatchGroup(Writer** last_writer) {
@@ -1410,6 +1936,7 @@ WriteBatch* DBImpl::BuildBatchGroup(Writer** last_writer) {
   assert(result != nullptr);
 
   size_t size = WriteBatchInternal::ByteSize(first->batch);
+  size_t charge = MemTableCharge(first->batch);
 
   // Allow the group to grow up to a maximum size, but if the
   // original write is small, limit the growth so we do not slow
@@ -1429,12 +1956,23 @@ WriteBatch* DBImpl::BuildBatchGroup(Writer** last_writer) {
       break;
     }
 
+    if (w->batch == nullptr && options_.enable_pipelined_write) {
+      // Pipelined groups apply every member's batch, the compaction's
+      // writer leads its own group and forces the memtable switch itself
+      break;
+    }
+
     if (w->batch != nullptr) {
       size += WriteBatchInternal::ByteSize(w->batch);
       if (size > max_size) {
         // Do not make batch too big
         break;
       }
+      charge += MemTableCharge(w->batch);
+      if (charge > kMemTableSlack) {
+        // The group has to fit in what is left of the memtable
+        break;
+      }
 
       // Append to *result
       if (result == first->batch) {
@@ -1452,7 +1990,7 @@ WriteBatch* DBImpl::BuildBatchGroup(Writer** last_writer) {
 
 // REQUIRES: mutex_ is held
 // REQUIRES: this thread is currently at the front of the writer queue
-Status DBImpl::MakeRoomForWrite(bool force) {
+Status DBImpl::MakeRoomForWrite(bool force, size_t charge) {
   mutex_.AssertHeld();
   assert(!writers_.empty());
   bool allow_delay = !force;
@@ -1477,7 +2015,9 @@ Status DBImpl::MakeRoomForWrite(bool force) {
       allow_delay = false;  // Do not delay a single write more than once
       mutex_.Lock();*/
     } else if (!force &&
-               (mem_->ApproximateMemoryUsage() <= options_.write_buffer_size)) {
+               (mem_->ApproximateMemoryUsage() + pending_memtable_bytes_ +
+                    std::max(charge, kMemTableSlack) <=
+                mem_->Capacity())) {
       // There is room in current memtable
       // mem_->ApproximateMemoryUsage() + MemTable::Add():encoded_length <= options_write_buffer_size!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
       break;
@@ -1496,12 +2036,16 @@ Status DBImpl::MakeRoomForWrite(bool force) {
       // There are too many level-0 files.
       Log(options_.info_log, "Too many L0 files; waiting...\n");
       background_work_finished_signal_.Wait();*/
+    } else if (!memtable_writers_.empty()) {
+      // Pipelined groups may still be writing log_ and all of them go to
+      // mem_, let them finish before either is switched.
+      background_work_finished_signal_.Wait();
     } else {
       // Attempt to switch to a new memtable and trigger compaction of old
       assert(versions_->PrevLogNumber() == 0);
       uint64_t new_log_number = versions_->NewFileNumber();
       WritableFile* lfile = nullptr;
-      s = env_->NewWritableFile(LogFileName(dbname_, new_log_number), &lfile);
+      s = NewLogFile(new_log_number, &lfile);
       if (!s.ok()) {
         // Avoid chewing through file number space in a tight loop.
         versions_->ReuseFileNumber(new_log_number);
@@ -1514,8 +2058,10 @@ Status DBImpl::MakeRoomForWrite(bool force) {
       log_ = new log::Writer(lfile);
       imm_ = mem_;
       has_imm_.store(true, std::memory_order_release);
-      mem_ = new MemTable(internal_comparator_, options_.write_buffer_size + 2 * 1024 * 1024);
+      mem_ = new MemTable(internal_comparator_,
+                          MemTableCapacity(options_, charge), options_);
       mem_->Ref();
+      InstallSuperVersion();
       force = false;  // Do not force another compaction if have room
       /*for (int i = 0; i < config::kNumLevels; i++) {
         MaybeScheduleCompaction(i);
@@ -1552,21 +2098,36 @@ bool DBImpl::GetProperty(const Slice& property, std::string* value) {
     char buf[200];
     std::snprintf(buf, sizeof(buf),
                   "                               Compactions\n"
-                  "Level  Files Size(MB) Time(sec) Read(MB) Write(MB)\n"
-                  "--------------------------------------------------\n");
+                  "Level  Files Size(MB) Time(sec) Read(MB) Write(MB) "
+                  "Reclaimed(MB)\n"
+                  "--------------------------------------------------"
+                  "--------------\n");
     value->append(buf);
     for (int level = 0; level < config::kNumLevels; level++) {
       int files = versions_->NumLevelFiles(level);
       if (stats_[level].micros > 0 || files > 0) {
-        std::snprintf(buf, sizeof(buf), "%3d %8d %8.0f %9.0f %8.0f %9.0f\n",
-                      level, files, versions_->NumLevelBytes(level) / 1048576.0,
+        std::snprintf(buf, sizeof(buf),
+                      "%3d %8d %8.0f %9.0f %8.0f %9.0f %13.0f\n", level,
+                      files, versions_->NumLevelBytes(level) / 1048576.0,
                       stats_[level].micros / 1e6,
                       stats_[level].bytes_read / 1048576.0,
-                      stats_[level].bytes_written / 1048576.0);
+                      stats_[level].bytes_written / 1048576.0,
+                      stats_[level].bytes_reclaimed / 1048576.0);
         value->append(buf);
       }
     }
     return true;
+  } else if (in == "flush-stats") {
+    char buf[200];
+    const FlushStats& f = flush_stats_;
+    std::snprintf(buf, sizeof(buf),
+                  "flushes: %lld, copied(MB): %.1f, threads: %d\n"
+                  "copy(sec): %.3f, index(sec): %.3f, sync(sec): %.3f\n",
+                  static_cast<long long>(f.count), f.bytes / 1048576.0,
+                  flush_workers_->Parallelism(), f.copy_micros / 1e6,
+                  f.index_micros / 1e6, f.sync_micros / 1e6);
+    value->append(buf);
+    return true;
   } else if (in == "sstables") {
     *value = versions_->current()->DebugString();
     return true;
@@ -1620,6 +2181,34 @@ Status DB::Delete(const WriteOptions& opt, const Slice& key) {
   return Write(opt, &batch);
 }
 
+Status DB::Get(const ReadOptions& options, const Slice& key,
+               PinnableSlice* value) {
+  std::string copy;
+  Status s = Get(options, key, &copy);
+  value->Reset();
+  if (s.ok()) {
+    value->PinSelf(copy);
+  }
+  return s;
+}
+
+void DB::MultiGet(const ReadOptions& options, const std::vector<Slice>& keys,
+                  std::vector<std::string>* values,
+                  std::vector<Status>* statuses) {
+  values->assign(keys.size(), std::string());
+  statuses->assign(keys.size(), Status());
+  ReadOptions read = options;
+  if (read.snapshot == nullptr) {
+    read.snapshot = GetSnapshot();
+  }
+  for (size_t i = 0; i < keys.size(); i++) {
+    (*statuses)[i] = Get(read, keys[i], &(*values)[i]);
+  }
+  if (options.snapshot == nullptr) {
+    ReleaseSnapshot(read.snapshot);
+  }
+}
+
 DB::~DB() = default;
 
 Status DB::Open(const Options& options, const std::string& dbname, DB** dbptr) {
@@ -1635,14 +2224,15 @@ Status DB::Open(const Options& options, const std::string& dbname, DB** dbptr) {
     // Create new log and a corresponding memtable.
     uint64_t new_log_number = impl->versions_->NewFileNumber();
     WritableFile* lfile;
-    s = options.env->NewWritableFile(LogFileName(dbname, new_log_number),
-                                     &lfile);
+    s = impl->NewLogFile(new_log_number, &lfile);
     if (s.ok()) {
       edit.SetLogNumber(new_log_number);
       impl->logfile_ = lfile;
       impl->logfile_number_ = new_log_number;
       impl->log_ = new log::Writer(lfile);
-      impl->mem_ = new MemTable(impl->internal_comparator_, options.write_buffer_size + 2 * 1024 * 1024);
+      impl->mem_ = new MemTable(impl->internal_comparator_,
+                                MemTableCapacity(impl->options_, 0),
+                                impl->options_);
       impl->mem_->Ref();
     }
   }
@@ -1652,6 +2242,7 @@ Status DB::Open(const Options& options, const std::string& dbname, DB** dbptr) {
     s = impl->versions_->LogAndApply(&edit, &impl->mutex_);
   }
   if (s.ok()) {
+    impl->InstallSuperVersion();
     impl->RemoveObsoleteFiles();
     //impl->MaybeScheduleCompaction();
     for (int i = 0; i < config::kNumLevels; i++) {
@@ -1694,6 +2285,9 @@ Status DestroyDB(const std::string& dbname, const Options& options) {
         }
       }
     }
+    if (!options.nvm_pool_path.empty()) {
+      env->RemoveFile(options.nvm_pool_path);
+    }
     env->UnlockFile(lock);  // Ignore error since state is already gone
     env->RemoveFile(lockname);
     env->RemoveDir(dbname);  // Ignore error in case dir contains other files
@@ -9,6 +9,7 @@
 #include <deque>
 #include <set>
 #include <string>
+#include <vector>
 
 #include "db/dbformat.h"
 #include "db/log_writer.h"
@@ -47,6 +48,11 @@ class DBImpl : public DB {
   Status Write(const WriteOptions& options, WriteBatch* updates) override;
   Status Get(const ReadOptions& options, const Slice& key,
              std::string* value) override;
+  Status Get(const ReadOptions& options, const Slice& key,
+             PinnableSlice* value) override;
+  void MultiGet(const ReadOptions& options, const std::vector<Slice>& keys,
+                std::vector<std::string>* values,
+                std::vector<Status>* statuses) override;
   Iterator* NewIterator(const ReadOptions&) override;
   const Snapshot* GetSnapshot() override;
   void ReleaseSnapshot(const Snapshot* snapshot) override;
@@ -80,6 +86,8 @@ class DBImpl : public DB {
   friend class DB;
   struct CompactionState;
   struct Writer;
+  struct WriteGroup;
+  struct SuperVersion;
   // add by mio
   uint64_t stall_time_;
   uint64_t dumptime;
@@ -97,17 +105,32 @@ class DBImpl : public DB {
   // Per level compaction stats.  stats_[level] stores the stats for
   // compactions that produced data for the specified "level".
   struct CompactionStats {
-    CompactionStats() : micros(0), bytes_read(0), bytes_written(0) {}
+    CompactionStats()
+        : micros(0), bytes_read(0), bytes_written(0), bytes_reclaimed(0) {}
 
     void Add(const CompactionStats& c) {
       this->micros += c.micros;
       this->bytes_read += c.bytes_read;
       this->bytes_written += c.bytes_written;
+      this->bytes_reclaimed += c.bytes_reclaimed;
     }
 
     int64_t micros;
     int64_t bytes_read;
     int64_t bytes_written;
+    int64_t bytes_reclaimed;  // Deletions and shadowed versions dropped
+  };
+
+  // Time spent in each phase of memtable flushes
+  struct FlushStats {
+    FlushStats()
+        : count(0), bytes(0), copy_micros(0), index_micros(0), sync_micros(0) {}
+
+    int64_t count;
+    int64_t bytes;          // Bytes copied to NVM
+    int64_t copy_micros;    // Copying the memtable arena
+    int64_t index_micros;   // Finding largest[] and building the bloom filter
+    int64_t sync_micros;    // Writing the table back to the nvm pool
   };
 
   Iterator* NewInternalIterator(const ReadOptions&,
@@ -136,13 +159,46 @@ class DBImpl : public DB {
                         VersionEdit* edit, SequenceNumber* max_sequence)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
-  Status WriteLevel0Table(MemTable* mem, VersionEdit* edit)
+  // Point readers at the current mem_, imm_ and version.  Must be called
+  // whenever one of them changes.
+  void InstallSuperVersion() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Return the current super version, pinned until it is handed back to
+  // ReturnSuperVersion() by the same thread.  Usually needs no locking.
+  SuperVersion* AcquireSuperVersion() LOCKS_EXCLUDED(mutex_);
+  void ReturnSuperVersion(SuperVersion* sv) LOCKS_EXCLUDED(mutex_);
+  // Drop a reference, freeing sv if it was the last one
+  void UnrefSuperVersion(SuperVersion* sv) LOCKS_EXCLUDED(mutex_);
+  void UnrefSuperVersionLocked(SuperVersion* sv)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Release what sv pins, once nobody references it
+  void FreeSuperVersion(SuperVersion* sv) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // This thread's cache of the super version it used last
+  std::atomic<SuperVersion*>* ReadSlot() LOCKS_EXCLUDED(mutex_);
+  // Drops the reference to a super version that an iterator or a pinned
+  // value held, arg1 is the DBImpl and arg2 the SuperVersion
+  static void CleanupSuperVersion(void* arg1, void* arg2);
+
+  // Create the write-ahead log with number "log_number"
+  Status NewLogFile(uint64_t log_number, WritableFile** result);
 
-  Status MakeRoomForWrite(bool force /* compact even if there is room? */)
+  Status WriteLevel0Table(MemTable* mem, VersionEdit* edit)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Make room in mem_ for a write group led by a batch of "charge"
+  // memtable bytes.
+  Status MakeRoomForWrite(bool force /* compact even if there is room? */,
+                          size_t charge) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   WriteBatch* BuildBatchGroup(Writer** last_writer)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Have every writer of "group" insert its own batch into "mem" in
+  // parallel, and wait until all of them are done.  group[0] is the caller.
+  Status InsertGroupConcurrently(const std::vector<Writer*>& group,
+                                 MemTable* mem) LOCKS_EXCLUDED(mutex_);
+  // Write path of options_.enable_pipelined_write, entered by the writer
+  // at the front of writers_.  Logs the group, hands the log over to the
+  // next group and then applies this group to the memtable in log order.
+  Status PipelinedWrite(const WriteOptions& options, Writer* w)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
   void RecordBackgroundError(const Status& s);
 
@@ -154,6 +210,9 @@ class DBImpl : public DB {
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   Status DoCompactionWork(CompactionState* compact)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Return the pool that splits up merging "dt" into another table, or
+  // nullptr if "dt" is too small to be worth it.
+  WorkerPool* CompactionWorkers(DataTable* dt);
 
   Status OpenCompactionOutputFile(CompactionState* compact);
   Status FinishCompactionOutputFile(CompactionState* compact, Iterator* input);
@@ -191,12 +250,27 @@ class DBImpl : public DB {
   WritableFile* logfile_;
   uint64_t logfile_number_ GUARDED_BY(mutex_);
   log::Writer* log_;
-  uint32_t seed_ GUARDED_BY(mutex_);  // For sampling.
+  std::atomic<uint32_t> seed_;  // For sampling.
+
+  // What readers see, replaced by InstallSuperVersion()
+  SuperVersion* super_version_ GUARDED_BY(mutex_);
+  // Per thread caches of a super version reference, see ReadSlot().
+  // InstallSuperVersion() empties them so that readers move on.
+  std::vector<std::atomic<SuperVersion*>*> read_slots_ GUARDED_BY(mutex_);
+  // Tells this DB's read slots apart from those of other DBs
+  const uint64_t id_;
 
   // Queue of writers.
   std::deque<Writer*> writers_ GUARDED_BY(mutex_);
   WriteBatch* tmp_batch_ GUARDED_BY(mutex_);
 
+  // Groups that are logged but not yet applied to their memtable, in log
+  // order (options_.enable_pipelined_write).  The front one is applying.
+  std::deque<WriteGroup*> memtable_writers_ GUARDED_BY(mutex_);
+  // MemTableCharge() of the groups in memtable_writers_, not yet counted
+  // by mem_
+  size_t pending_memtable_bytes_ GUARDED_BY(mutex_);
+
   SnapshotList snapshots_ GUARDED_BY(mutex_);
 
   // Set of table files to protect from deletion because they are
@@ -210,10 +284,21 @@ class DBImpl : public DB {
 
   VersionSet* const versions_ GUARDED_BY(mutex_);
 
+  // Pool opened by this DB when options_.nvm_pool_path is set, also
+  // published through the nvm_pool global for the allocators.
+  NvmPool* nvm_pool_;
+
+  // Threads that split up memtable flushes
+  WorkerPool* const flush_workers_;
+
+  // Threads that split up large compactions
+  WorkerPool* const compaction_workers_;
+
   // Have we encountered a background error in paranoid mode?
   Status bg_error_ GUARDED_BY(mutex_);
 
   CompactionStats stats_[config::kNumLevels] GUARDED_BY(mutex_);
+  FlushStats flush_stats_ GUARDED_BY(mutex_);
 };
 
 // Sanitize db options.  The caller should delete result.info_log if
@@ -275,6 +275,9 @@ class DBTest : public testing::Test {
       case kUncompressed:
         options.compression = kNoCompression;
         break;
+      case kPipelinedWrite:
+        options.enable_pipelined_write = true;
+        break;
       default:
         break;
     }
@@ -531,7 +534,14 @@ class DBTest : public testing::Test {
 
  private:
   // Sequence of option configurations to try
-  enum OptionConfig { kDefault, kReuse, kFilter, kUncompressed, kEnd };
+  enum OptionConfig {
+    kDefault,
+    kReuse,
+    kFilter,
+    kUncompressed,
+    kPipelinedWrite,
+    kEnd
+  };
 
   const FilterPolicy* filter_policy_;
   int option_config_;
@@ -2277,9 +2287,7 @@ void BM_LogAndApply(int iters, int num_base_files) {
 
   for (int i = 0; i < iters; i++) {
     VersionEdit vedit;
-    // modify by mio 2020/7/19
-    //vedit.RemoveFile(2, fnum);
-    vedit.RemoveFile(2, nullptr);
+    vedit.RemoveFile(2, fnum);
     InternalKey start(MakeKey(2 * fnum), 1, kTypeValue);
     InternalKey limit(MakeKey(2 * fnum + 1), 1, kTypeDeletion);
     // modify by mio 2020/7/19
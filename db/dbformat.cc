@@ -9,6 +9,7 @@
 
 #include "port/port.h"
 #include "util/coding.h"
+#include "util/mergeablebloom.h"
 
 namespace leveldb {
 
@@ -85,8 +86,9 @@ int InternalKeyComparator::NewCompare(const Slice& akey, const Slice& bkey, bool
   }
 
   if (hasseq) {
-    const uint64_t anum = DecodeFixed64(akey.data() + akey.size() - 8);
-    const uint64_t bnum = DecodeFixed64(bkey.data() + bkey.size() - 8);
+    // The tags hold the type in their low byte
+    const uint64_t anum = DecodeFixed64(akey.data() + akey.size() - 8) >> 8;
+    const uint64_t bnum = DecodeFixed64(bkey.data() + bkey.size() - 8) >> 8;
 
     if (anum <= snum) {
       //code is 0
@@ -171,7 +173,8 @@ bool InternalFilterPolicy::KeyMayMatch(const Slice& key, const Slice& f) const {
   return user_policy_->KeyMayMatch(ExtractUserKey(key), f);
 }
 
-LookupKey::LookupKey(const Slice& user_key, SequenceNumber s) {
+LookupKey::LookupKey(const Slice& user_key, SequenceNumber s)
+    : hash_(0), hashed_(false) {
   size_t usize = user_key.size();
   size_t needed = usize + 13;  // A conservative estimate
   char* dst;
@@ -190,4 +193,12 @@ LookupKey::LookupKey(const Slice& user_key, SequenceNumber s) {
   end_ = dst;
 }
 
+uint32_t LookupKey::hash() const {
+  if (!hashed_) {
+    hash_ = MergeableBloom::BloomHash(user_key());
+    hashed_ = true;
+  }
+  return hash_;
+}
+
 }  // namespace leveldb
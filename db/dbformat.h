@@ -206,6 +206,10 @@ class LookupKey {
   // Return the user key
   Slice user_key() const { return Slice(kstart_, end_ - kstart_ - 8); }
 
+  // Hash of the user key that the filters of the datatables are probed
+  // with.  Computed on first use, so a lookup hashes the key only once.
+  uint32_t hash() const;
+
  private:
   // We construct a char array of the form:
   //    klength  varint32               <-- start_
@@ -217,6 +221,8 @@ class LookupKey {
   const char* start_;
   const char* kstart_;
   const char* end_;
+  mutable uint32_t hash_;
+  mutable bool hashed_;
   char space_[200];  // Avoid allocation for short keys
 };
 
@@ -224,6 +230,14 @@ inline LookupKey::~LookupKey() {
   if (start_ != space_) delete[] start_;
 }
 
+// One of the keys of a DB::MultiGet() on its way through the tables
+struct KeyLookup {
+  const LookupKey* key;
+  std::string* value;
+  Status* status;
+  bool found;  // *value or *status holds the result
+};
+
 }  // namespace leveldb
 
 #endif  // STORAGE_LEVELDB_DB_DBFORMAT_H_
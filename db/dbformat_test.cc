@@ -6,6 +6,7 @@
 
 #include "gtest/gtest.h"
 #include "util/logging.h"
+#include "util/mergeablebloom.h"
 
 namespace leveldb {
 
@@ -125,6 +126,16 @@ TEST(FormatTest, InternalKeyDebugString) {
   ASSERT_EQ("(bad)", invalid_key.DebugString());
 }
 
+TEST(FormatTest, LookupKeyHash) {
+  // The same for every snapshot, it only covers the user key
+  LookupKey key("foo", 100);
+  LookupKey old_key("foo", 1);
+  ASSERT_EQ(MergeableBloom::BloomHash("foo"), key.hash());
+  ASSERT_EQ(key.hash(), key.hash());
+  ASSERT_EQ(key.hash(), old_key.hash());
+  ASSERT_NE(key.hash(), LookupKey("bar", 100).hash());
+}
+
 }  // namespace leveldb
 
 int main(int argc, char** argv) {
@@ -1,4 +1,5 @@
 #include "db/global.h"
+#include "util/no_destructor.h"
 // because nvm_node_size() is very slow, we use global variables to record KV size and change nvm_node
 // just used to test more KVs
 // in beta version, we support 2 nvm numa nodes
@@ -6,6 +7,12 @@ int nvm_node = 2;
 int nvm_next_node = 4;
 size_t nvm_free_space = 384L * 1024 * 1024 * 1024;
 bool nvm_node_has_changed = false;
+NvmPool* nvm_pool = nullptr;
+
+EpochLimbo* FilterLimbo() {
+    static NoDestructor<EpochLimbo> limbo;
+    return limbo.get();
+}
 
 // init nvm_free_space
 void NvmNodeSizeInit(const Options& options_) {
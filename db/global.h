@@ -4,11 +4,18 @@
 #include <iostream>
 #include "numa.h"
 #include "leveldb/options.h"
+#include "util/epoch.h"
+#include "util/nvm_pool.h"
 using namespace leveldb;
 extern int nvm_node;
 extern int nvm_next_node;
 extern size_t nvm_free_space;
 extern bool nvm_node_has_changed;
+// non-null when DataTables are carved out of a memory-mapped pool file
+extern NvmPool* nvm_pool;
+// Bloom and cuckoo filters that tables replaced while lookups may still
+// probe them.  Lookups pin FilterLimbo()->epoch() around their probes.
+EpochLimbo* FilterLimbo();
 void NvmNodeSizeInit(const Options& options_);
 void NvmNodeSizeRecord(size_t s);
 #endif
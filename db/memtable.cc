@@ -3,6 +3,10 @@
 // found in the LICENSE file. See the AUTHORS file for names of contributors.
 
 #include "db/memtable.h"
+
+#include <vector>
+
+#include "db/datatable.h"
 #include "db/dbformat.h"
 #include "leveldb/comparator.h"
 #include "leveldb/env.h"
@@ -21,12 +25,30 @@ static Slice GetLengthPrefixedSlice(const char* data) {
 MemTable::MemTable(const InternalKeyComparator& comparator, const size_t size)
     : comparator_(comparator), refs_(0), arena_(size), table_(comparator_, &arena_) {}
 
-MemTable::~MemTable() { assert(refs_ == 0); }
+// No entry takes less of the arena than this, node included
+static const size_t kMinEntrySize = 32;
+
+MemTable::MemTable(const InternalKeyComparator& comparator, const size_t size,
+                   const Options& options)
+    : MemTable(comparator, size) {
+  if (options.use_datatable_bloom) {
+    bloom_ = new MergeableBloom(options, size / kMinEntrySize,
+                                DataTable::FilterBitsPerKey(options, 0));
+  }
+}
+
+MemTable::~MemTable() {
+  assert(refs_ == 0);
+  delete bloom_;
+}
 
 size_t MemTable::ApproximateMemoryUsage() { return arena_.MemoryUsage(); }
 
-int KeyComparator::operator()(const char* aptr,
-                                        const char* bptr) const {
+size_t MemTable::MaxEntryOverhead() {
+  return 2 * 5 + 8 + mTable::MaxNodeSize();
+}
+
+int KeyComparator::UserCompare(const char* aptr, const char* bptr) const {
   // Internal keys are encoded as length-prefixed strings.
   Slice a = GetLengthPrefixedSlice(aptr);
   Slice b = GetLengthPrefixedSlice(bptr);
@@ -36,11 +58,25 @@ int KeyComparator::NewCompare(const char* aptr,
 										 const char* bptr,
 										 const bool hasseq,
 										 const SequenceNumber snum) const {
+  if (prefix_order) {
+    uint64_t atag, btag;
+    const int c = CompareUserKeys(aptr, bptr, 0, &atag, &btag);
+    int r = c < 0 ? 0b01 : (c == 0 ? 0b10 : 0b11);
+    if (hasseq) {
+      if ((atag >> 8) > snum) r += 0b100;
+      if ((btag >> 8) > snum) r += 0b1000;
+    }
+    return r;
+  }
 	Slice a = GetLengthPrefixedSlice(aptr);
 	Slice b = GetLengthPrefixedSlice(bptr);
 	return comparator.NewCompare(a, b, hasseq, snum);
 }
 bool KeyComparator::NewCompare(const char* aptr, const char* bptr) const {
+  if (prefix_order) {
+    uint64_t atag, btag;
+    return CompareUserKeys(aptr, bptr, 0, &atag, &btag) == 0 && atag < btag;
+  }
   Slice a = GetLengthPrefixedSlice(aptr);
   Slice b = GetLengthPrefixedSlice(bptr);
   return comparator.NewCompare(a, b);
@@ -87,7 +123,7 @@ class MemTableIterator : public Iterator {
 Iterator* MemTable::NewIterator() { return new MemTableIterator(&table_); }
 
 void MemTable::Add(SequenceNumber s, ValueType type, const Slice& key,
-                   const Slice& value) {
+                   const Slice& value, bool concurrent) {
   // Format of an entry is concatenation of:
   //  key_size     : varint32 of internal_key.size()
   //  key bytes    : char[internal_key.size()]
@@ -99,7 +135,8 @@ void MemTable::Add(SequenceNumber s, ValueType type, const Slice& key,
   const size_t encoded_len = VarintLength(internal_key_size) +
                              internal_key_size + VarintLength(val_size) +
                              val_size;
-  char* buf = arena_.Allocate(encoded_len);
+  char* buf = concurrent ? arena_.AllocateConcurrently(encoded_len)
+                         : arena_.Allocate(encoded_len);
   char* p = EncodeVarint32(buf, internal_key_size);
   std::memcpy(p, key.data(), key_size);
   p += key_size;
@@ -108,44 +145,87 @@ void MemTable::Add(SequenceNumber s, ValueType type, const Slice& key,
   p = EncodeVarint32(p, val_size);
   std::memcpy(p, value.data(), val_size);
   assert(p + val_size == buf + encoded_len);
+  entries_.fetch_add(1, std::memory_order_relaxed);
   // modify by mio 2020/5/30
-  table_.Insert(buf, encoded_len);
+  if (concurrent) {
+    if (bloom_ != nullptr) bloom_->AddKeyConcurrently(key);
+    table_.InsertConcurrently(buf, encoded_len);
+  } else {
+    if (bloom_ != nullptr) bloom_->AddKey(key);
+    table_.Insert(buf, encoded_len);
+  }
+}
+
+// Get() of "key" from the entry a search for it reached, with *value
+// pointing at the value bytes in the entry
+static bool GetFromEntry(const Comparator* ucmp, const char* entry,
+                         const LookupKey& key, Slice* value, Status* s) {
+  // entry format is:
+  //    klength  varint32
+  //    userkey  char[klength]
+  //    tag      uint64
+  //    vlength  varint32
+  //    value    char[vlength]
+  // Check that it belongs to same user key.  We do not check the
+  // sequence number since the Seek() call above should have skipped
+  // all entries with overly large sequence numbers.
+  uint32_t key_length;
+  const char* key_ptr = GetVarint32Ptr(entry, entry + 5, &key_length);
+  if (ucmp->Compare(Slice(key_ptr, key_length - 8), key.user_key()) == 0) {
+    // Correct user key
+    const uint64_t tag = DecodeFixed64(key_ptr + key_length - 8);
+    switch (static_cast<ValueType>(tag & 0xff)) {
+      case kTypeValue: {
+        *value = GetLengthPrefixedSlice(key_ptr + key_length);
+        return true;
+      }
+      case kTypeDeletion:
+        *s = Status::NotFound(Slice());
+        return true;
+    }
+  }
+  return false;
 }
 
 bool MemTable::Get(const LookupKey& key, std::string* value, Status* s) {
+  Slice v;
+  if (!Get(key, &v, s)) {
+    return false;
+  }
+  if (s->ok()) {
+    value->assign(v.data(), v.size());
+  }
+  return true;
+}
+
+bool MemTable::Get(const LookupKey& key, Slice* value, Status* s) {
   Slice memkey = key.memtable_key();
   mTable::Iterator iter(&table_);
   iter.Seek(memkey.data());
-  if (iter.Valid()) {
-    // entry format is:
-    //    klength  varint32
-    //    userkey  char[klength]
-    //    tag      uint64
-    //    vlength  varint32
-    //    value    char[vlength]
-    // Check that it belongs to same user key.  We do not check the
-    // sequence number since the Seek() call above should have skipped
-    // all entries with overly large sequence numbers.
-    const char* entry = iter.key();
-    uint32_t key_length;
-    const char* key_ptr = GetVarint32Ptr(entry, entry + 5, &key_length);
-    if (comparator_.comparator.user_comparator()->Compare(
-            Slice(key_ptr, key_length - 8), key.user_key()) == 0) {
-      // Correct user key
-      const uint64_t tag = DecodeFixed64(key_ptr + key_length - 8);
-      switch (static_cast<ValueType>(tag & 0xff)) {
-        case kTypeValue: {
-          Slice v = GetLengthPrefixedSlice(key_ptr + key_length);
-          value->assign(v.data(), v.size());
-          return true;
-        }
-        case kTypeDeletion:
-          *s = Status::NotFound(Slice());
-          return true;
+  return iter.Valid() &&
+         GetFromEntry(comparator_.comparator.user_comparator(), iter.key(),
+                      key, value, s);
+}
+
+void MemTable::MultiGet(KeyLookup* const* lookups, int n) {
+  std::vector<const char*> targets(n);
+  for (int i = 0; i < n; i++) {
+    targets[i] = lookups[i]->key->memtable_key().data();
+  }
+  std::vector<const char*> entries(n);
+  table_.SeekMany(targets.data(), n, entries.data());
+  for (int i = 0; i < n; i++) {
+    KeyLookup* l = lookups[i];
+    Slice v;
+    if (entries[i] != nullptr &&
+        GetFromEntry(comparator_.comparator.user_comparator(), entries[i],
+                     *l->key, &v, l->status)) {
+      l->found = true;
+      if (l->status->ok()) {
+        l->value->assign(v.data(), v.size());
       }
     }
   }
-  return false;
 }
 
 }  // namespace leveldb
@@ -5,13 +5,19 @@
 #ifndef STORAGE_LEVELDB_DB_MEMTABLE_H_
 #define STORAGE_LEVELDB_DB_MEMTABLE_H_
 
+#include <algorithm>
+#include <atomic>
+#include <cstring>
 #include <string>
 
 #include "db/dbformat.h"
 #include "db/skiplist.h"
+#include "leveldb/comparator.h"
 #include "leveldb/db.h"
+#include "util/coding.h"
 #include "util/arena.h"
 #include "leveldb/options.h"
+#include "util/mergeablebloom.h"
 
 namespace leveldb {
 
@@ -20,8 +26,60 @@ class MemTableIterator;
 
 struct KeyComparator {
     const InternalKeyComparator comparator;
-    explicit KeyComparator(const InternalKeyComparator& c) : comparator(c) {}
-    int operator()(const char* a, const char* b) const;
+    // User keys order like their bytes, and so like their KeyPrefix()
+    // where those differ
+    const bool prefix_order;
+    explicit KeyComparator(const InternalKeyComparator& c)
+        : comparator(c),
+          prefix_order(c.user_comparator() == BytewiseComparator()) {}
+    int operator()(const char* a, const char* b) const {
+      return prefix_order ? BytewiseCompare(a, b, 0) : UserCompare(a, b);
+    }
+    // operator() through the virtual user comparator
+    int UserCompare(const char* a, const char* b) const;
+    // operator() for the bytewise comparator, inlined into the searches.
+    // The first "known_equal" bytes of both user keys are the same.
+    static int BytewiseCompare(const char* a, const char* b,
+                               size_t known_equal) {
+      uint64_t atag, btag;
+      int r = CompareUserKeys(a, b, known_equal, &atag, &btag);
+      if (r == 0 && atag != btag) {
+        r = atag > btag ? -1 : +1;  // Newer first
+      }
+      return r;
+    }
+    // Bytewise order of the user keys of "a" and "b", whose first
+    // "known_equal" bytes are the same, and the tags of both keys
+    static int CompareUserKeys(const char* a, const char* b,
+                               size_t known_equal, uint64_t* atag,
+                               uint64_t* btag) {
+      uint32_t alen, blen;
+      a = GetVarint32Ptr(a, a + 5, &alen);
+      b = GetVarint32Ptr(b, b + 5, &blen);
+      const size_t asize = alen - 8;
+      const size_t bsize = blen - 8;
+      const size_t n = std::min(asize, bsize);
+      known_equal = std::min(known_equal, n);
+      int r = memcmp(a + known_equal, b + known_equal, n - known_equal);
+      if (r == 0 && asize != bsize) {
+        r = asize < bsize ? -1 : +1;
+      }
+      *atag = DecodeFixed64(a + asize);
+      *btag = DecodeFixed64(b + bsize);
+      return r;
+    }
+    // The first 16 bytes of the user key of "key", zero padded, as two
+    // big-endian words.  All zero for a null key.
+    static void KeyPrefix(const char* key, uint64_t* prefix) {
+      char buf[16] = {0};
+      if (key != nullptr) {
+        uint32_t len;
+        const char* p = GetVarint32Ptr(key, key + 5, &len);
+        memcpy(buf, p, std::min<size_t>(len - 8, sizeof(buf)));
+      }
+      prefix[0] = __builtin_bswap64(DecodeFixed64(buf));
+      prefix[1] = __builtin_bswap64(DecodeFixed64(buf + 8));
+    }
     int NewCompare(const char* a, const char* b, bool hasseq, SequenceNumber snum) const;
     bool NewCompare(const char* a, const char* b) const;
 };
@@ -32,6 +90,10 @@ class MemTable {
   // MemTables are reference counted.  The initial reference count
   // is zero and the caller must call Ref() at least once.
   explicit MemTable(const InternalKeyComparator& comparator, const size_t size);
+  // A memtable that also fills the bloom filter its datatable will get
+  // when it is flushed, if "options" ask for filters
+  MemTable(const InternalKeyComparator& comparator, const size_t size,
+           const Options& options);
 
   MemTable(const MemTable&) = delete;
   MemTable& operator=(const MemTable&) = delete;
@@ -52,6 +114,23 @@ class MemTable {
   // data structure. It is safe to call when MemTable is being modified.
   size_t ApproximateMemoryUsage();
 
+  // Arena bytes it can hold.  A flush copies them as a single block, the
+  // writer must not add more.
+  size_t Capacity() const { return arena_.Capacity(); }
+
+  // Most arena bytes Add() takes for an entry beyond those of its key and
+  // value: their lengths, the tag and a node of the greatest height.
+  static size_t MaxEntryOverhead();
+
+  // Number of entries added so far
+  size_t NumEntries() const {
+    return entries_.load(std::memory_order_relaxed);
+  }
+
+  // Filter of the user keys added so far, sized for as many as fit in the
+  // arena.  nullptr if the memtable keeps none.
+  MergeableBloom* bloom() const { return bloom_; }
+
   // Return an iterator that yields the contents of the memtable.
   //
   // The caller must ensure that the underlying MemTable remains live
@@ -63,14 +142,24 @@ class MemTable {
   // Add an entry into memtable that maps key to value at the
   // specified sequence number and with the specified type.
   // Typically value will be empty if type==kTypeDeletion.
+  // If "concurrent" is true, other threads may be adding entries at the
+  // same time.  A memtable must not mix concurrent and non-concurrent
+  // calls once it is shared.
   void Add(SequenceNumber seq, ValueType type, const Slice& key,
-           const Slice& value);
+           const Slice& value, bool concurrent = false);
 
   // If memtable contains a value for key, store it in *value and return true.
   // If memtable contains a deletion for key, store a NotFound() error
   // in *status and return true.
   // Else, return false.
   bool Get(const LookupKey& key, std::string* value, Status* s);
+  // Get() that points *value at the value bytes in the memtable, which
+  // stay in place while it is referenced
+  bool Get(const LookupKey& key, Slice* value, Status* s);
+
+  // Get() for each of lookups[0,n), setting found where Get() would
+  // return true.  Keys in order search fastest.
+  void MultiGet(KeyLookup* const* lookups, int n);
 
  private:
   friend class MemTableIterator;
@@ -88,6 +177,8 @@ class MemTable {
 
   KeyComparator comparator_;
   int refs_;
+  std::atomic<size_t> entries_{0};
+  MergeableBloom* bloom_ = nullptr;
  public:
   Arena arena_;
   mTable table_;
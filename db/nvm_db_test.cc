@@ -0,0 +1,504 @@
+// Add by MioDB
+// DB-level tests of a DB that keeps its datatables in an nvm pool
+
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "db/db_impl.h"
+#include "leveldb/db.h"
+#include "leveldb/env.h"
+#include "leveldb/pinnable_slice.h"
+#include "leveldb/write_batch.h"
+#include "util/testutil.h"
+
+namespace leveldb {
+
+class NvmDBTest : public testing::Test {
+ public:
+  NvmDBTest()
+      : dbname_(DBName()), options_(DBOptions(dbname_)), db_(nullptr) {
+    DestroyDB(dbname_, options_);
+  }
+
+  static std::string DBName() {
+    std::string dbname;
+    EXPECT_LEVELDB_OK(Env::Default()->GetTestDirectory(&dbname));
+    return dbname + "/nvm_db_test";
+  }
+
+  static Options DBOptions(const std::string& dbname) {
+    Options options;
+    options.create_if_missing = true;
+    options.nvm_pool_path = dbname + ".pool";
+    options.nvm_pool_size = 256 << 20;
+    // Small memtables, so that a few thousand writes go through several
+    options.write_buffer_size = 64 << 10;
+    return options;
+  }
+
+  ~NvmDBTest() {
+    Close();
+    DestroyDB(dbname_, options_);
+  }
+
+  DBImpl* dbfull() { return reinterpret_cast<DBImpl*>(db_); }
+
+  void Open() { ASSERT_LEVELDB_OK(DB::Open(options_, dbname_, &db_)); }
+
+  void Close() {
+    delete db_;
+    db_ = nullptr;
+  }
+
+  void Reopen() {
+    Close();
+    Open();
+  }
+
+  std::string Get(const std::string& key, const Snapshot* snapshot = nullptr) {
+    ReadOptions options;
+    options.snapshot = snapshot;
+    std::string result;
+    Status s = db_->Get(options, key, &result);
+    if (s.IsNotFound()) {
+      result = "NOT_FOUND";
+    } else if (!s.ok()) {
+      result = s.ToString();
+    }
+    return result;
+  }
+
+  // Get() into a PinnableSlice, with its result in the form Get() gives it
+  std::string GetPinned(const std::string& key,
+                        const Snapshot* snapshot = nullptr) {
+    ReadOptions options;
+    options.snapshot = snapshot;
+    PinnableSlice value;
+    Status s = db_->Get(options, key, &value);
+    if (s.IsNotFound()) {
+      return "NOT_FOUND";
+    } else if (!s.ok()) {
+      return s.ToString();
+    }
+    return value.ToString();
+  }
+
+  // MultiGet() of keys, with its results in the form Get() gives them
+  std::vector<std::string> MultiGet(const std::vector<std::string>& keys,
+                                    const Snapshot* snapshot = nullptr) {
+    ReadOptions options;
+    options.snapshot = snapshot;
+    std::vector<Slice> slices(keys.begin(), keys.end());
+    std::vector<std::string> values;
+    std::vector<Status> statuses;
+    db_->MultiGet(options, slices, &values, &statuses);
+    EXPECT_EQ(keys.size(), values.size());
+    EXPECT_EQ(keys.size(), statuses.size());
+    for (size_t i = 0; i < statuses.size(); i++) {
+      if (statuses[i].IsNotFound()) {
+        values[i] = "NOT_FOUND";
+      } else if (!statuses[i].ok()) {
+        values[i] = statuses[i].ToString();
+      }
+    }
+    return values;
+  }
+
+  static std::string Key(int thread, int i) {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "key%02d.%06d", thread, i);
+    return buf;
+  }
+
+  static std::string Value(int thread, int i) {
+    return Key(thread, i) + std::string(20, 'v');
+  }
+
+  // Let "threads" writers each write "n" batches of two keys at once and
+  // check that every key is there afterwards
+  void WriteConcurrently(int threads, int n) {
+    std::vector<std::thread> writers;
+    for (int t = 0; t < threads; t++) {
+      writers.emplace_back([this, t, n]() {
+        for (int i = 0; i < n; i += 2) {
+          WriteBatch batch;
+          batch.Put(Key(t, i), Value(t, i));
+          batch.Put(Key(t, i + 1), Value(t, i + 1));
+          EXPECT_LEVELDB_OK(db_->Write(WriteOptions(), &batch));
+        }
+      });
+    }
+    for (auto& writer : writers) {
+      writer.join();
+    }
+    CheckWrites(threads, n);
+  }
+
+  void CheckWrites(int threads, int n) {
+    for (int t = 0; t < threads; t++) {
+      for (int i = 0; i < n; i++) {
+        ASSERT_EQ(Value(t, i), Get(Key(t, i)));
+      }
+    }
+  }
+
+  // Keys 0..n-1 of thread 0, those never written in between and after, and
+  // the values Get() gives for them with "round" of Value() written over
+  // every key and every "deleted"-th deleted afterwards
+  static void ExpectedRound(int n, int round, int deleted,
+                            std::vector<std::string>* keys,
+                            std::vector<std::string>* values) {
+    keys->clear();
+    values->clear();
+    for (int i = 0; i < n; i++) {
+      keys->push_back(Key(0, i));
+      values->push_back(i % deleted == 0 ? "NOT_FOUND" : Value(round, i));
+      if (i % 100 == 0) {
+        keys->push_back(Key(0, i) + "x");
+        values->push_back("NOT_FOUND");
+      }
+    }
+    keys->push_back(Key(0, n));
+    values->push_back("NOT_FOUND");
+  }
+
+  void WriteRound(int n, int round, int deleted) {
+    for (int i = 0; i < n; i++) {
+      ASSERT_LEVELDB_OK(db_->Put(WriteOptions(), Key(0, i), Value(round, i)));
+    }
+    for (int i = 0; i < n; i += deleted) {
+      ASSERT_LEVELDB_OK(db_->Delete(WriteOptions(), Key(0, i)));
+    }
+  }
+
+  // Write "n" keys to the datatables, take a snapshot and overwrite or
+  // delete some of them in the memtable.  Fills in the keys to read with
+  // what Get() gives for them under the snapshot and without it.
+  void WriteOverSnapshot(int n, const Snapshot** snapshot,
+                         std::vector<std::string>* keys,
+                         std::vector<std::string>* old_values,
+                         std::vector<std::string>* new_values) {
+    WriteRound(n, 1, 5);
+    ASSERT_LEVELDB_OK(dbfull()->TEST_CompactMemTable());
+    ExpectedRound(n, 1, 5, keys, old_values);
+    *snapshot = db_->GetSnapshot();
+    // Small enough to stay in the memtable, over deletions and values that
+    // are in the datatables
+    WriteRound(n / 10, 2, 7);
+    *new_values = *old_values;
+    for (int i = 0; i < n / 10; i++) {
+      // After one key that was never written per 100 before it
+      (*new_values)[i + (i + 99) / 100] =
+          i % 7 == 0 ? "NOT_FOUND" : Value(2, i);
+    }
+  }
+
+  // Writes of RunCrashChild() in "round": key i is written as write
+  // number round * kCrashKeys + i
+  static const int kCrashKeys = 2000;
+
+  static std::string CrashValue(uint64_t write) {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%016llu",
+                  static_cast<unsigned long long>(write));
+    return std::string(buf) + std::string(80, 'v');
+  }
+
+  // Rewrite every key in rounds starting at "round" until killed
+  static int RunCrashChild(uint64_t round) {
+    const std::string dbname = DBName();
+    DB* db;
+    Status s = DB::Open(DBOptions(dbname), dbname, &db);
+    if (!s.ok()) {
+      std::fprintf(stderr, "%s\n", s.ToString().c_str());
+      return 1;
+    }
+    for (;; round++) {
+      for (int i = 0; i < kCrashKeys; i++) {
+        s = db->Put(WriteOptions(), Key(0, i),
+                    CrashValue(round * kCrashKeys + i));
+        if (!s.ok()) {
+          std::fprintf(stderr, "%s\n", s.ToString().c_str());
+          return 1;
+        }
+      }
+    }
+  }
+
+  // Check that the DB holds the writes of a child that started at round
+  // "first" up to one of them, on top of "last", the write each key held
+  // before.  Updates "last".
+  void CheckCrashWrites(uint64_t first, std::vector<uint64_t>* last) {
+    std::vector<uint64_t> found(kCrashKeys);
+    uint64_t newest = 0;
+    for (int i = 0; i < kCrashKeys; i++) {
+      std::string value = Get(Key(0, i));
+      ASSERT_NE("NOT_FOUND", value) << i;
+      found[i] = std::strtoull(value.substr(0, 16).c_str(), nullptr, 10);
+      ASSERT_EQ(CrashValue(found[i]), value);
+      newest = std::max(newest, found[i]);
+    }
+    for (int i = 0; i < kCrashKeys; i++) {
+      uint64_t expected = (*last)[i];
+      if (newest >= first * kCrashKeys) {
+        const uint64_t round = newest / kCrashKeys;
+        if (static_cast<uint64_t>(i) <= newest % kCrashKeys) {
+          expected = round * kCrashKeys + i;
+        } else if (round > first) {
+          expected = (round - 1) * kCrashKeys + i;
+        }
+      }
+      ASSERT_EQ(expected, found[i]) << i;
+    }
+    *last = found;
+  }
+
+  std::string dbname_;
+  Options options_;
+  DB* db_;
+};
+
+TEST_F(NvmDBTest, ReopenAfterCompactions) {
+  Open();
+  const int kKeys = 3000;
+  for (int round = 0; round < 10; round++) {
+    for (int i = 0; i < kKeys; i++) {
+      ASSERT_LEVELDB_OK(db_->Put(WriteOptions(), Key(0, i), Value(round, i)));
+      if (i % 7 == round % 7) {
+        ASSERT_LEVELDB_OK(db_->Delete(WriteOptions(), Key(0, i)));
+      }
+    }
+    // Close while compactions may still run
+    Reopen();
+    for (int i = 0; i < kKeys; i++) {
+      ASSERT_EQ(i % 7 == round % 7 ? "NOT_FOUND" : Value(round, i),
+                Get(Key(0, i)));
+    }
+  }
+}
+
+// The datatables of a process that is killed while it merges them in
+// place are rolled back to what the MANIFEST says
+TEST_F(NvmDBTest, KilledDuringCompactions) {
+  // Rounds of one child do not reach the first round of the next
+  const uint64_t kRoundsPerChild = 1000000;
+  std::vector<uint64_t> last(kCrashKeys, 0);
+  Open();
+  for (int i = 0; i < kCrashKeys; i++) {
+    ASSERT_LEVELDB_OK(db_->Put(WriteOptions(), Key(0, i), CrashValue(i)));
+  }
+  CheckCrashWrites(0, &last);
+  Close();
+
+  for (int child = 1; child <= 4; child++) {
+    const uint64_t first = child * kRoundsPerChild;
+    const std::string round = std::to_string(first);
+    pid_t pid = fork();
+    ASSERT_GE(pid, 0);
+    if (pid == 0) {
+      execl("/proc/self/exe", "nvm_db_test", "--crash_child", round.c_str(),
+            static_cast<char*>(nullptr));
+      _exit(1);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(300 * child));
+    int wstatus;
+    ASSERT_EQ(0, kill(pid, SIGKILL));
+    ASSERT_EQ(pid, waitpid(pid, &wstatus, 0));
+    ASSERT_TRUE(WIFSIGNALED(wstatus) && WTERMSIG(wstatus) == SIGKILL)
+        << "child failed, status " << wstatus;
+
+    Open();
+    CheckCrashWrites(first, &last);
+    Reopen();
+    CheckCrashWrites(first, &last);
+    Close();
+  }
+}
+
+// MultiGet() finds what Get() does in the memtables and the datatables,
+// also while writes move the keys from one to the other
+TEST_F(NvmDBTest, MultiGet) {
+  const int kKeys = 3000;
+  std::vector<std::string> keys, old_values, new_values;
+  const Snapshot* snapshot;
+  Open();
+  WriteOverSnapshot(kKeys, &snapshot, &keys, &old_values, &new_values);
+  for (size_t i = 0; i < keys.size(); i++) {
+    ASSERT_EQ(new_values[i], Get(keys[i])) << keys[i];
+    ASSERT_EQ(old_values[i], Get(keys[i], snapshot)) << keys[i];
+  }
+  ASSERT_EQ(new_values, MultiGet(keys));
+  ASSERT_EQ(old_values, MultiGet(keys, snapshot));
+
+  // Unsorted, with duplicates
+  std::vector<std::string> reversed(keys.rbegin(), keys.rend());
+  std::vector<std::string> reversed_values(new_values.rbegin(),
+                                           new_values.rend());
+  reversed.push_back(keys[1]);
+  reversed_values.push_back(new_values[1]);
+  ASSERT_EQ(reversed_values, MultiGet(reversed));
+
+  // Fill memtables with other keys, so that those above go through
+  // immutable memtables and merges while they are read
+  std::atomic<bool> done(false);
+  std::thread writer([this, &done]() {
+    for (int i = 0; i < 20000; i++) {
+      EXPECT_LEVELDB_OK(db_->Put(WriteOptions(), Key(1, i), Value(1, i)));
+    }
+    done.store(true, std::memory_order_release);
+  });
+  while (!done.load(std::memory_order_acquire) && !HasFailure()) {
+    EXPECT_EQ(new_values, MultiGet(keys));
+    EXPECT_EQ(old_values, MultiGet(keys, snapshot));
+  }
+  writer.join();
+  db_->ReleaseSnapshot(snapshot);
+
+  Reopen();
+  ASSERT_EQ(new_values, MultiGet(keys));
+}
+
+// Get() into a PinnableSlice finds what Get() does, and the values it pins
+// stay in place while merges drop and reuse the nodes that hold them
+TEST_F(NvmDBTest, PinnedGet) {
+  const int kKeys = 3000;
+  std::vector<std::string> keys, old_values, new_values;
+  const Snapshot* snapshot;
+  Open();
+  WriteOverSnapshot(kKeys, &snapshot, &keys, &old_values, &new_values);
+  for (size_t i = 0; i < keys.size(); i++) {
+    ASSERT_EQ(new_values[i], GetPinned(keys[i])) << keys[i];
+    ASSERT_EQ(old_values[i], GetPinned(keys[i], snapshot)) << keys[i];
+  }
+  db_->ReleaseSnapshot(snapshot);
+
+  // Writes of other keys merge these down to the last table
+  const int kRounds = 60;
+  WriteRound(kKeys, 3, kKeys);
+  for (int round = 0; round < kRounds; round++) {
+    for (int i = 0; i < kKeys; i++) {
+      ASSERT_LEVELDB_OK(db_->Put(WriteOptions(), Key(1, i), Value(round, i)));
+    }
+  }
+  std::deque<PinnableSlice> pinned(kKeys);
+  for (int i = 1; i < kKeys; i++) {
+    ASSERT_LEVELDB_OK(db_->Get(ReadOptions(), Key(0, i), &pinned[i]));
+    ASSERT_EQ(Value(3, i), pinned[i].ToString());
+  }
+
+  // Overwrite them with values of the same size, which the last table can
+  // put in the nodes of the pinned ones if it reuses them too early
+  std::atomic<bool> done(false);
+  std::thread writer([this, &done]() {
+    for (int round = 4; round < kRounds; round++) {
+      for (int i = 1; i < kKeys; i++) {
+        EXPECT_LEVELDB_OK(
+            db_->Put(WriteOptions(), Key(0, i), Value(round, i)));
+      }
+    }
+    done.store(true, std::memory_order_release);
+  });
+  do {
+    for (int i = 1; i < kKeys && !HasFailure(); i++) {
+      EXPECT_EQ(Value(3, i), pinned[i].ToString()) << i;
+    }
+  } while (!done.load(std::memory_order_acquire) && !HasFailure());
+  writer.join();
+  for (int i = 1; i < kKeys; i++) {
+    ASSERT_EQ(Value(3, i), pinned[i].ToString()) << i;
+    pinned[i].Reset();
+    ASSERT_EQ(Value(kRounds - 1, i), GetPinned(Key(0, i)));
+  }
+}
+
+TEST_F(NvmDBTest, ConcurrentMemtableWriters) {
+  options_.allow_concurrent_memtable_write = true;
+  Open();
+  WriteConcurrently(8, 4000);
+  Reopen();
+  CheckWrites(8, 4000);
+}
+
+TEST_F(NvmDBTest, PipelinedWriters) {
+  options_.enable_pipelined_write = true;
+  Open();
+  WriteConcurrently(8, 4000);
+  Reopen();
+  CheckWrites(8, 4000);
+}
+
+// Compactions queue writers without a batch behind the pipelined ones
+TEST_F(NvmDBTest, PipelinedWritersWithCompactRange) {
+  options_.enable_pipelined_write = true;
+  Open();
+  std::atomic<bool> done(false);
+  std::thread compactor([this, &done]() {
+    while (!done.load(std::memory_order_acquire)) {
+      db_->CompactRange(nullptr, nullptr);
+    }
+  });
+  WriteConcurrently(8, 4000);
+  done.store(true, std::memory_order_release);
+  compactor.join();
+  Reopen();
+  CheckWrites(8, 4000);
+}
+
+// A batch larger than a memtable's slack gets a memtable of its own while
+// the other writers keep filling theirs
+TEST_F(NvmDBTest, BatchLargerThanMemTable) {
+  options_.allow_concurrent_memtable_write = true;
+  Open();
+  const std::string large(1 << 20, 'l');
+  std::thread writer([this, &large]() {
+    for (int round = 0; round < 3; round++) {
+      WriteBatch batch;
+      for (int i = 0; i < 3; i++) {
+        batch.Put(Key(8, 3 * round + i), large);
+      }
+      EXPECT_LEVELDB_OK(db_->Write(WriteOptions(), &batch));
+    }
+  });
+  WriteConcurrently(8, 4000);
+  writer.join();
+  for (int i = 0; i < 9; i++) {
+    ASSERT_EQ(large, Get(Key(8, i)));
+  }
+  Reopen();
+  CheckWrites(8, 4000);
+  for (int i = 0; i < 9; i++) {
+    ASSERT_EQ(large, Get(Key(8, i)));
+  }
+}
+
+TEST_F(NvmDBTest, PipelinedConcurrentMemtableWriters) {
+  options_.enable_pipelined_write = true;
+  options_.allow_concurrent_memtable_write = true;
+  Open();
+  WriteConcurrently(8, 4000);
+  Reopen();
+  CheckWrites(8, 4000);
+}
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  if (argc == 3 && std::strcmp(argv[1], "--crash_child") == 0) {
+    return leveldb::NvmDBTest::RunCrashChild(
+        std::strtoull(argv[2], nullptr, 10));
+  }
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -8,10 +8,13 @@
 // Thread safety
 // -------------
 //
-// Writes require external synchronization, most likely a mutex.
+// Writes require external synchronization, most likely a mutex, except
+// for InsertConcurrently() which may run in several threads at once.
 // Reads require a guarantee that the SkipList will not be destroyed
 // while the read is in progress.  Apart from that, reads progress
-// without any internal locking or synchronization.
+// without any internal locking or synchronization.  A zero-copy Compact()
+// moves nodes between live lists, readers search again when a per-list
+// sequence counter shows that a move ran through their search.
 //
 // Invariants:
 //
@@ -27,19 +30,27 @@
 //
 // ... prev vs. next pointer ordering ...
 
+#include <algorithm>
 #include <atomic>
 #include <cassert>
 #include <cstdlib>
 #include <string.h>
 #include <iostream>
+#include <thread>
+#include <vector>
 
 #include "util/arena.h"
+#include "util/cuckoofilter.h"
 #include "util/random.h"
+#include "util/slab_allocator.h"
 #include "db/dbformat.h"
 #include "leveldb/options.h"
 #include "util/mergeablebloom.h"
+#include "port/port.h"
+#include "util/worker_pool.h"
 #include "sys/time.h"
 #include "db/global.h"
+#include "numa.h"
 
 namespace leveldb {
 
@@ -48,9 +59,14 @@ class Arena;
 template <typename Key, class Comparator>
 class SkipList {
  private:
-  enum { kMaxHeight = 22, kLastHeight = 32 };
+  enum { kMaxHeight = 22, kLastHeight = 32, kMaxPartitions = 32 };
+  // Level whose keys a Fence copies, one node in 64 reaches it
+  enum { kFenceLevel = 3 };
+  // Searches SeekMany() runs in turns
+  enum { kLockstep = 16 };
  public:  // modify by mio
   struct Node;
+  class Fence;
 
  public:
   // Create a new SkipList object that will use "cmp" for comparing keys,
@@ -61,13 +77,32 @@ class SkipList {
   SkipList(const SkipList&) = delete;
   SkipList& operator=(const SkipList&) = delete;
 
+  ~SkipList() { delete fence_.load(std::memory_order_relaxed); }
+
   // Insert key into the list.
   // REQUIRES: nothing that compares equal to key is currently in the list.
   void Insert(const Key& key, const size_t& len);
 
+  // Like Insert(), but safe to call from several threads at once.  Links
+  // are published with compare-and-swap and nodes are carved out of the
+  // arena with AllocateAlignedConcurrently().
+  // REQUIRES: no concurrent calls of Insert() on the same list.
+  void InsertConcurrently(const Key& key, const size_t& len);
+
   // Returns true iff an entry that compares equal to key is in the list.
   bool Contains(const Key& key) const;
 
+  // Most arena bytes a node takes, alignment included
+  static size_t MaxNodeSize() {
+    return sizeof(Node) + sizeof(std::atomic<intptr_t>) * (kMaxHeight - 1) +
+           sizeof(void*);
+  }
+
+  // Iterator::Seek() to each of targets[0,n), with the key reached in
+  // found[i], or a null key past the end.  The searches take turns, each
+  // prefetching the node it compares next, so that their misses overlap.
+  void SeekMany(const Key* targets, int n, Key* found) const;
+
   // Iteration over the contents of a skip list
   class Iterator {
    public:
@@ -80,7 +115,7 @@ class SkipList {
 
     // Returns the key at the current position.
     // REQUIRES: Valid()
-    const Key& key() const;
+    Key key() const;
 
     // Advances to the next position.
     // REQUIRES: Valid()
@@ -90,7 +125,8 @@ class SkipList {
     // REQUIRES: Valid()
     void Prev();
 
-    // Advance to the first entry with a key >= target
+    // Advance to the first entry with a key >= target.  Reads the fence
+    // of the list, if it has one, see SetFence().
     void Seek(const Key& target);
 
     // Position at the first entry in list.
@@ -104,6 +140,7 @@ class SkipList {
    private:
     const SkipList* list_;
     Node* node_;
+    uint64_t version_;  // moves_ of list_ when node_ was found
     // Intentionally copyable
   };
 
@@ -111,28 +148,66 @@ class SkipList {
   // Add by mio
   // public parameter
   Arena* arena_;  // Arena used for allocations of nodes
+  SlabAllocator* slab_;  // Reuses the nodes freed in the last table
   Node* const head_;
   Node* smallest;
   Node* largest[kMaxHeight];
-  std::atomic<Node*> insertingnode;
   size_t wa;
+  size_t reclaimed = 0;  // Bytes LastTableCompact() dropped or did not copy
   uint64_t dumptime;
 
   // public function
   Node* Insert(const Key& key, const size_t& len, Node** prev, bool max);
-  explicit SkipList(Comparator cmp, Arena* arena, const SkipList<Key, Comparator>* list, const Options& options_, MergeableBloom* bloom_);
+  explicit SkipList(Comparator cmp, Arena* arena, const SkipList<Key, Comparator>* list, const Options& options_);
   void PreNext(Node** pre, int height);
   bool Compact(SkipList<Key, Comparator>* list, SequenceNumber snum);
   bool Compact(SkipList<Key, Comparator>* list, bool frontlink);
-
+  // Return true if the user keys of list all sort before (*frontlink) or
+  // all after those of this table, so that Compact(list, *frontlink) can
+  // link the two lists instead of merging them.
+  bool Disjoint(const SkipList<Key, Comparator>* list, bool* frontlink) const;
+  // Compact(list, snum) split into key ranges that are merged on "workers".
+  // Falls back to a single range if this table is too small to split.
+  // Tables that do not overlap are linked by Compact(list, frontlink).
+  bool Compact(SkipList<Key, Comparator>* list, SequenceNumber snum,
+               WorkerPool* workers);
+
+  // Link n after the nodes in prev, which on entry hold the predecessors
+  // of an earlier key (or head_) and are searched onwards from there.
   void Insert(SkipList<Key, Comparator>::Node* n, Node** prev);
   void DeleteNode(Node** pre, Node* n);
 
-  explicit SkipList(Comparator cmp);
+  explicit SkipList(Comparator cmp, Arena* arena, SlabAllocator* slab,
+                    bool lasttable);
+  explicit SkipList(Comparator cmp, Arena* arena, SlabAllocator* slab,
+                    bool lasttable, size_t size);
   Node* LastTableNewNode(const Key& key, int height, const size_t& len);
   void LastTableDeleteNode(Node** pre, Node* n);
+  // Same contract for prev as Insert(Node*, Node**)
   Node* LastTableInsert(const Key& key, const size_t& len, Node** prev);
+  // Nothing is older than the last table, so deletions that every live
+  // snapshot sees are not copied and drop the versions they shadow.
   bool LastTableCompact(SkipList<Key, Comparator>* list, SequenceNumber snum);
+  // LastTableCompact(list, snum) split into key ranges like Compact()
+  bool LastTableCompact(SkipList<Key, Comparator>* list, SequenceNumber snum,
+                        WorkerPool* workers);
+  // From now on keep the user keys of the last table in "filter", which
+  // holds them already.  REQUIRES: no compaction of this table runs
+  void SetFilter(CuckooFilter* filter) { filter_ = filter; }
+  // Record the links that compactions of this table overwrite in "journal"
+  // from now on, stop if it is null.  See NvmPool::BeginUpdate().
+  void SetJournal(NvmJournal* journal) { journal_ = journal; }
+
+  // A fence of the nodes now in the list, allocated on "dram_node", or
+  // nullptr if no node reaches kFenceLevel.
+  // REQUIRES: the list is not modified while it is built
+  Fence* NewFence(int dram_node) const;
+  // Start Iterator::Seek() at "fence" from now on and return the fence it
+  // used so far, which Seek() calls that are still running may read.
+  // REQUIRES: no fence is set while the list is modified
+  Fence* SetFence(Fence* fence) {
+    return fence_.exchange(fence, std::memory_order_acq_rel);
+  }
 
   // modify from private to public
   inline int GetMaxHeight() const {
@@ -164,6 +239,17 @@ class SkipList {
 
   // Return true if key is greater than the data stored in "n"
   bool KeyIsAfterNode(const Key& key, Node* n) const;
+  // KeyIsAfterNode() for a key whose Comparator::KeyPrefix() is "prefix"
+  bool KeyIsAfterNode(const Key& key, const uint64_t* prefix, Node* n) const;
+  // compare_(n->key(), key), decided by the prefixes when they differ and
+  // past them otherwise
+  int CompareNode(const Node* n, const Key& key, const uint64_t* prefix) const;
+
+  // Find the nodes that "key" falls between at "level", starting the search
+  // at "before" which must come before "key".
+  void FindSpliceForLevel(const Key& key, const uint64_t* prefix,
+                          Node* before, int level, Node** out_prev,
+                          Node** out_next) const;
 
   // Return the earliest node that comes at or after key.
   // Return nullptr if there is no such node.
@@ -197,30 +283,176 @@ class SkipList {
   // ------------------------------------------------------------------------------------
   // Add by mio
   // private parameter
-  bool UseBloomFilter;
   bool IsLastTable;
   size_t sizesum;
+  CuckooFilter* filter_ = nullptr;  // Last table: one entry per user key
+  NvmJournal* journal_ = nullptr;   // Set while a compaction runs in the pool
+
+  // n->SetNext(level, x) and n->NoBarrier_SetNext(level, x) for links that
+  // a compaction overwrites, saved in journal_ first
+  void SetLink(Node* n, int level, Node* x);
+  void NoBarrier_SetLink(Node* n, int level, Node* x);
 
   // private function
   int NewCompare(const Node* a, const Node* b, bool hasseq, SequenceNumber snum) const;
   bool NewCompare(const Node* a, const Node* b) const;
   int LastRandomHeight();
+
+  // A compaction split into key ranges.  The nodes of this table at one
+  // level split it, range i runs from bounds[i - 1] (head_ for the first)
+  // to bounds[i].  Below that level every link lies within a range, so
+  // the ranges are merged at once.  Links of taller nodes and nodes next
+  // to the bounds are fixed up by FinishPartitions() afterwards.
+  struct CompactJob {
+    SkipList* table;
+    SkipList* list;
+    SequenceNumber snum;
+    int height;                  // Levels owned by the ranges
+    std::vector<Node*> bounds;
+    std::vector<Node*> first;    // Lazy copy: first node of "list" per range
+    std::vector<std::vector<Node*>> tall;  // Nodes linked below height only
+    std::vector<size_t> wa;
+    std::vector<size_t> reclaimed;
+    std::vector<std::vector<Node*>> deferred;  // Lazy copy: deletions to drop
+    port::Mutex alloc_mu;        // Lazy copy: guards node allocation
+  };
+  bool SplitForCompaction(WorkerPool* workers, CompactJob* job);
+  void InsertInRange(Node* x, Node* start, int height, Node** prev);
+  void FinishPartitions(CompactJob* job);
+  static void CompactPartition(void* arg, int i);
+  static void LastTableCompactPartition(void* arg, int i);
+
+  // Keep filter_ up to date after x was linked after prev, or unlinked
+  // from after it.  Only the first version of a user key to arrive adds
+  // it and only the last one to leave deletes it.
+  void FilterAdd(Node* prev, Node* x);
+  void FilterDelete(Node* prev, Node* x);
+  bool SharesUserKey(Node* prev, Node* x) const;
+
+  // Whether x is a deletion with a sequence number at or below snum
+  bool IsObsoleteDeletion(const Node* x, SequenceNumber snum) const;
+  // Unlink the versions of the user key of the deletion x that follow the
+  // finger in pre, like FindGreaterOrEqualFinger(x->key(), start, height,
+  // pre).  Returns false without unlinking any if one of them is "limit".
+  // Frees the nodes under "mu" unless it is null, in which case smallest
+  // and largest[0] are kept up to date as well.
+  bool LastTableDropKey(const Node* x, Node* start, int height, Node* limit,
+                        Node** pre, port::Mutex* mu);
+
+  // Return the earliest node at or after key in the list that starts at
+  // "head", searching from level "height - 1".
+  Node* FindGreaterOrEqualFrom(Node* head, int height, const Key& key) const;
+
+  // FindGreaterOrEqual() on the levels below "height", starting from the
+  // finger in prev: the predecessors of an earlier position at every one
+  // of those levels, or "start" at all of them.  Starts over from "start"
+  // if key is not after prev[0].
+  Node* FindGreaterOrEqualFinger(const Key& key, Node* start, int height,
+                                 Node** prev) const;
+
+  // Set by a zero-copy Compact() split into ranges: the nodes of range i
+  // wait in the list that starts at pending_[i] and are moved one at a
+  // time into the table.  Readers search both.
+  std::atomic<int> partitions_{0};
+  int pending_height_ = 0;
+  Node* pending_[kMaxPartitions] = {};
+
+  // Zero-copy moves are seqlocks: the counter of a list is odd while a
+  // move takes nodes out of it or links them into it.  moves_ guards this
+  // table, range_moves_[i] the nodes of range i while they are pending.
+  // A reader that a move ran through searches again.
+  std::atomic<uint64_t> moves_{0};
+  std::atomic<uint64_t> range_moves_[kMaxPartitions] = {};
+  static uint64_t ReadBegin(const std::atomic<uint64_t>* seq);
+  static bool ReadRetry(const std::atomic<uint64_t>* seq, uint64_t version);
+  static void BeginMove(std::atomic<uint64_t>* seq);
+  static void EndMove(std::atomic<uint64_t>* seq);
+
+  // The earliest node of the list that starts at "head" after target, or
+  // at or after it unless "after".  Null target is before every key.
+  Node* FindFrom(Node* head, int height, const Key* target, bool after) const;
+  // Earlier of two nodes, either of which may be null
+  Node* Earlier(Node* a, Node* b) const;
+  // FindFrom() on the table, starting at the last node of "fence" before
+  // target if "fence" is not null
+  Node* FindInTable(const Fence* fence, const Key* target, bool after) const;
+  // FindInTable() for each of targets[0,n), n <= kLockstep, in turns
+  void FindInTableLockstep(const Fence* fence, const Key* targets, int n,
+                           Node** found) const;
+  // Like FindFrom() on the table and the pending ranges together,
+  // consistently with the moves between them.  Sets *version to the
+  // moves_ the result is valid for.  Searches start at fence_ if "fenced".
+  Node* FindForReader(const Key* target, bool after, uint64_t* version,
+                      bool fenced) const;
+
+  // Set only while no compaction changes the list.  Readers that used a
+  // fence cleared since see moves_ change and search again, except after
+  // Compact(list, frontlink), which links nodes before or after all of
+  // those in the fence, where searches from it still find them.
+  std::atomic<Fence*> fence_{nullptr};
   // Add end
   // ------------------------------------------------------------------------------------
 };
 
 // Implementation details follow
+
+// Nodes refer to keys and to other nodes by their distance from the node
+// (or link) that holds the reference instead of by address.  A table is
+// then valid wherever it is placed, so a flushed memtable arena becomes a
+// datatable with one memcpy and a table in the nvm pool can be mapped at
+// any address.  Offset 0 is null: nothing refers to its own location.
+template <typename Key>
+class RelativeKey {
+ public:
+  // Keys that are not pointers are stored as they are
+  Key Get(const void* base) const { return key_; }
+  void Set(const void* base, const Key& key) { key_ = key; }
+
+ private:
+  Key key_;
+};
+
+template <typename T>
+class RelativeKey<T*> {
+ public:
+  T* Get(const void* base) const {
+    return offset_ == 0 ? nullptr
+                        : reinterpret_cast<T*>(
+                              const_cast<char*>(
+                                  reinterpret_cast<const char*>(base)) +
+                              offset_);
+  }
+  void Set(const void* base, T* key) {
+    offset_ = (key == nullptr) ? 0
+                               : reinterpret_cast<const char*>(key) -
+                                     reinterpret_cast<const char*>(base);
+  }
+
+ private:
+  intptr_t offset_;
+};
+
+// The fields a search reads at every hop come first: 32 bytes that hold
+// the prefix of the key, so that the key is only read when the prefixes
+// are equal, followed by the links.  A node up to four levels high fits
+// in a cache line.
 template <typename Key, class Comparator>
 struct SkipList<Key, Comparator>::Node {
   // add parameter len by mio 2020/5/30
-  explicit Node(const Key& k, const size_t& l, const int h) : key(k), len(l), height(h) {}
+  explicit Node(const Key& k, const size_t& l, const int h) : len(l), height(h) {
+    SetKey(k);
+  }
+
+  Key key() const { return key_.Get(this); }
+  void SetKey(const Key& k) {
+    key_.Set(this, k);
+    Comparator::KeyPrefix(k, prefix);
+  }
 
-  // modify by mio 2020/5/29
-  // Key const -> key;
-  Key key;
   // add by mio 2020/5/29
-  size_t len;
-  int height;
+  uint32_t len;
+  uint16_t height;
+  uint64_t prefix[2];  // Comparator::KeyPrefix() of the key
 
   // Accessors/mutators for links.  Wrapped in methods so we can
   // add the appropriate barriers as necessary.
@@ -228,36 +460,147 @@ struct SkipList<Key, Comparator>::Node {
     assert(n >= 0);
     // Use an 'acquire load' so that we observe a fully initialized
     // version of the returned Node.
-    return next_[n].load(std::memory_order_acquire);
+    return Decode(n, next_[n].load(std::memory_order_acquire));
   }
   void SetNext(int n, Node* x) {
     assert(n >= 0);
     // Use a 'release store' so that anybody who reads through this
     // pointer observes a fully initialized version of the inserted node.
-    next_[n].store(x, std::memory_order_release);
+    next_[n].store(Encode(n, x), std::memory_order_release);
   }
 
   // No-barrier variants that can be safely used in a few locations.
   Node* NoBarrier_Next(int n) {
     assert(n >= 0);
-    return next_[n].load(std::memory_order_relaxed);
+    return Decode(n, next_[n].load(std::memory_order_relaxed));
   }
   void NoBarrier_SetNext(int n, Node* x) {
     assert(n >= 0);
-    next_[n].store(x, std::memory_order_relaxed);
+    next_[n].store(Encode(n, x), std::memory_order_relaxed);
+  }
+
+  // The word that holds link n, for NvmJournal::Record()
+  const void* Link(int n) const { return &next_[n]; }
+
+  // Replace the link "expected" by "x", fail if another thread got there first
+  bool CASNext(int n, Node* expected, Node* x) {
+    assert(n >= 0);
+    intptr_t e = Encode(n, expected);
+    return next_[n].compare_exchange_strong(e, Encode(n, x),
+                                            std::memory_order_acq_rel);
   }
 
  private:
+  intptr_t Encode(int n, Node* x) const {
+    return (x == nullptr) ? 0
+                          : reinterpret_cast<const char*>(x) -
+                                reinterpret_cast<const char*>(&next_[n]);
+  }
+  Node* Decode(int n, intptr_t offset) {
+    return (offset == 0) ? nullptr
+                         : reinterpret_cast<Node*>(
+                               reinterpret_cast<char*>(&next_[n]) + offset);
+  }
+
+  RelativeKey<Key> key_;
   // Array of length equal to the node height.  next_[0] is lowest level link.
-  std::atomic<Node*> next_[1];
+  std::atomic<intptr_t> next_[1];
 };
 
+// Copies in DRAM of the keys at kFenceLevel in key order, with their
+// nodes.  A search finds the last one before its key here and walks only
+// the levels below it on NVM.
+template <typename Key, class Comparator>
+class SkipList<Key, Comparator>::Fence {
+ public:
+  Fence(const SkipList* list, int dram_node);
+
+  Fence(const Fence&) = delete;
+  Fence& operator=(const Fence&) = delete;
+
+  ~Fence() { numa_free(mem_, bytes_); }
+
+  // The last node before key, nullptr if there is none
+  Node* Before(const Comparator& cmp, const Key& key) const;
+
+  size_t NumNodes() const { return num_nodes_; }
+
+ private:
+  struct Entry {
+    Node* node;
+    const char* key;  // Length prefixed internal key, in mem_
+  };
+
+  static size_t KeySize(const char* key) {
+    uint32_t len;
+    const char* p = GetVarint32Ptr(key, key + 5, &len);
+    return (p - key) + len;
+  }
+
+  size_t num_nodes_;
+  size_t bytes_;
+  char* mem_;        // entries_ followed by the keys
+  Entry* entries_;
+};
+
+template <typename Key, class Comparator>
+SkipList<Key, Comparator>::Fence::Fence(const SkipList* list, int dram_node)
+    : num_nodes_(0), bytes_(0) {
+  size_t key_bytes = 0;
+  for (Node* x = list->head_->Next(kFenceLevel); x != nullptr;
+       x = x->Next(kFenceLevel)) {
+    num_nodes_++;
+    key_bytes += KeySize(x->key());
+  }
+  bytes_ = num_nodes_ * sizeof(Entry) + key_bytes;
+  mem_ = reinterpret_cast<char*>(numa_alloc_onnode(bytes_, dram_node));
+  entries_ = reinterpret_cast<Entry*>(mem_);
+  char* p = mem_ + num_nodes_ * sizeof(Entry);
+  size_t i = 0;
+  for (Node* x = list->head_->Next(kFenceLevel); x != nullptr;
+       x = x->Next(kFenceLevel)) {
+    const size_t size = KeySize(x->key());
+    memcpy(p, x->key(), size);
+    entries_[i].node = x;
+    entries_[i].key = p;
+    p += size;
+    i++;
+  }
+}
+
+template <typename Key, class Comparator>
+typename SkipList<Key, Comparator>::Node*
+SkipList<Key, Comparator>::Fence::Before(const Comparator& cmp,
+                                         const Key& key) const {
+  // Entries before lo are before key, those from hi on are not
+  size_t lo = 0;
+  size_t hi = num_nodes_;
+  while (lo < hi) {
+    const size_t mid = lo + (hi - lo) / 2;
+    if (cmp(entries_[mid].key, key) < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo == 0 ? nullptr : entries_[lo - 1].node;
+}
+
+template <typename Key, class Comparator>
+typename SkipList<Key, Comparator>::Fence*
+SkipList<Key, Comparator>::NewFence(int dram_node) const {
+  if (head_->Next(kFenceLevel) == nullptr) {
+    return nullptr;
+  }
+  return new Fence(this, dram_node);
+}
+
 // modify by mio 2020/5/20
 template <typename Key, class Comparator>
 typename SkipList<Key, Comparator>::Node* SkipList<Key, Comparator>::NewNode(
     const Key& key, int height, const size_t& len) {
   char* node_memory = arena_->AllocateAligned(
-                            sizeof(Node) + sizeof(std::atomic<Node*>) * (height - 1));
+                            sizeof(Node) + sizeof(std::atomic<intptr_t>) * (height - 1));
   return new (node_memory) Node(key, len, height);
 }
 
@@ -265,6 +608,7 @@ template <typename Key, class Comparator>
 inline SkipList<Key, Comparator>::Iterator::Iterator(const SkipList* list) {
   list_ = list;
   node_ = nullptr;
+  version_ = 0;
 }
 
 template <typename Key, class Comparator>
@@ -273,16 +617,27 @@ inline bool SkipList<Key, Comparator>::Iterator::Valid() const {
 }
 
 template <typename Key, class Comparator>
-inline const Key& SkipList<Key, Comparator>::Iterator::key() const {
+inline Key SkipList<Key, Comparator>::Iterator::key() const {
   assert(Valid());
-  return node_->key;
+  return node_->key();
 }
 
 template <typename Key, class Comparator>
 inline void SkipList<Key, Comparator>::Iterator::Next() {
   assert(Valid());
-  while (list_->insertingnode.load(std::memory_order_acquire) != nullptr);
-  node_ = node_->Next(0);
+  if (list_->partitions_.load(std::memory_order_acquire) == 0) {
+    const uint64_t version = ReadBegin(&list_->moves_);
+    if (version == version_) {
+      Node* next = node_->Next(0);
+      if (!ReadRetry(&list_->moves_, version)) {
+        node_ = next;
+        return;
+      }
+    }
+  }
+  // node_ may have been moved to another list since it was found
+  const Key key = node_->key();
+  node_ = list_->FindForReader(&key, true, &version_, false);
 }
 
 template <typename Key, class Comparator>
@@ -290,7 +645,11 @@ inline void SkipList<Key, Comparator>::Iterator::Prev() {
   // Instead of using explicit "prev" links, we just search for the
   // last node that falls before key.
   assert(Valid());
-  node_ = list_->FindLessThan(node_->key);
+  const Key key = node_->key();
+  do {
+    version_ = ReadBegin(&list_->moves_);
+    node_ = list_->FindLessThan(key);
+  } while (ReadRetry(&list_->moves_, version_));
   if (node_ == list_->head_) {
     node_ = nullptr;
   }
@@ -298,30 +657,197 @@ inline void SkipList<Key, Comparator>::Iterator::Prev() {
 
 template <typename Key, class Comparator>
 inline void SkipList<Key, Comparator>::Iterator::Seek(const Key& target) {
-  node_ = list_->FindGreaterOrEqual(target, nullptr);
-  Node* tmp = list_->insertingnode.load(std::memory_order_acquire);
-  if (tmp != nullptr && !list_->KeyIsAfterNode(target, tmp)) {
-    if (node_ == nullptr) {
-      node_ = tmp;
-    } else if (list_->NewCompare(node_, tmp)) { // node_->key = ins->key && node_->snum < ins_snum
-      node_ = tmp;
-    }
-  }
+  node_ = list_->FindForReader(&target, false, &version_, true);
 }
 
 template <typename Key, class Comparator>
 inline void SkipList<Key, Comparator>::Iterator::SeekToFirst() {
-  node_ = list_->head_->Next(0);
+  node_ = list_->FindForReader(nullptr, false, &version_, false);
 }
 
 template <typename Key, class Comparator>
 inline void SkipList<Key, Comparator>::Iterator::SeekToLast() {
-  node_ = list_->FindLast();
+  do {
+    version_ = ReadBegin(&list_->moves_);
+    node_ = list_->FindLast();
+  } while (ReadRetry(&list_->moves_, version_));
   if (node_ == list_->head_) {
     node_ = nullptr;
   }
 }
 
+template <typename Key, class Comparator>
+uint64_t SkipList<Key, Comparator>::ReadBegin(
+    const std::atomic<uint64_t>* seq) {
+  uint64_t version;
+  while ((version = seq->load(std::memory_order_acquire)) & 1) {
+    // A move only relinks a few links, let its thread run
+    std::this_thread::yield();
+  }
+  return version;
+}
+
+template <typename Key, class Comparator>
+bool SkipList<Key, Comparator>::ReadRetry(const std::atomic<uint64_t>* seq,
+                                          uint64_t version) {
+  // Keep the reads of the links before the check
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return seq->load(std::memory_order_relaxed) != version;
+}
+
+template <typename Key, class Comparator>
+void SkipList<Key, Comparator>::BeginMove(std::atomic<uint64_t>* seq) {
+  seq->store(seq->load(std::memory_order_relaxed) + 1,
+             std::memory_order_relaxed);
+  // Keep the writes of the links after it
+  std::atomic_thread_fence(std::memory_order_release);
+}
+
+template <typename Key, class Comparator>
+void SkipList<Key, Comparator>::EndMove(std::atomic<uint64_t>* seq) {
+  seq->store(seq->load(std::memory_order_relaxed) + 1,
+             std::memory_order_release);
+}
+
+template <typename Key, class Comparator>
+typename SkipList<Key, Comparator>::Node* SkipList<Key, Comparator>::FindFrom(
+    Node* head, int height, const Key* target, bool after) const {
+  if (target == nullptr) {
+    return head->Next(0);
+  }
+  Node* x = FindGreaterOrEqualFrom(head, height, *target);
+  if (after && x != nullptr && Equal(x->key(), *target)) {
+    x = x->Next(0);
+  }
+  return x;
+}
+
+// The nodes at kFenceLevel and above the start of the search are at or
+// after target, so the search from head_ also skips the levels above.
+template <typename Key, class Comparator>
+typename SkipList<Key, Comparator>::Node* SkipList<Key, Comparator>::FindInTable(
+    const Fence* fence, const Key* target, bool after) const {
+  if (fence == nullptr || target == nullptr) {
+    return FindFrom(head_, GetMaxHeight(), target, after);
+  }
+  Node* start = fence->Before(compare_, *target);
+  return FindFrom(start != nullptr ? start : head_, kFenceLevel, target, after);
+}
+
+template <typename Key, class Comparator>
+void SkipList<Key, Comparator>::FindInTableLockstep(const Fence* fence,
+                                                    const Key* targets, int n,
+                                                    Node** found) const {
+  struct Search {
+    Node* x;
+    Node* next;  // Prefetched, compared on the next turn
+    int level;
+    uint64_t prefix[2];
+  };
+  Search searches[kLockstep];
+  int active[kLockstep];
+  for (int i = 0; i < n; i++) {
+    Search& s = searches[i];
+    Comparator::KeyPrefix(targets[i], s.prefix);
+    s.x = fence != nullptr ? fence->Before(compare_, targets[i]) : nullptr;
+    s.level = (fence != nullptr ? kFenceLevel : GetMaxHeight()) - 1;
+    if (s.x == nullptr) s.x = head_;
+    s.next = s.x->Next(s.level);
+    if (s.next != nullptr) __builtin_prefetch(s.next);
+    active[i] = i;
+  }
+  // Like FindGreaterOrEqualFrom(), one step of each search per turn
+  int remaining = n;
+  while (remaining > 0) {
+    int kept = 0;
+    for (int j = 0; j < remaining; j++) {
+      const int i = active[j];
+      Search& s = searches[i];
+      if (KeyIsAfterNode(targets[i], s.prefix, s.next)) {
+        s.x = s.next;
+      } else if (s.level == 0) {
+        found[i] = s.next;
+        continue;
+      } else {
+        s.level--;
+      }
+      s.next = s.x->Next(s.level);
+      if (s.next != nullptr) __builtin_prefetch(s.next);
+      active[kept++] = i;
+    }
+    remaining = kept;
+  }
+}
+
+// Lockstep searches only run while no partitioned compaction does, the
+// pending ranges are left to FindForReader().
+template <typename Key, class Comparator>
+void SkipList<Key, Comparator>::SeekMany(const Key* targets, int n,
+                                         Key* found) const {
+  Node* nodes[kLockstep];
+  for (int start = 0; start < n; start += kLockstep) {
+    const int count = std::min<int>(n - start, kLockstep);
+    bool done = false;
+    while (!done) {
+      const uint64_t v = ReadBegin(&moves_);
+      if (partitions_.load(std::memory_order_acquire) != 0) break;
+      FindInTableLockstep(fence_.load(std::memory_order_acquire),
+                          targets + start, count, nodes);
+      done = !ReadRetry(&moves_, v);
+    }
+    for (int i = 0; i < count; i++) {
+      if (!done) {
+        uint64_t version;
+        nodes[i] = FindForReader(&targets[start + i], false, &version, true);
+      }
+      found[start + i] = nodes[i] != nullptr ? nodes[i]->key() : Key();
+    }
+  }
+}
+
+template <typename Key, class Comparator>
+typename SkipList<Key, Comparator>::Node* SkipList<Key, Comparator>::Earlier(
+    Node* a, Node* b) const {
+  if (a == nullptr) return b;
+  if (b == nullptr) return a;
+  return CompareNode(b, a->key(), a->prefix) < 0 ? b : a;
+}
+
+// A node of range i is either pending or in the table while no move of
+// range i runs.  The pending lists are searched before the table, so only
+// the ranges whose counter changed by the end are searched again.
+template <typename Key, class Comparator>
+typename SkipList<Key, Comparator>::Node*
+SkipList<Key, Comparator>::FindForReader(const Key* target, bool after,
+                                         uint64_t* version,
+                                         bool fenced) const {
+  Node* found[kMaxPartitions];
+  uint64_t seen[kMaxPartitions];
+  while (true) {
+    const uint64_t v = ReadBegin(&moves_);
+    const Fence* fence =
+        fenced ? fence_.load(std::memory_order_acquire) : nullptr;
+    const int partitions = partitions_.load(std::memory_order_acquire);
+    for (int i = 0; i < partitions; i++) {
+      seen[i] = ReadBegin(&range_moves_[i]);
+      found[i] = FindFrom(pending_[i], pending_height_, target, after);
+    }
+    Node* x = FindInTable(fence, target, after);
+    for (int i = 0; i < partitions; i++) {
+      while (ReadRetry(&range_moves_[i], seen[i])) {
+        seen[i] = ReadBegin(&range_moves_[i]);
+        found[i] = Earlier(FindFrom(pending_[i], pending_height_, target, after),
+                           FindInTable(fence, target, after));
+      }
+      x = Earlier(x, found[i]);
+    }
+    if (!ReadRetry(&moves_, v)) {
+      *version = v;
+      return x;
+    }
+  }
+}
+
 template <typename Key, class Comparator>
 int SkipList<Key, Comparator>::RandomHeight() {
   // Increase height with probability 1 in kBranching
@@ -339,19 +865,42 @@ int SkipList<Key, Comparator>::RandomHeight() {
 // n->userkey = k->userkey, n->num > k->num return true
 template <typename Key, class Comparator>
 bool SkipList<Key, Comparator>::KeyIsAfterNode(const Key& key, Node* n) const {
+  uint64_t prefix[2];
+  Comparator::KeyPrefix(key, prefix);
+  return KeyIsAfterNode(key, prefix, n);
+}
+
+template <typename Key, class Comparator>
+bool SkipList<Key, Comparator>::KeyIsAfterNode(const Key& key,
+                                               const uint64_t* prefix,
+                                               Node* n) const {
   // null n is considered infinite
-  return (n != nullptr) && (compare_(n->key, key) < 0);
+  return (n != nullptr) && (CompareNode(n, key, prefix) < 0);
+}
+
+template <typename Key, class Comparator>
+inline int SkipList<Key, Comparator>::CompareNode(const Node* n,
+                                                  const Key& key,
+                                                  const uint64_t* prefix) const {
+  if (compare_.prefix_order) {
+    if (n->prefix[0] != prefix[0]) return n->prefix[0] < prefix[0] ? -1 : 1;
+    if (n->prefix[1] != prefix[1]) return n->prefix[1] < prefix[1] ? -1 : 1;
+    return Comparator::BytewiseCompare(n->key(), key, sizeof(n->prefix));
+  }
+  return compare_.UserCompare(n->key(), key);
 }
 
 template <typename Key, class Comparator>
 typename SkipList<Key, Comparator>::Node*
 SkipList<Key, Comparator>::FindGreaterOrEqual(const Key& key,
                                               Node** prev) const {
+  uint64_t prefix[2];
+  Comparator::KeyPrefix(key, prefix);
   Node* x = head_;
   int level = GetMaxHeight() - 1;
   while (true) {
     Node* next = x->Next(level);
-    if (KeyIsAfterNode(key, next)) {
+    if (KeyIsAfterNode(key, prefix, next)) {
       // Keep searching in this list
       x = next;
     } else {
@@ -366,15 +915,77 @@ SkipList<Key, Comparator>::FindGreaterOrEqual(const Key& key,
   }
 }
 
+template <typename Key, class Comparator>
+typename SkipList<Key, Comparator>::Node*
+SkipList<Key, Comparator>::FindGreaterOrEqualFrom(Node* head, int height,
+                                                  const Key& key) const {
+  uint64_t prefix[2];
+  Comparator::KeyPrefix(key, prefix);
+  Node* x = head;
+  Node* next = nullptr;
+  for (int level = height - 1; level >= 0; level--) {
+    while (KeyIsAfterNode(key, prefix, next = x->Next(level))) {
+      x = next;
+    }
+  }
+  // Not x->Next(0) again, a concurrent insert may have put a node before
+  // key there since it was compared
+  return next;
+}
+
+// A merge inserts keys in order, mostly close to the previous one, so the
+// search climbs from the finger only while the next node of a level is
+// still before key, and goes down from there.
+template <typename Key, class Comparator>
+typename SkipList<Key, Comparator>::Node*
+SkipList<Key, Comparator>::FindGreaterOrEqualFinger(const Key& key,
+                                                    Node* start, int height,
+                                                    Node** prev) const {
+  uint64_t prefix[2];
+  Comparator::KeyPrefix(key, prefix);
+  Node* x;
+  int level;
+  if (prev[0] == start || KeyIsAfterNode(key, prefix, prev[0])) {
+    level = 0;
+    while (level < height &&
+           KeyIsAfterNode(key, prefix, prev[level]->Next(level))) {
+      level++;
+    }
+    if (level == 0) {
+      return prev[0]->Next(0);
+    }
+    // prev[level..height-1] are already the predecessors of key
+    level--;
+    x = prev[level];
+  } else {
+    level = height - 1;
+    x = start;
+  }
+  while (true) {
+    Node* next = x->Next(level);
+    if (KeyIsAfterNode(key, prefix, next)) {
+      x = next;
+    } else {
+      prev[level] = x;
+      if (level == 0) {
+        return next;
+      }
+      level--;
+    }
+  }
+}
+
 template <typename Key, class Comparator>
 typename SkipList<Key, Comparator>::Node*
 SkipList<Key, Comparator>::FindLessThan(const Key& key) const {
+  uint64_t prefix[2];
+  Comparator::KeyPrefix(key, prefix);
   Node* x = head_;
   int level = GetMaxHeight() - 1;
   while (true) {
-    assert(x == head_ || compare_(x->key, key) < 0);
+    assert(x == head_ || compare_(x->key(), key) < 0);
     Node* next = x->Next(level);
-    if (next == nullptr || compare_(next->key, key) >= 0) {
+    if (next == nullptr || CompareNode(next, key, prefix) >= 0) {
       if (level == 0) {
         return x;
       } else {
@@ -410,17 +1021,16 @@ typename SkipList<Key, Comparator>::Node* SkipList<Key, Comparator>::FindLast()
 // modify by mio
 template <typename Key, class Comparator>
 SkipList<Key, Comparator>::SkipList(Comparator cmp, Arena* arena)
-    : UseBloomFilter(false),
-      IsLastTable(false),
+    : IsLastTable(false),
       compare_(cmp),
       arena_(arena),
+      slab_(nullptr),
       head_(NewNode(0 /* any key will do */, kMaxHeight, 0 /*add by mio*/)),
       max_height_(1),
       rnd_(0xdeadbeef) {
   for (int i = 0; i < kMaxHeight; i++) {
     head_->SetNext(i, nullptr);
   }
-  insertingnode.store(nullptr, std::memory_order_relaxed);
 }
 
 // add parameter len by mio 2020/5/30
@@ -432,7 +1042,7 @@ void SkipList<Key, Comparator>::Insert(const Key& key, const size_t& len) {
   Node* x = FindGreaterOrEqual(key, prev);
 
   // Our data structure does not allow duplicate insertion
-  assert(x == nullptr || !Equal(key, x->key));
+  assert(x == nullptr || !Equal(key, x->key()));
 
   int height = RandomHeight();
   if (height > GetMaxHeight()) {
@@ -458,10 +1068,81 @@ void SkipList<Key, Comparator>::Insert(const Key& key, const size_t& len) {
   }
 }
 
+template <typename Key, class Comparator>
+void SkipList<Key, Comparator>::FindSpliceForLevel(const Key& key,
+                                                   const uint64_t* prefix,
+                                                   Node* before, int level,
+                                                   Node** out_prev,
+                                                   Node** out_next) const {
+  while (true) {
+    Node* next = before->Next(level);
+    if (KeyIsAfterNode(key, prefix, next)) {
+      before = next;
+    } else {
+      *out_prev = before;
+      *out_next = next;
+      return;
+    }
+  }
+}
+
+template <typename Key, class Comparator>
+void SkipList<Key, Comparator>::InsertConcurrently(const Key& key,
+                                                   const size_t& len) {
+  // rnd_ belongs to the single threaded writer, every inserting thread
+  // draws heights from its own generator instead.
+  static thread_local Random rnd(static_cast<uint32_t>(
+      reinterpret_cast<uintptr_t>(&rnd) >> 4) | 1);
+  static const unsigned int kBranching = 4;
+  int height = 1;
+  while (height < kMaxHeight && ((rnd.Next() % kBranching) == 0)) {
+    height++;
+  }
+
+  int max_height = GetMaxHeight();
+  while (height > max_height) {
+    // Readers that see the new height before the links of head_ are set
+    // drop down a level on nullptr, as in Insert()
+    if (max_height_.compare_exchange_weak(max_height, height,
+                                          std::memory_order_relaxed)) {
+      max_height = height;
+      break;
+    }
+  }
+
+  char* node_memory = arena_->AllocateAlignedConcurrently(
+      sizeof(Node) + sizeof(std::atomic<intptr_t>) * (height - 1));
+  Node* x = new (node_memory) Node(key, len, height);
+
+  // Find the splice at every level from the top, each level starting at
+  // the predecessor found one level up.
+  Node* prev[kMaxHeight];
+  Node* next[kMaxHeight];
+  Node* before = head_;
+  for (int level = max_height - 1; level >= 0; level--) {
+    FindSpliceForLevel(key, x->prefix, before, level, &prev[level],
+                       &next[level]);
+    before = prev[level];
+  }
+
+  // Link bottom up, so that x is reachable at a level only once it is in
+  // every level below.  A failed CAS means another node went in between,
+  // search again from the old predecessor.
+  for (int i = 0; i < height; i++) {
+    while (true) {
+      x->NoBarrier_SetNext(i, next[i]);
+      if (prev[i]->CASNext(i, next[i], x)) {
+        break;
+      }
+      FindSpliceForLevel(key, x->prefix, prev[i], i, &prev[i], &next[i]);
+    }
+  }
+}
+
 template <typename Key, class Comparator>
 bool SkipList<Key, Comparator>::Contains(const Key& key) const {
   Node* x = FindGreaterOrEqual(key, nullptr);
-  if (x != nullptr && Equal(key, x->key)) {
+  if (x != nullptr && Equal(key, x->key())) {
     return true;
   } else {
     return false;
@@ -470,15 +1151,16 @@ bool SkipList<Key, Comparator>::Contains(const Key& key) const {
 
 // Add by mio, 2020/5/14
 // serve for small datatable
+// "arena" holds a copy of the memtable's arena.  Links are relative, so the
+// copy is already a valid list; only largest[] is left to compute.
 template <typename Key, class Comparator>
 SkipList<Key, Comparator>::SkipList(Comparator cmp, Arena* arena,
                                     const SkipList<Key, Comparator>* list,
-                                    const Options& options_,
-                                    MergeableBloom* bloom_)
-    : UseBloomFilter(bloom_ != nullptr),
-      IsLastTable(false),
+                                    const Options& options_)
+    : IsLastTable(false),
       compare_(cmp),
       arena_(arena),
+      slab_(nullptr),
       head_((Node*)arena->GetHead()),
       max_height_(list->GetMaxHeight()),
       rnd_(0xdeadbeef) {
@@ -487,50 +1169,22 @@ SkipList<Key, Comparator>::SkipList(Comparator cmp, Arena* arena,
   dumptime = 0;
   struct timeval start, end;
   gettimeofday(&start, nullptr);
-  Node* x;
-  for (int level = 0; level < GetMaxHeight(); level++) {
-    x = head_;
-    do {
-      // The pointer of key
-      if (x != head_ && level == 0) {
-        x->key = x->key - (Key)(list->head_) + (Key)head_;
-	    wa += 8;
-        if (UseBloomFilter) {
-          uint32_t len;
-          const char* p = x->key;
-          p = GetVarint32Ptr(p, p + 5, &len);  // +5: we assume "p" is not corrupted
-          Slice tmpkey = Slice(p, len - 8);
-          bloom_->AddKey(tmpkey);
-        }
-      }
-      // The pointer of next node
-      x->NoBarrier_SetNext(level, x->NoBarrier_Next(level) - list->head_ + head_);
-	  wa += 8;
-      x = x->NoBarrier_Next(level);
-    } while (x->NoBarrier_Next(level) != nullptr);
-    if (level == 0) {
-      x->key = x->key - (Key)(list->head_) + (Key)head_;
-	  wa += 8;
-      if (UseBloomFilter) {
-        uint32_t len;
-        const char* p = x->key;
-        p = GetVarint32Ptr(p, p + 5, &len);  // +5: we assume "p" is not corrupted
-        Slice tmpkey = Slice(p, len - 8);
-        bloom_->AddKey(tmpkey);
-      }
-      largest[level] = x;
-    } else {
-      largest[level] = x;
+  // Walk down the right edge of the list to find the last node of every level
+  for (int level = GetMaxHeight(); level < kMaxHeight; level++) {
+    largest[level] = nullptr;
+  }
+  Node* x = head_;
+  for (int level = GetMaxHeight() - 1; level >= 0; level--) {
+    Node* next;
+    while ((next = x->NoBarrier_Next(level)) != nullptr) {
+      x = next;
     }
+    largest[level] = x;
   }
   gettimeofday(&end, nullptr);
   dumptime = (end.tv_sec - start.tv_sec) * 1000000L + (end.tv_usec - start.tv_usec);
-  if (UseBloomFilter) {
-    bloom_->Finish();
-  }
 
   smallest = head_->NoBarrier_Next(0);
-  insertingnode.store(nullptr, std::memory_order_relaxed);
 }
 
 template <typename Key, class Comparator>
@@ -550,18 +1204,27 @@ template <typename Key, class Comparator>
 int SkipList<Key, Comparator>::NewCompare(const Node* a, const Node* b, bool hasseq, SequenceNumber snum) const {
   if (a == nullptr || b == nullptr) {
     return 0;
-  } else {
-    return compare_.NewCompare(a->key, b->key, hasseq, snum);
+  } else if (!hasseq && compare_.prefix_order) {
+    // The sequence numbers are in the keys, the user key order is not
+    if (a->prefix[0] != b->prefix[0]) {
+      return a->prefix[0] < b->prefix[0] ? 0b01 : 0b11;
+    }
+    if (a->prefix[1] != b->prefix[1]) {
+      return a->prefix[1] < b->prefix[1] ? 0b01 : 0b11;
+    }
   }
+  return compare_.NewCompare(a->key(), b->key(), hasseq, snum);
 }
 
 template <typename Key, class Comparator>
 bool SkipList<Key, Comparator>::NewCompare(const Node* a, const Node* b) const {
   if (a == nullptr || b == nullptr) {
     return false;
-  } else {
-    return compare_.NewCompare(a->key, b->key);
+  } else if (compare_.prefix_order &&
+             (a->prefix[0] != b->prefix[0] || a->prefix[1] != b->prefix[1])) {
+    return false;  // Different user keys
   }
+  return compare_.NewCompare(a->key(), b->key());
 }
 
 template <typename Key, class Comparator>
@@ -581,16 +1244,16 @@ typename SkipList<Key, Comparator>::Node* SkipList<Key, Comparator>::Insert(cons
     // NoBarrier_SetNext() suffices since we will add a barrier when
     // we publish a pointer to "x" in prev[i].
     x->NoBarrier_SetNext(i, prev[i]->NoBarrier_Next(i));
-    prev[i]->SetNext(i, x);
+    SetLink(prev[i], i, x);
   }
   return x;
 }
 
 template <typename Key, class Comparator>
 void SkipList<Key, Comparator>::Insert(SkipList<Key, Comparator>::Node* n, Node** prev) {
-  Node* x = FindGreaterOrEqual(n->key, prev);
+  Node* x = FindGreaterOrEqualFinger(n->key(), head_, GetMaxHeight(), prev);
 
-  assert(x == nullptr || !Equal(n->key, x->key));
+  assert(x == nullptr || !Equal(n->key(), x->key()));
 
   int height = n->height;
   if (height > GetMaxHeight()) {
@@ -601,18 +1264,35 @@ void SkipList<Key, Comparator>::Insert(SkipList<Key, Comparator>::Node* n, Node*
   }
 
   for (int i = 0; i < height; i++) {
-    n->NoBarrier_SetNext(i, prev[i]->NoBarrier_Next(i));
-    prev[i]->SetNext(i, n);
+    NoBarrier_SetLink(n, i, prev[i]->NoBarrier_Next(i));
+    SetLink(prev[i], i, n);
   }
 }
 
 template <typename Key, class Comparator>
 void SkipList<Key, Comparator>::DeleteNode(Node** pre, Node* n) {
   for (int i = 0; i < n->height; i++) {
-    pre[i]->SetNext(i, n->Next(i));
+    SetLink(pre[i], i, n->Next(i));
   }
 }
 
+template <typename Key, class Comparator>
+inline void SkipList<Key, Comparator>::SetLink(Node* n, int level, Node* x) {
+  if (journal_ != nullptr) {
+    journal_->Record(n->Link(level));
+  }
+  n->SetNext(level, x);
+}
+
+template <typename Key, class Comparator>
+inline void SkipList<Key, Comparator>::NoBarrier_SetLink(Node* n, int level,
+                                                         Node* x) {
+  if (journal_ != nullptr) {
+    journal_->Record(n->Link(level));
+  }
+  n->NoBarrier_SetNext(level, x);
+}
+
 // only compact overlapping skiplists
 // insert all old table's nodes into new table(this table)
 /*
@@ -633,12 +1313,12 @@ bool SkipList<Key, Comparator>::Compact(SkipList<Key, Comparator>* list, Sequenc
   x = x->Next(0);
   y = y->Next(0);
   
-  // front, y->key < head_->Next(0)->key
+  // front, y->key() < head_->Next(0)->key()
   while (y != nullptr && NewCompare(x, y, false, 0) == 0b11) { // xkey > ykey
 
     if (xpre[0] == head_) { // first insert node
       char* copykey = arena_->Allocate(y->len);
-      memcpy(copykey, y->key, y->len);
+      memcpy(copykey, y->key(), y->len);
       smallest = Insert(copykey, y->len, xpre, false);
       PreNext(xpre, GetMaxHeight());
 
@@ -648,7 +1328,7 @@ bool SkipList<Key, Comparator>::Compact(SkipList<Key, Comparator>* list, Sequenc
 
       } else {  // insert y
         char* copykey = arena_->Allocate(y->len);
-        memcpy(copykey, y->key, y->len);
+        memcpy(copykey, y->key(), y->len);
         Insert(copykey, y->len, xpre, false);
         PreNext(xpre, GetMaxHeight());
       }
@@ -664,7 +1344,7 @@ bool SkipList<Key, Comparator>::Compact(SkipList<Key, Comparator>* list, Sequenc
         y = y->Next(0);
       } else {  // insert
         char* copykey = arena_->Allocate(y->len);
-        memcpy(copykey, y->key, y->len);
+        memcpy(copykey, y->key(), y->len);
 
         if (firstinsert) {  // In mid phase, the first inserted node's inserted height should be max
           Node* tmp = Insert(copykey, y->len, xpre, true);
@@ -702,31 +1382,29 @@ bool SkipList<Key, Comparator>::Compact(SkipList<Key, Comparator>* list, Sequenc
     } else {
       xpre[i] = nullptr;
     }
+    ypre[i] = head_;
   }
 
-  bool first = true;
   while (x != nullptr) {
-    insertingnode.store(x, std::memory_order_release);
+    // Find where x goes before the readers of both lists have to wait
+    FindGreaterOrEqualFinger(x->key(), head_, GetMaxHeight(), ypre);
+    BeginMove(&list->moves_);
+    BeginMove(&moves_);
     DeleteNode(xpre, x);
     Insert(x, ypre);
+    EndMove(&moves_);
+    EndMove(&list->moves_);
 	wa += (3 * 8 * x->height);
+    Node* moved = x;
     y = x;
     PreNext(ypre, y->height);
 
-    // Set smallest
-    if (first) {
-      if (smallest == nullptr || NewCompare(y, smallest, false, 0) == 0b01) {
-        smallest = y;
-      }
-      first = false;
-    }
-
     // LargeTable duplication
     while (y->Next(0) != nullptr) {
       int r = NewCompare(y, y->Next(0), true, snum);
       if (r == 0b0010) {
         for (int i = 0; i < GetMaxHeight(); i++) {
-          if (largest[i] = y->Next(0)) {
+          if (largest[i] == y->Next(0)) {
             largest[i] = ypre[i];
           } else {
             break;
@@ -741,85 +1419,375 @@ bool SkipList<Key, Comparator>::Compact(SkipList<Key, Comparator>* list, Sequenc
       }
     }
 
-    // Jump obsolescent node in small table
+    // Drop obsolescent nodes in small table.  They are unlinked rather
+    // than jumped over, readers of the small table would otherwise find
+    // them in place of the version that was moved out.
     x = xpre[0]->Next(0);
-    if (x == nullptr) {
-
-    } else {
-      bool flag = true;
-      int r;
-      do {
-        if (flag) {
-          r = NewCompare(insertingnode.load(std::memory_order_relaxed), x, true, snum);
-          flag = false;
-        } else {
-          r = NewCompare(xpre[0], x, true, snum);
-        }
-        if (r == 0b0010) {
-          PreNext(xpre, x->height);
-          x = x->Next(0);
-        } else {
-          break;
-        }
-      } while (x != nullptr);
+    while (x != nullptr && NewCompare(moved, x, true, snum) == 0b0010) {
+      BeginMove(&list->moves_);
+      DeleteNode(xpre, x);
+      EndMove(&list->moves_);
+      x = xpre[0]->Next(0);
     }
   }
-  insertingnode.store(nullptr, std::memory_order_release);
 
-  // Set Largest
+  // Set Largest, levels that were empty before the compaction have none yet.
+  // Nothing was inserted before the nodes of a level whose ypre is head_.
   for (int i = 0; i < GetMaxHeight(); i++) {
-    if (NewCompare(ypre[i], largest[i], false, 0) == 0b11) {
+    if (ypre[i] != head_ &&
+        (largest[i] == nullptr ||
+         NewCompare(ypre[i], largest[i], false, 0) == 0b11)) {
       largest[i] = ypre[i];
     }
   }
-  
+  // The old smallest may have been a version y shadowed and deleted
+  smallest = head_->Next(0);
+
   arena_->ReceiveArena(list->arena_);
   list->arena_->SetTransfer();
   return true;
 }
 
 // no overlaping skiplists compaction
+// only the towers at the seam are relinked, levels that one of the lists
+// does not reach take the links and largest[] of the other
 template <typename Key, class Comparator>
 bool SkipList<Key, Comparator>::Compact(SkipList<Key, Comparator>* list, bool frontlink) {
-  Node *pre[kMaxHeight];
   int xheight = GetMaxHeight();
   int yheight = list->GetMaxHeight();
 
   if (frontlink) {
     for (int i = 0; i < yheight; i++) {
-      list->largest[i]->SetNext(i, head_->Next(i));
-      head_->SetNext(i, list->head_->Next(i));
+      SetLink(list->largest[i], i, head_->Next(i));
+      SetLink(head_, i, list->head_->Next(i));
+      if (largest[i] == nullptr) {
+        largest[i] = list->largest[i];
+      }
     }
-    if (yheight > xheight) {
-      max_height_.store(yheight, std::memory_order_relaxed);
+  } else {
+    for (int i = 0; i < yheight; i++) {
+      Node* last = (largest[i] != nullptr) ? largest[i] : head_;
+      SetLink(last, i, list->head_->Next(i));
+      largest[i] = list->largest[i];
     }
-    smallest = list->smallest;
+  }
+  if (yheight > xheight) {
+    max_height_.store(yheight, std::memory_order_relaxed);
+  }
+  smallest = head_->Next(0);
+  wa = 2 * 8 * yheight;
 
-  } else {
-    for (int i = 0; i < xheight; i++) {
-      largest[i]->SetNext(i, list->head_->Next(i));
+  arena_->ReceiveArena(list->arena_);
+  list->arena_->SetTransfer();
+  return true;
+}
+
+template <typename Key, class Comparator>
+bool SkipList<Key, Comparator>::Disjoint(const SkipList<Key, Comparator>* list,
+                                         bool* frontlink) const {
+  Node* first = head_->Next(0);
+  Node* list_first = list->head_->Next(0);
+  if (list_first == nullptr) {
+    return false;  // Nothing to link
+  }
+  if (first == nullptr ||
+      NewCompare(list->largest[0], first, false, 0) == 0b01) {
+    *frontlink = true;
+    return true;
+  }
+  if (NewCompare(largest[0], list_first, false, 0) == 0b01) {
+    *frontlink = false;
+    return true;
+  }
+  return false;
+}
+
+// Pick the level whose nodes split this table into about four ranges per
+// worker, without going over kMaxPartitions ranges.
+template <typename Key, class Comparator>
+bool SkipList<Key, Comparator>::SplitForCompaction(WorkerPool* workers,
+                                                   CompactJob* job) {
+  if (workers == nullptr || workers->Parallelism() < 2) {
+    return false;
+  }
+  const size_t want = 4 * workers->Parallelism();
+  std::vector<Node*> nodes;
+  for (int level = GetMaxHeight() - 1; level > 0; level--) {
+    nodes.clear();
+    for (Node* x = head_->Next(level); x != nullptr; x = x->Next(level)) {
+      nodes.push_back(x);
+      if (nodes.size() >= kMaxPartitions) break;
     }
-    if (yheight > xheight) {
-      max_height_.store(yheight, std::memory_order_relaxed);
+    if (nodes.size() >= kMaxPartitions) {
+      break;  // Too many ranges, keep the level above
     }
-    for (int i = 0; i < yheight; i++) {
-      largest[i] = list->largest[i];
+    job->bounds.swap(nodes);
+    job->height = level + 1;
+    if (job->bounds.size() + 1 >= want) {
+      break;
     }
   }
-  
+  if (job->bounds.empty()) {
+    return false;
+  }
+  const size_t n = job->bounds.size() + 1;
+  job->table = this;
+  job->tall.resize(n);
+  job->wa.assign(n, 0);
+  job->reclaimed.assign(n, 0);
+  job->deferred.resize(n);
+  return true;
+}
+
+// Link "x" below "height" only, searching from the finger in prev, or
+// from "start" that is in every level below "height".  Fills
+// prev[0..height-1].
+template <typename Key, class Comparator>
+void SkipList<Key, Comparator>::InsertInRange(Node* x, Node* start, int height,
+                                              Node** prev) {
+  FindGreaterOrEqualFinger(x->key(), start, height, prev);
+  const int h = std::min<int>(x->height, height);
+  for (int i = 0; i < h; i++) {
+    NoBarrier_SetLink(x, i, prev[i]->NoBarrier_Next(i));
+    SetLink(prev[i], i, x);
+  }
+}
+
+// Link the upper levels of the tall nodes, drop versions shadowed across
+// the bounds and recompute smallest and largest[].
+template <typename Key, class Comparator>
+void SkipList<Key, Comparator>::FinishPartitions(CompactJob* job) {
+  Node* prev[kLastHeight];
+  for (size_t i = 0; i < job->tall.size(); i++) {
+    for (Node* x : job->tall[i]) {
+      if (x->height > GetMaxHeight()) {
+        max_height_.store(x->height, std::memory_order_relaxed);
+      }
+      Node* n = head_;
+      for (int level = GetMaxHeight() - 1; level >= job->height; level--) {
+        Node* next;
+        while (KeyIsAfterNode(x->key(), x->prefix, next = n->Next(level))) {
+          n = next;
+        }
+        prev[level] = n;
+      }
+      for (int level = job->height; level < x->height; level++) {
+        NoBarrier_SetLink(x, level, prev[level]->NoBarrier_Next(level));
+        SetLink(prev[level], level, x);
+      }
+    }
+    wa += job->wa[i];
+    reclaimed += job->reclaimed[i];
+  }
+
+  // A range stops before the next bound, continue the duplication check
+  // of the LargeTable across it
+  std::vector<bool> dropped(job->bounds.size(), false);
+  for (size_t i = 0; i < job->bounds.size(); i++) {
+    if (dropped[i]) {
+      continue;  // Dropped as the duplicate of a node before it
+    }
+    FindGreaterOrEqual(job->bounds[i]->key(), prev);
+    Node* y = prev[0];
+    if (y == head_) {
+      continue;
+    }
+    while (y->Next(0) != nullptr) {
+      int r = NewCompare(y, y->Next(0), true, job->snum);
+      if (r == 0b0010) {
+        for (size_t j = i; j < job->bounds.size(); j++) {
+          if (job->bounds[j] == y->Next(0)) dropped[j] = true;
+        }
+        if (IsLastTable) {
+          LastTableDeleteNode(prev, y->Next(0));
+        } else {
+          DeleteNode(prev, y->Next(0));
+        }
+      } else if ((r & 0b11) == 0b10) {
+        y = y->Next(0);
+        PreNext(prev, y->height);
+      } else {
+        break;
+      }
+    }
+  }
+
+  // Deletions whose versions reach past the bound of their range
+  for (int level = 0; level < kLastHeight; level++) {
+    prev[level] = head_;
+  }
+  for (size_t i = 0; i < job->deferred.size(); i++) {
+    for (Node* x : job->deferred[i]) {
+      LastTableDropKey(x, head_, GetMaxHeight(), nullptr, prev, nullptr);
+    }
+  }
+
+  // Walk down the right edge of the list to find the last node of every level
+  for (int level = GetMaxHeight(); level < kMaxHeight; level++) {
+    largest[level] = nullptr;
+  }
+  Node* x = head_;
+  for (int level = GetMaxHeight() - 1; level >= 0; level--) {
+    Node* next;
+    while ((next = x->Next(level)) != nullptr) {
+      x = next;
+    }
+    if (level < kMaxHeight) {
+      largest[level] = (x == head_) ? nullptr : x;
+    }
+  }
+  smallest = head_->Next(0);
+}
+
+template <typename Key, class Comparator>
+bool SkipList<Key, Comparator>::Compact(SkipList<Key, Comparator>* list,
+                                        SequenceNumber snum,
+                                        WorkerPool* workers) {
+  bool frontlink;
+  if (Disjoint(list, &frontlink)) {
+    return Compact(list, frontlink);
+  }
+  CompactJob job;
+  if (!SplitForCompaction(workers, &job)) {
+    return Compact(list, snum);
+  }
+  wa = 0;
+  job.list = list;
+  job.snum = snum;
+  const int n = static_cast<int>(job.bounds.size()) + 1;
+  const int list_height = list->GetMaxHeight();
+
+  // Find where every range starts in "list"
+  Node* cut[kMaxPartitions][kMaxHeight];
+  Node* first[kMaxPartitions + 1];
+  first[0] = list->head_->Next(0);
+  for (int i = 1; i < n; i++) {
+    first[i] = list->FindGreaterOrEqual(job.bounds[i - 1]->key(), cut[i]);
+  }
+  first[n] = nullptr;
+
+  // Give every range a list of its own.  Readers search them through this
+  // table from the moment they are published, so "list" can then be
+  // emptied and cut at the ranges.  To the readers of either table this
+  // is one move of all the nodes of "list".
+  BeginMove(&list->moves_);
+  BeginMove(&moves_);
+  for (int i = 0; i < n; i++) {
+    if (pending_[i] == nullptr) {
+      pending_[i] = NewNode(0 /* any key will do */, kMaxHeight, 0);
+    }
+    for (int level = 0; level < kMaxHeight; level++) {
+      Node* x = nullptr;
+      if (level < list_height) {
+        x = (i == 0) ? list->head_->Next(level) : cut[i][level]->Next(level);
+      }
+      if (x != nullptr && first[i + 1] != nullptr &&
+          !KeyIsAfterNode(first[i + 1]->key(), x)) {
+        x = nullptr;  // Belongs to a later range
+      }
+      SetLink(pending_[i], level, x);
+    }
+  }
+  pending_height_ = list_height;
+  partitions_.store(n, std::memory_order_release);
+  for (int level = 0; level < list_height; level++) {
+    SetLink(list->head_, level, nullptr);
+    for (int i = 1; i < n; i++) {
+      if (cut[i][level] != list->head_) {
+        SetLink(cut[i][level], level, nullptr);
+      }
+    }
+  }
+  EndMove(&moves_);
+  EndMove(&list->moves_);
+
+  workers->Run(n, &CompactPartition, &job);
+  FinishPartitions(&job);
+  partitions_.store(0, std::memory_order_release);
+
   arena_->ReceiveArena(list->arena_);
   list->arena_->SetTransfer();
   return true;
 }
 
+// Compact(list, snum) on the nodes waiting in pending_[i]
+template <typename Key, class Comparator>
+void SkipList<Key, Comparator>::CompactPartition(void* arg, int i) {
+  CompactJob* job = reinterpret_cast<CompactJob*>(arg);
+  SkipList* t = job->table;
+  const int height = job->height;
+  const SequenceNumber snum = job->snum;
+  Node* start = (i == 0) ? t->head_ : job->bounds[i - 1];
+  Node* limit =
+      (i < static_cast<int>(job->bounds.size())) ? job->bounds[i] : nullptr;
+  std::atomic<uint64_t>* moves = &t->range_moves_[i];
+  Node *y, *ypre[kMaxHeight], *xpre[kMaxHeight];
+  for (int level = 0; level < kMaxHeight; level++) {
+    xpre[level] = t->pending_[i];
+    ypre[level] = start;
+  }
+
+  Node* x = xpre[0]->Next(0);
+  while (x != nullptr) {
+    t->FindGreaterOrEqualFinger(x->key(), start, height, ypre);
+    BeginMove(moves);
+    t->DeleteNode(xpre, x);
+    t->InsertInRange(x, start, height, ypre);
+    EndMove(moves);
+    Node* moved = x;
+    if (x->height > height) {
+      job->tall[i].push_back(x);
+    }
+    job->wa[i] += (3 * 8 * x->height);
+    y = x;
+    t->PreNext(ypre, std::min<int>(y->height, height));
+
+    // LargeTable duplication
+    while (y->Next(0) != nullptr && y->Next(0) != limit) {
+      int r = t->NewCompare(y, y->Next(0), true, snum);
+      if (r == 0b0010) {
+        t->DeleteNode(ypre, y->Next(0));
+      } else if ((r & 0b11) == 0b10) {
+        y = y->Next(0);
+        t->PreNext(ypre, std::min<int>(y->height, height));
+      } else {
+        break;
+      }
+    }
+
+    // Jump obsolescent node in small table
+    x = xpre[0]->Next(0);
+    if (x != nullptr) {
+      bool flag = true;
+      int r;
+      do {
+        if (flag) {
+          r = t->NewCompare(moved, x, true, snum);
+          flag = false;
+        } else {
+          r = t->NewCompare(xpre[0], x, true, snum);
+        }
+        if (r == 0b0010) {
+          t->PreNext(xpre, x->height);
+          x = x->Next(0);
+        } else {
+          break;
+        }
+      } while (x != nullptr);
+    }
+  }
+}
+
 // serve for last large datatable
+// nodes are carved out of the blocks of arena by slab
 template <typename Key, class Comparator>
-SkipList<Key, Comparator>::SkipList(Comparator cmp)
-    : UseBloomFilter(false),
-      IsLastTable(true),
+SkipList<Key, Comparator>::SkipList(Comparator cmp, Arena* arena,
+                                    SlabAllocator* slab, bool lasttable)
+    : IsLastTable(lasttable),
       sizesum(0),
       compare_(cmp),
-      arena_(nullptr),
+      arena_(arena),
+      slab_(slab),
       head_(LastTableNewNode(0 /* any key will do */, kLastHeight, 0 /*add by mio*/)),
       max_height_(1),
       rnd_(0xdeadbeef) {
@@ -828,36 +1796,146 @@ SkipList<Key, Comparator>::SkipList(Comparator cmp)
   }
   smallest = nullptr;
   largest[0] = nullptr;
-  insertingnode.store(nullptr, std::memory_order_relaxed);
+}
+
+// serve for datatables remapped from the nvm pool
+// head_ is at the start of the first arena block, the rest is recomputed
+template <typename Key, class Comparator>
+SkipList<Key, Comparator>::SkipList(Comparator cmp, Arena* arena,
+                                    SlabAllocator* slab, bool lasttable,
+                                    size_t size)
+    : IsLastTable(lasttable),
+      sizesum(size),
+      compare_(cmp),
+      arena_(arena),
+      slab_(slab),
+      head_((Node*)arena->GetHead()),
+      max_height_(1),
+      rnd_(0xdeadbeef) {
+  int height = lasttable ? kLastHeight : kMaxHeight;
+  while (height > 1 && head_->Next(height - 1) == nullptr) {
+    height--;
+  }
+  max_height_.store(height, std::memory_order_relaxed);
+
+  // Walk down the right edge of the list to find the last node of every level
+  for (int level = height; level < kMaxHeight; level++) {
+    largest[level] = nullptr;
+  }
+  Node* x = head_;
+  for (int level = height - 1; level >= 0; level--) {
+    Node* next;
+    while ((next = x->Next(level)) != nullptr) {
+      x = next;
+    }
+    if (level < kMaxHeight) {
+      largest[level] = (x == head_) ? nullptr : x;
+    }
+  }
+  smallest = head_->Next(0);
+  wa = 0;
+  dumptime = 0;
 }
 
 template <typename Key, class Comparator>
 typename SkipList<Key, Comparator>::Node* SkipList<Key, Comparator>::LastTableNewNode(
     const Key& key, int height, const size_t& len) {
-  NvmNodeSizeRecord(len);
-  char* copykey = (char*)numa_alloc_onnode(len, nvm_node);
-  wa += len;
-  sizesum += len;
-  memcpy(copykey, key, len);
-  size_t tmp = sizeof(Node) + sizeof(std::atomic<Node*>) * (height - 1);
-  NvmNodeSizeRecord(tmp);
-  char* node_memory = (char*)numa_alloc_onnode(tmp, nvm_node);
-  wa += tmp;
-  sizesum += tmp;
+  size_t tmp = sizeof(Node) + sizeof(std::atomic<intptr_t>) * (height - 1);
+  // node first, so that head_ is at the start of the first block
+  char* node_memory = slab_->Allocate(tmp);
+  char* copykey = nullptr;
+  if (len > 0) {
+    copykey = slab_->Allocate(len);
+    memcpy(copykey, key, len);
+  }
+  wa += len + tmp;
+  sizesum += len + tmp;
   return new (node_memory) Node(copykey, len, height);
 }
 
 template <typename Key, class Comparator>
 void SkipList<Key, Comparator>::LastTableDeleteNode(Node** pre, Node* n) {
   for (int i = 0; i < n->height; i++) {
-    pre[i]->SetNext(i, n->Next(i));
+    SetLink(pre[i], i, n->Next(i));
   }
+  FilterDelete(pre[0], n);
   wa += (8 * n->height);
-  numa_free(const_cast<char*>(n->key), n->len);
-  sizesum -= n->len;
-  size_t tmp = sizeof(Node) + sizeof(std::atomic<Node*>) * (n->height - 1);
-  numa_free(n, tmp);
-  sizesum -= tmp;
+  // readers may still be on n, its memory goes to the next node or key of
+  // the same size class once they have left
+  const size_t len = n->len;
+  size_t tmp = sizeof(Node) + sizeof(std::atomic<intptr_t>) * (n->height - 1);
+  if (len > 0) {
+    slab_->Retire(const_cast<char*>(n->key()), len);
+  }
+  slab_->Retire(reinterpret_cast<char*>(n), tmp);
+  sizesum -= len + tmp;
+  reclaimed += len + tmp;
+}
+
+template <typename Key, class Comparator>
+bool SkipList<Key, Comparator>::SharesUserKey(Node* prev, Node* x) const {
+  return (prev != head_ && NewCompare(prev, x, false, 0) == 0b10) ||
+         (x->Next(0) != nullptr && NewCompare(x, x->Next(0), false, 0) == 0b10);
+}
+
+template <typename Key, class Comparator>
+void SkipList<Key, Comparator>::FilterAdd(Node* prev, Node* x) {
+  if (filter_ != nullptr && !SharesUserKey(prev, x)) {
+    uint32_t len;
+    const char* p = GetVarint32Ptr(x->key(), x->key() + 5, &len);
+    filter_->Add(MergeableBloom::BloomHash(Slice(p, len - 8)));
+  }
+}
+
+// x keeps its links when it is unlinked, so its neighbours are still known
+template <typename Key, class Comparator>
+void SkipList<Key, Comparator>::FilterDelete(Node* prev, Node* x) {
+  if (filter_ != nullptr && !SharesUserKey(prev, x)) {
+    uint32_t len;
+    const char* p = GetVarint32Ptr(x->key(), x->key() + 5, &len);
+    filter_->Delete(MergeableBloom::BloomHash(Slice(p, len - 8)));
+  }
+}
+
+template <typename Key, class Comparator>
+bool SkipList<Key, Comparator>::IsObsoleteDeletion(const Node* x,
+                                                   SequenceNumber snum) const {
+  uint32_t len;
+  const char* p = GetVarint32Ptr(x->key(), x->key() + 5, &len);
+  const uint64_t tag = DecodeFixed64(p + len - 8);
+  return static_cast<ValueType>(tag & 0xff) == kTypeDeletion &&
+         (tag >> 8) <= snum;
+}
+
+template <typename Key, class Comparator>
+bool SkipList<Key, Comparator>::LastTableDropKey(const Node* x, Node* start,
+                                                 int height, Node* limit,
+                                                 Node** pre, port::Mutex* mu) {
+  // Older versions sort after x, they are all shadowed by it
+  Node* end = FindGreaterOrEqualFinger(x->key(), start, height, pre);
+  while (end != nullptr && NewCompare(x, end, false, 0) == 0b10) {
+    if (end == limit) {
+      return false;
+    }
+    end = end->Next(0);
+  }
+  Node* n;
+  while ((n = pre[0]->Next(0)) != end) {
+    if (mu == nullptr) {
+      if (n == smallest) {
+        smallest = end;
+      }
+      if (n == largest[0]) {
+        largest[0] = (pre[0] == head_) ? nullptr : pre[0];
+      }
+      LastTableDeleteNode(pre, n);
+    } else {
+      mu->Lock();
+      LastTableDeleteNode(pre, n);
+      mu->Unlock();
+    }
+  }
+  return true;
 }
 
 template <typename Key, class Comparator>
@@ -875,9 +1953,9 @@ int SkipList<Key, Comparator>::LastRandomHeight() {
 
 template <typename Key, class Comparator>
 typename SkipList<Key, Comparator>::Node* SkipList<Key, Comparator>::LastTableInsert(const Key& key, const size_t& len, Node** prev) {
-  Node* x = FindGreaterOrEqual(key, prev);
+  Node* x = FindGreaterOrEqualFinger(key, head_, GetMaxHeight(), prev);
 
-  assert(x == nullptr || !Equal(key, x->key));
+  assert(x == nullptr || !Equal(key, x->key()));
 
   int height = LastRandomHeight();
   if (height > GetMaxHeight()) {
@@ -890,8 +1968,9 @@ typename SkipList<Key, Comparator>::Node* SkipList<Key, Comparator>::LastTableIn
   x = LastTableNewNode(key, height, len); // different from Insert()
   for (int i = 0; i < height; i++) {
     x->NoBarrier_SetNext(i, prev[i]->NoBarrier_Next(i));
-    prev[i]->SetNext(i, x);
+    SetLink(prev[i], i, x);
   }
+  FilterAdd(prev[0], x);
   wa += (2 * 8 * height);
   return x;
 }
@@ -900,59 +1979,164 @@ typename SkipList<Key, Comparator>::Node* SkipList<Key, Comparator>::LastTableIn
 template <typename Key, class Comparator>
 bool SkipList<Key, Comparator>::LastTableCompact(SkipList<Key, Comparator>* list, SequenceNumber snum) {
   wa = 0;
+  reclaimed = 0;
+  slab_->Reclaim();
   Node *x = list->head_->Next(0);
   Node *pre[kLastHeight];
-  Node *y;
-  bool first = true;
+  Node *y = nullptr;
+  for (int i = 0; i < kLastHeight; i++) {
+    pre[i] = head_;
+  }
   while (x != nullptr) {
-    y = LastTableInsert(x->key, x->len, pre);
-    PreNext(pre, y->height);
-
-    // Set smallest
-    if (first) {
-      if (smallest == nullptr || NewCompare(y, smallest, false, 0) == 0b01) {
-        smallest = y;
+    if (IsObsoleteDeletion(x, snum)) {
+      // Set Largest before y can be dropped with the key
+      if (y != nullptr &&
+          (largest[0] == nullptr || NewCompare(y, largest[0], false, 0) == 0b11)) {
+        largest[0] = y;
       }
-      first = false;
-    }
+      y = nullptr;
+      LastTableDropKey(x, head_, GetMaxHeight(), nullptr, pre, nullptr);
+      reclaimed += x->len;
+    } else {
+      y = LastTableInsert(x->key(), x->len, pre);
+      PreNext(pre, y->height);
 
-    // LargeTable duplication
-    while (y->Next(0) != nullptr) {
-      int r = NewCompare(y, y->Next(0), true, snum);
-      if (r == 0b0010) {
-        if (y->Next(0) == largest[0]) {
-          largest[0] = y;
+      // LargeTable duplication
+      while (y->Next(0) != nullptr) {
+        int r = NewCompare(y, y->Next(0), true, snum);
+        if (r == 0b0010) {
+          if (y->Next(0) == largest[0]) {
+            largest[0] = y;
+          }
+          LastTableDeleteNode(pre, y->Next(0));
+        } else if ((r & 0b11) == 0b10) {
+          y = y->Next(0);
+          PreNext(pre, y->height);
+        } else {
+          break;
         }
-        LastTableDeleteNode(pre, y->Next(0));
-      } else if ((r & 0b11) == 0b10) {
-        y = y->Next(0);
-        PreNext(pre, y->height);
-      } else {
-        break;
       }
     }
 
     // Jump obsolescent node in small table
-    if (x->Next(0) == nullptr) {
-      x = nullptr;
-    } else {
-      do {
-        int r = NewCompare(x, x->Next(0), true, snum);
-        if (r == 0b0010) {
-          x = x->Next(0);
-        } else {
-          x = x->Next(0);
-          break;
-        }
-      } while (x->Next(0) != nullptr);
+    Node* next = x->Next(0);
+    while (next != nullptr && NewCompare(x, next, true, snum) == 0b0010) {
+      reclaimed += next->len;
+      next = next->Next(0);
     }
+    x = next;
   }
 
   // Set Largest
-  if (largest[0] == nullptr || NewCompare(y, largest[0], false, 0) == 0b11) {
+  if (y != nullptr &&
+      (largest[0] == nullptr || NewCompare(y, largest[0], false, 0) == 0b11)) {
     largest[0] = y;
   }
+  // The old smallest may have been a version y shadowed and deleted, whose
+  // node the slab can hand out again
+  smallest = head_->Next(0);
   return true;
 }
+
+template <typename Key, class Comparator>
+bool SkipList<Key, Comparator>::LastTableCompact(
+    SkipList<Key, Comparator>* list, SequenceNumber snum, WorkerPool* workers) {
+  CompactJob job;
+  if (!SplitForCompaction(workers, &job)) {
+    return LastTableCompact(list, snum);
+  }
+  wa = 0;
+  reclaimed = 0;
+  slab_->Reclaim();
+  job.list = list;
+  job.snum = snum;
+  // "list" is only read, every range copies its part of it
+  job.first.push_back(list->head_->Next(0));
+  for (Node* bound : job.bounds) {
+    job.first.push_back(list->FindGreaterOrEqual(bound->key(), nullptr));
+  }
+  job.first.push_back(nullptr);
+
+  workers->Run(static_cast<int>(job.bounds.size()) + 1,
+               &LastTableCompactPartition, &job);
+  FinishPartitions(&job);
+  return true;
+}
+
+// LastTableCompact(list, snum) on the nodes of "list" in range i
+template <typename Key, class Comparator>
+void SkipList<Key, Comparator>::LastTableCompactPartition(void* arg, int i) {
+  CompactJob* job = reinterpret_cast<CompactJob*>(arg);
+  SkipList* t = job->table;
+  const int height = job->height;
+  const SequenceNumber snum = job->snum;
+  Node* start = (i == 0) ? t->head_ : job->bounds[i - 1];
+  Node* limit =
+      (i < static_cast<int>(job->bounds.size())) ? job->bounds[i] : nullptr;
+  // rnd_ belongs to the table, like InsertConcurrently() draw the heights
+  // of the copies from a generator of this range
+  Random rnd(0xdeadbeef + i);
+  static const unsigned int kBranching = 4;
+  Node* pre[kLastHeight];
+  for (int level = 0; level < kLastHeight; level++) {
+    pre[level] = start;
+  }
+
+  Node* x = job->first[i];
+  Node* end = job->first[i + 1];
+  Node* last = nullptr;
+  while (x != end) {
+    // Jump obsolescent node in small table
+    if (last != nullptr && t->NewCompare(last, x, true, snum) == 0b0010) {
+      job->reclaimed[i] += x->len;
+      last = x;
+      x = x->Next(0);
+      continue;
+    }
+
+    // Keys that run into the next range are dropped by FinishPartitions()
+    if (t->IsObsoleteDeletion(x, snum)) {
+      if (!t->LastTableDropKey(x, start, height, limit, pre, &job->alloc_mu)) {
+        job->deferred[i].push_back(x);
+      }
+      job->reclaimed[i] += x->len;
+      last = x;
+      x = x->Next(0);
+      continue;
+    }
+
+    int h = 1;
+    while (h < kLastHeight && ((rnd.Next() % kBranching) == 0)) {
+      h++;
+    }
+    job->alloc_mu.Lock();
+    Node* y = t->LastTableNewNode(x->key(), h, x->len);
+    job->alloc_mu.Unlock();
+    t->InsertInRange(y, start, height, pre);
+    t->FilterAdd(pre[0], y);
+    if (h > height) {
+      job->tall[i].push_back(y);
+    }
+    job->wa[i] += (2 * 8 * h);
+    t->PreNext(pre, std::min<int>(y->height, height));
+
+    // LargeTable duplication
+    while (y->Next(0) != nullptr && y->Next(0) != limit) {
+      int r = t->NewCompare(y, y->Next(0), true, snum);
+      if (r == 0b0010) {
+        job->alloc_mu.Lock();
+        t->LastTableDeleteNode(pre, y->Next(0));
+        job->alloc_mu.Unlock();
+      } else if ((r & 0b11) == 0b10) {
+        y = y->Next(0);
+        t->PreNext(pre, std::min<int>(y->height, height));
+      } else {
+        break;
+      }
+    }
+    last = x;
+    x = x->Next(0);
+  }
+}
 }  // namespace leveldb
 #endif  // STORAGE_LEVELDB_DB_SKIPLIST_H_
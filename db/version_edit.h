@@ -28,6 +28,8 @@ struct FileMetaData {
 
   // add by mio 2020/6/17
   DataTable* dt;
+  // Regions of the nvm pool holding dt, used to remap it at recovery
+  DataTableLayout layout;
 };
 
 class VersionEdit {
@@ -75,13 +77,15 @@ class VersionEdit {
     f.largest = largest;
     f.dt = addtable;
     f.mustquery = false;
+    if (addtable != nullptr) {
+      addtable->GetLayout(&f.layout);
+    }
     new_files_.push_back(std::make_pair(level, f));
   }
 
   // Delete the specified "file" from the specified "level".
-  // modify by mio
-  //void RemoveFile(int level, uint64_t file) {
-  void RemoveFile(int level, DataTable* file) {
+  // A datatable keeps its file number when it is merged into the next level.
+  void RemoveFile(int level, uint64_t file) {
     deleted_files_.insert(std::make_pair(level, file));
   }
 
@@ -93,9 +97,7 @@ class VersionEdit {
  private:
   friend class VersionSet;
 
-  // modify by mio 2020/6/18
-  //typedef std::set<std::pair<int, uint64_t>> DeletedFileSet;
-  typedef std::set<std::pair<int, DataTable*>> DeletedFileSet;
+  typedef std::set<std::pair<int, uint64_t>> DeletedFileSet;
 
   std::string comparator_;
   uint64_t log_number_;
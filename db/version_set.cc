@@ -6,6 +6,8 @@
 
 #include <algorithm>
 #include <cstdio>
+#include <map>
+#include <set>
 
 #include "db/filename.h"
 #include "db/log_reader.h"
@@ -20,6 +22,7 @@
 #include "util/logging.h"
 // add by mio
 #include "db/datatable.h"
+#include "db/global.h"
 
 namespace leveldb {
 
@@ -309,6 +312,14 @@ static bool NewestFirst(FileMetaData* a, FileMetaData* b) {
   return a->number > b->number;
 }
 
+// Whether a search for user_key has to look into "f"
+static bool MayHold(const Comparator* ucmp, FileMetaData* f,
+                    const Slice& user_key) {
+  return f->mustquery ||
+         (ucmp->Compare(user_key, f->smallest.user_key()) >= 0 &&
+          ucmp->Compare(user_key, f->largest.user_key()) <= 0);
+}
+
 void Version::ForEachOverlapping(Slice user_key, Slice internal_key, void* arg,
                                  bool (*func)(void*, int, FileMetaData*)) {
   const Comparator* ucmp = vset_->icmp_.user_comparator();
@@ -324,11 +335,7 @@ void Version::ForEachOverlapping(Slice user_key, Slice internal_key, void* arg,
     for (uint32_t i = 0; i < files_[level].size(); i++) {
       //FileMetaData* f = files_[0][i];
       FileMetaData* f = files_[level][i];
-      if (f->mustquery) {
-        tmp.push_back(f);
-      }
-      else if (ucmp->Compare(user_key, f->smallest.user_key()) >= 0 &&
-          ucmp->Compare(user_key, f->largest.user_key()) <= 0) {
+      if (MayHold(ucmp, f, user_key)) {
         tmp.push_back(f);
       }
     }
@@ -367,6 +374,17 @@ void Version::ForEachOverlapping(Slice user_key, Slice internal_key, void* arg,
 
 Status Version::Get(const ReadOptions& options, const LookupKey& k,
                     std::string* value, GetStats* stats) {
+  return Get(options, k, value, nullptr, stats);
+}
+
+Status Version::Get(const ReadOptions& options, const LookupKey& k,
+                    PinnableSlice* value, GetStats* stats) {
+  return Get(options, k, nullptr, value, stats);
+}
+
+Status Version::Get(const ReadOptions& options, const LookupKey& k,
+                    std::string* value, PinnableSlice* pinned,
+                    GetStats* stats) {
   stats->seek_file = nullptr;
   stats->seek_file_level = -1;
 
@@ -377,6 +395,7 @@ Status Version::Get(const ReadOptions& options, const LookupKey& k,
     Slice ikey;
     // add by mio
     const LookupKey* lkey;
+    PinnableSlice* pinned;  // Takes the value instead of saver.value
     FileMetaData* last_file_read;
     int last_file_read_level;
 
@@ -402,7 +421,10 @@ Status Version::Get(const ReadOptions& options, const LookupKey& k,
                                                 f->file_size, state->ikey,
                                                 &state->saver, SaveValue);*/
       // add by mio
-      if (f->dt->Get(*(state->lkey), state->saver.value, state->s)) {
+      if (state->pinned != nullptr
+              ? f->dt->GetUnfiltered(*(state->lkey), state->pinned, state->s)
+              : f->dt->GetUnfiltered(*(state->lkey), state->saver.value,
+                                     state->s)) {
         state->found = true;
         return false;
       } else {
@@ -444,6 +466,7 @@ Status Version::Get(const ReadOptions& options, const LookupKey& k,
   state.ikey = k.internal_key();
   // add by mio
   state.lkey = &k;
+  state.pinned = pinned;
   state.vset = vset_;
 
   state.saver.state = kNotFound;
@@ -451,11 +474,104 @@ Status Version::Get(const ReadOptions& options, const LookupKey& k,
   state.saver.user_key = k.user_key();
   state.saver.value = value;
 
-  ForEachOverlapping(state.saver.user_key, state.ikey, &state, &State::Match);
+  // As in MultiGet(), whether a table may hold the key is decided when it
+  // comes up: a compaction that starts meanwhile may merge the key into a
+  // table whose range did not hold it, and marks it mustquery.
+  const Comparator* ucmp = vset_->icmp_.user_comparator();
+
+  // Hash the key once and start loading the filter bits of every table it
+  // may be in, so that each probe below finds them in cache.  A filter is
+  // still probed only when its table comes up, a compaction may merge the
+  // filter of a table searched before into it in the meantime.  A filter
+  // that has to grow for it is replaced, the old one is kept while pinned.
+  Epoch::Guard filters(FilterLimbo()->epoch());
+  for (const auto& file : search_order_) {
+    if (MayHold(ucmp, file.second, state.saver.user_key)) {
+      file.second->dt->PrefetchFilter(k);
+    }
+  }
+  for (const auto& file : search_order_) {
+    if (MayHold(ucmp, file.second, state.saver.user_key) &&
+        file.second->dt->MayContain(k) &&
+        !State::Match(&state, file.first, file.second)) {
+      break;
+    }
+  }
 
   return state.found ? state.s : Status::NotFound(Slice());
 }
 
+void Version::MultiGet(const ReadOptions& options, KeyLookup* const* lookups,
+                       int n) {
+  const Comparator* ucmp = vset_->icmp_.user_comparator();
+  // Whether a table may hold a key is decided when it comes up for the
+  // key: a compaction that starts meanwhile may merge keys past its range
+  // into it, and marks it mustquery.
+  const std::vector<std::pair<int, FileMetaData*>>& tables = search_order_;
+
+  // Filters are probed when their table comes up, as in Get()
+  Epoch::Guard filters(FilterLimbo()->epoch());
+  for (int i = 0; i < n; i++) {
+    const LookupKey& k = *lookups[i]->key;
+    for (const auto& table : tables) {
+      if (MayHold(ucmp, table.second, k.user_key())) {
+        table.second->dt->PrefetchFilter(k);
+      }
+    }
+  }
+
+  std::vector<size_t> next(n, 0);  // Of tables to search next
+  std::vector<int> pending(n);
+  for (int i = 0; i < n; i++) {
+    pending[i] = i;
+  }
+  std::vector<std::pair<DataTable*, KeyLookup*>> round;
+  std::vector<KeyLookup*> batch;
+  while (!pending.empty()) {
+    round.clear();
+    size_t kept = 0;
+    for (int i : pending) {
+      const LookupKey& k = *lookups[i]->key;
+      while (next[i] < tables.size() &&
+             !(MayHold(ucmp, tables[next[i]].second, k.user_key()) &&
+               tables[next[i]].second->dt->MayContain(k))) {
+        next[i]++;
+      }
+      if (next[i] == tables.size()) {
+        *lookups[i]->status = Status::NotFound(Slice());
+        continue;
+      }
+      round.emplace_back(tables[next[i]++].second->dt, lookups[i]);
+      pending[kept++] = i;
+    }
+    pending.resize(kept);
+
+    // Each table gets its keys in the order they came, which is sorted if
+    // the lookups are
+    std::stable_sort(round.begin(), round.end(),
+                     [](const std::pair<DataTable*, KeyLookup*>& a,
+                        const std::pair<DataTable*, KeyLookup*>& b) {
+                       return a.first < b.first;
+                     });
+    for (size_t start = 0; start < round.size();) {
+      DataTable* dt = round[start].first;
+      batch.clear();
+      for (; start < round.size() && round[start].first == dt; start++) {
+        batch.push_back(round[start].second);
+      }
+      dt->MultiGetUnfiltered(batch.data(), static_cast<int>(batch.size()));
+    }
+
+    kept = 0;
+    for (int i : pending) {
+      if (!lookups[i]->found) {
+        pending[kept++] = i;
+      }
+    }
+    pending.resize(kept);
+  }
+}
+
 bool Version::UpdateStats(const GetStats& stats) {
   FileMetaData* f = stats.seek_file;
   if (f != nullptr) {
@@ -644,9 +760,7 @@ class VersionSet::Builder {
 
   typedef std::set<FileMetaData*, BySmallestKey> FileSet;
   struct LevelState {
-    //modify by mio
-    //std::set<uint64_t> deleted_files;
-    std::set<DataTable*> deleted_files;
+    std::set<uint64_t> deleted_files;
     FileSet* added_files;
   };
 
@@ -700,10 +814,8 @@ class VersionSet::Builder {
     // Delete files
     for (const auto& deleted_file_set_kvp : edit->deleted_files_) {
       const int level = deleted_file_set_kvp.first;
-      /* modify by mio
       const uint64_t number = deleted_file_set_kvp.second;
-      levels_[level].deleted_files.insert(number);*/
-      levels_[level].deleted_files.insert(deleted_file_set_kvp.second);
+      levels_[level].deleted_files.insert(number);
     }
 
     // Add new files
@@ -824,7 +936,7 @@ class VersionSet::Builder {
 
   // modify by mio
   void MaybeAddFile(Version* v, int level, FileMetaData* f, bool IsBase) {
-    if (IsBase && levels_[level].deleted_files.count(f->dt) > 0) {
+    if (IsBase && levels_[level].deleted_files.count(f->number) > 0) {
       // File is deleted: do nothing
       //return false;
       //std::cout << "do not save: " << f->dt << std::endl;
@@ -903,7 +1015,7 @@ Status VersionSet::LogAndApply(VersionEdit* edit, port::Mutex* mu) {
   }
 
   edit->SetNextFile(next_file_number_);
-  edit->SetLastSequence(last_sequence_);
+  edit->SetLastSequence(LastSequence());
 
   Version* v = new Version(this);
   {
@@ -1018,7 +1130,10 @@ Status VersionSet::Recover(bool* save_manifest) {
   uint64_t last_sequence = 0;
   uint64_t log_number = 0;
   uint64_t prev_log_number = 0;
-  Builder builder(this, current_);
+  // Datatables keep their file number while they move down the levels and
+  // the last table is deleted and re-added at the same level, so replay the
+  // edits by (level, number) instead of accumulating them in a Builder.
+  std::map<std::pair<int, uint64_t>, FileMetaData> files;
 
   {
     LogReporter reporter;
@@ -1040,7 +1155,13 @@ Status VersionSet::Recover(bool* save_manifest) {
       }
 
       if (s.ok()) {
-        builder.Apply(&edit);
+        for (const auto& deleted_file_kvp : edit.deleted_files_) {
+          files.erase(deleted_file_kvp);
+        }
+        for (size_t i = 0; i < edit.new_files_.size(); i++) {
+          const FileMetaData& f = edit.new_files_[i].second;
+          files[std::make_pair(edit.new_files_[i].first, f.number)] = f;
+        }
       }
 
       if (edit.has_log_number_) {
@@ -1084,15 +1205,61 @@ Status VersionSet::Recover(bool* save_manifest) {
     MarkFileNumberUsed(log_number);
   }
 
+  // Merges that were running when the DB went away changed tables in place
+  // that the MANIFEST still refers to, bring those back first
+  std::set<uint64_t> undone;
+  if (s.ok() && nvm_pool != nullptr && !nvm_pool->IsNew()) {
+    std::set<uint64_t> live;
+    for (const auto& file_kvp : files) {
+      live.insert(file_kvp.first.second);
+    }
+    s = nvm_pool->Recover(live, &undone);
+    if (s.ok() && !undone.empty()) {
+      Log(options_->info_log, "Rolled back merges of %d datatables\n",
+          static_cast<int>(undone.size()));
+    }
+  }
+
+  Version* v = nullptr;
+  if (s.ok()) {
+    // Remap the datatables.  Within a level files are ordered by number,
+    // which is the order in which they arrived at that level.
+    v = new Version(this);
+    for (const auto& file_kvp : files) {
+      const int level = file_kvp.first.first;
+      if (nvm_pool == nullptr || nvm_pool->IsNew() ||
+          file_kvp.second.layout.blocks.empty()) {
+        s = Status::Corruption("datatable was not stored in an nvm pool",
+                               NumberToString(file_kvp.first.second));
+        break;
+      }
+      FileMetaData* f = new FileMetaData(file_kvp.second);
+      if (undone.count(f->number) != 0) {
+        // The merge may have freed the region of the filter for reuse
+        f->layout.bloom = NvmRegion();
+      }
+      f->dt = new DataTable(icmp_, *options_, f->layout, level, f->file_size);
+      f->allowed_seeks = 30000;
+      f->refs = 1;
+      f->dt->Ref();
+      v->files_[level].push_back(f);
+      s = f->dt->status();
+      if (!s.ok()) {
+        break;
+      }
+    }
+    if (!s.ok()) {
+      delete v;
+    }
+  }
+
   if (s.ok()) {
-    Version* v = new Version(this);
-    builder.SaveTo(v);
     // Install recovered version
     Finalize(v);
     AppendVersion(v);
     manifest_file_number_ = next_file;
     next_file_number_ = next_file + 1;
-    last_sequence_ = last_sequence;
+    last_sequence_.store(last_sequence, std::memory_order_relaxed);
     log_number_ = log_number;
     prev_log_number_ = prev_log_number;
 
@@ -1184,6 +1351,19 @@ void VersionSet::Finalize(Version* v) {
 
   v->compaction_level_ = best_level;
   v->compaction_score_ = best_score;
+
+  v->search_order_.clear();
+  for (int level = 0; level < config::kNumLevels; level++) {
+    const size_t start = v->search_order_.size();
+    for (FileMetaData* f : v->files_[level]) {
+      v->search_order_.emplace_back(level, f);
+    }
+    std::sort(v->search_order_.begin() + start, v->search_order_.end(),
+              [](const std::pair<int, FileMetaData*>& a,
+                 const std::pair<int, FileMetaData*>& b) {
+                return NewestFirst(a.second, b.second);
+              });
+  }
 }
 
 Status VersionSet::WriteSnapshot(log::Writer* log) {
@@ -1615,8 +1795,7 @@ bool Compaction::IsTrivialMove() const {
 void Compaction::AddInputDeletions(VersionEdit* edit) {
   for (int which = 0; which < 2; which++) {
     for (size_t i = 0; i < inputs_[which].size(); i++) {
-      //edit->RemoveFile(level_ + which, inputs_[which][i]->number);
-      edit->RemoveFile(level_ + which, inputs_[which][i]->dt);
+      edit->RemoveFile(level_ + which, inputs_[which][i]->number);
     }
   }
 }
@@ -15,8 +15,10 @@
 #ifndef STORAGE_LEVELDB_DB_VERSION_SET_H_
 #define STORAGE_LEVELDB_DB_VERSION_SET_H_
 
+#include <atomic>
 #include <map>
 #include <set>
+#include <utility>
 #include <vector>
 
 #include "db/dbformat.h"
@@ -76,6 +78,17 @@ class Version {
 
   Status Get(const ReadOptions&, const LookupKey& key, std::string* val,
              GetStats* stats);
+  // Get() that points *val at the value bytes in the table that holds
+  // them, see DataTable::GetUnfiltered()
+  Status Get(const ReadOptions&, const LookupKey& key, PinnableSlice* val,
+             GetStats* stats);
+
+  // Get() for each of lookups[0,n), with the result in its value and
+  // status, NotFound() for the keys in no table.  The tables are searched
+  // in rounds, each key goes to the next table that may hold it and every
+  // table takes the keys of a round at once.
+  // REQUIRES: lock is not held, none of the lookups found
+  void MultiGet(const ReadOptions&, KeyLookup* const* lookups, int n);
 
   // Adds "stats" into the current state.  Returns true if a new
   // compaction may need to be triggered, false otherwise.
@@ -148,6 +161,10 @@ class Version {
   void ForEachOverlapping(Slice user_key, Slice internal_key, void* arg,
                           bool (*func)(void*, int, FileMetaData*));
 
+  // Both Get()s, the value goes to whichever of value and pinned is set
+  Status Get(const ReadOptions&, const LookupKey& key, std::string* value,
+             PinnableSlice* pinned, GetStats* stats);
+
   VersionSet* vset_;  // VersionSet to which this Version belongs
   Version* next_;     // Next version in linked list
   Version* prev_;     // Previous version in linked list
@@ -155,6 +172,11 @@ class Version {
 
   // List of files per level
   std::vector<FileMetaData*> files_[config::kNumLevels];
+
+  // Every file with its level in the order ForEachOverlapping() visits
+  // them, newest first within a level.  Initialized by Finalize() so that
+  // reads do not sort the files themselves.
+  std::vector<std::pair<int, FileMetaData*>> search_order_;
   double level_score_[config::kNumLevels];
 
   // Next file to compact based on seek stats.
@@ -213,13 +235,16 @@ class VersionSet {
   // Return the combined file size of all files at the specified level.
   int64_t NumLevelBytes(int level) const;
 
-  // Return the last sequence number.
-  uint64_t LastSequence() const { return last_sequence_; }
+  // Return the last sequence number.  May be called without the DB mutex;
+  // every write up to the returned sequence is visible in the memtable.
+  uint64_t LastSequence() const {
+    return last_sequence_.load(std::memory_order_acquire);
+  }
 
   // Set the last sequence number to s.
   void SetLastSequence(uint64_t s) {
-    assert(s >= last_sequence_);
-    last_sequence_ = s;
+    assert(s >= LastSequence());
+    last_sequence_.store(s, std::memory_order_release);
   }
 
   // Mark the specified file number as used.
@@ -308,7 +333,7 @@ class VersionSet {
   const InternalKeyComparator icmp_;
   uint64_t next_file_number_;
   uint64_t manifest_file_number_;
-  uint64_t last_sequence_;
+  std::atomic<uint64_t> last_sequence_;
   uint64_t log_number_;
   uint64_t prev_log_number_;  // 0 or backing store for memtable being compacted
 
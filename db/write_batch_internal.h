@@ -35,7 +35,10 @@ class WriteBatchInternal {
 
   static void SetContents(WriteBatch* batch, const Slice& contents);
 
-  static Status InsertInto(const WriteBatch* batch, MemTable* memtable);
+  // If "concurrent" is true, other threads may insert into memtable at
+  // the same time (see MemTable::Add).
+  static Status InsertInto(const WriteBatch* batch, MemTable* memtable,
+                           bool concurrent = false);
 
   static void Append(WriteBatch* dst, const WriteBatch* src);
 };
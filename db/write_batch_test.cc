@@ -2,12 +2,16 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file. See the AUTHORS file for names of contributors.
 
+#include <thread>
+#include <vector>
+
 #include "gtest/gtest.h"
 #include "db/memtable.h"
 #include "db/write_batch_internal.h"
 #include "leveldb/db.h"
 #include "leveldb/env.h"
 #include "util/logging.h"
+#include "util/testutil.h"
 
 namespace leveldb {
 
@@ -129,6 +133,45 @@ TEST(WriteBatchTest, ApproximateSize) {
   ASSERT_LT(two_keys_size, post_delete_size);
 }
 
+TEST(WriteBatchTest, ConcurrentInsert) {
+  const int kThreads = 4;
+  const int kPerThread = 2000;
+  std::vector<WriteBatch> batches(kThreads);
+  for (int t = 0; t < kThreads; t++) {
+    for (int i = 0; i < kPerThread; i++) {
+      // Interleave the keys of the threads so that their splices collide
+      std::string key = NumberToString(i * kThreads + t + 100000);
+      batches[t].Put(key, key);
+    }
+    WriteBatchInternal::SetSequence(&batches[t], 1 + t * kPerThread);
+  }
+
+  InternalKeyComparator cmp(BytewiseComparator());
+  MemTable* mem = new MemTable(cmp, 4 * 1024 * 1024);
+  mem->Ref();
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; t++) {
+    threads.emplace_back([&, t]() {
+      ASSERT_LEVELDB_OK(WriteBatchInternal::InsertInto(&batches[t], mem, true));
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  Iterator* iter = mem->NewIterator();
+  int count = 0;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next(), count++) {
+    ParsedInternalKey ikey;
+    ASSERT_TRUE(ParseInternalKey(iter->key(), &ikey));
+    ASSERT_EQ(NumberToString(count + 100000), ikey.user_key.ToString());
+    ASSERT_EQ(ikey.user_key, iter->value());
+  }
+  ASSERT_EQ(kThreads * kPerThread, count);
+  delete iter;
+  mem->Unref();
+}
+
 }  // namespace leveldb
 
 int main(int argc, char** argv) {
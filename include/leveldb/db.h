@@ -7,10 +7,13 @@
 
 #include <cstdint>
 #include <cstdio>
+#include <string>
+#include <vector>
 
 #include "leveldb/export.h"
 #include "leveldb/iterator.h"
 #include "leveldb/options.h"
+#include "leveldb/pinnable_slice.h"
 
 #define MIODB
 namespace leveldb {
@@ -91,6 +94,22 @@ class LEVELDB_EXPORT DB {
   virtual Status Get(const ReadOptions& options, const Slice& key,
                      std::string* value) = 0;
 
+  // Get() that points *value at the value bytes in the database instead
+  // of copying them, where it can.  Until value->Reset() or its
+  // destruction, the tables it points into stay in place, and the memory
+  // compactions free in the last table is not reused: release it soon.
+  virtual Status Get(const ReadOptions& options, const Slice& key,
+                     PinnableSlice* value);
+
+  // Get() for each of keys, with the results in (*values)[i] and
+  // (*statuses)[i], both resized to keys.size().  All keys are read from
+  // the same state of the database.  Cheaper than a Get() per key,
+  // especially with the keys sorted.
+  virtual void MultiGet(const ReadOptions& options,
+                        const std::vector<Slice>& keys,
+                        std::vector<std::string>* values,
+                        std::vector<Status>* statuses);
+
   // Return a heap-allocated iterator over the contents of the database.
   // The result of NewIterator() is initially invalid (caller must
   // call one of the Seek methods on the iterator before using it).
@@ -123,6 +142,8 @@ class LEVELDB_EXPORT DB {
   //     about the internal operation of the DB.
   //  "leveldb.sstables" - returns a multi-line string that describes all
   //     of the sstables that make up the db contents.
+  //  "leveldb.flush-stats" - returns a multi-line string with the time
+  //     memtable flushes spent copying, indexing and syncing.
   //  "leveldb.approximate-memory-usage" - returns the approximate number of
   //     bytes of memory in use by the DB.
   virtual bool GetProperty(const Slice& property, std::string* value) = 0;
@@ -190,14 +190,19 @@ class LEVELDB_EXPORT Env {
   // REQUIRES: lock has not already been unlocked.
   virtual Status UnlockFile(FileLock* lock) = 0;
 
-  // Arrange to run "(*function)(arg)" once in a background thread.
+  // Arrange to run "(*function)(arg, level)" once in a background thread.
   //
   // "function" may run in an unspecified thread.  Multiple functions
   // added to the same Env may run concurrently in different threads.
   // I.e., the caller may not assume that background work items are
-  // serialized.
+  // serialized.  When threads are scarce, work items of lower levels
+  // run first.
   virtual void Schedule(void (*function)(void* arg, int level), void* arg, int level) = 0;
 
+  // Run background work on at most "number" threads.  The default
+  // implementation does nothing.
+  virtual void SetBackgroundThreads(int number) {}
+
   // Start a new thread, invoking "function(arg)" within the new thread.
   // When "function(arg)" returns, the thread will be destroyed.
   virtual void StartThread(void (*function)(void* arg), void* arg) = 0;
@@ -385,6 +390,9 @@ class LEVELDB_EXPORT EnvWrapper : public Env {
   void Schedule(void (*f)(void*, int), void* a, int l) override {
     return target_->Schedule(f, a, l);
   }
+  void SetBackgroundThreads(int number) override {
+    return target_->SetBackgroundThreads(number);
+  }
   void StartThread(void (*f)(void*), void* a) override {
     return target_->StartThread(f, a);
   }
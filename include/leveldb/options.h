@@ -6,6 +6,7 @@
 #define STORAGE_LEVELDB_INCLUDE_OPTIONS_H_
 
 #include <cstddef>
+#include <string>
 
 #include "leveldb/export.h"
 
@@ -35,13 +36,21 @@ struct LEVELDB_EXPORT Options {
   Options();
   // -------------------
   // Parameters added by mio
-  // if true, DataTable will use bloom filter
+  // if true, DataTable will use bloom filter, and the last table a cuckoo
+  // filter
   bool use_datatable_bloom = true;
 
-  // bloom filter bits per key. 99%
+  // bloom filter bits per key of the tables in the deepest level that
+  // has filters.  99%
   size_t bits_per_key = 16;
 
-  // keys in datatable in the highest level which sets bloom filter
+  // Extra bloom filter bits per key for every level a table sits above
+  // that one.  Upper levels hold fewer keys, so their bits cost less
+  // DRAM per false positive saved.  0 gives every level bits_per_key.
+  double bloom_bits_per_level = 1.0;
+
+  // keys in datatable in the highest level which sets bloom filter, no
+  // filter is sized for more
   int keys_per_datatable = 2097152;
 
   // dram node in numa, default node0
@@ -51,6 +60,42 @@ struct LEVELDB_EXPORT Options {
   int nvm_node = 2;
   int nvm_next_node = -1;
 
+  // If non-empty, DataTables are carved out of this memory-mapped file
+  // (e.g. a file on a DAX mount) instead of numa_alloc_onnode(), and are
+  // remapped rather than lost when the DB is reopened.
+  std::string nvm_pool_path;
+
+  // Size of the pool file created at nvm_pool_path.
+  size_t nvm_pool_size = 64L * 1024 * 1024 * 1024;
+
+  // If true, the write-ahead log is a preallocated memory-mapped file that
+  // is made durable by writing back CPU cache lines instead of fsync().
+  // Meant for a DB directory on a DAX mount; elsewhere msync() is used.
+  // reuse_logs has no effect when this is set.
+  bool use_nvm_log = false;
+
+  // If true, the writers of a group commit insert their own batches into
+  // the memtable in parallel once the group's log record is written,
+  // instead of the group leader applying all of them.
+  bool allow_concurrent_memtable_write = false;
+
+  // If true, a write group leaves the log as soon as its record is written
+  // and is applied to the memtable while the next group writes the log.
+  // Groups become visible to readers in log order.
+  bool enable_pipelined_write = false;
+
+  // Number of threads that copy a memtable to NVM and build its bloom
+  // filter during a flush.  1 does all of it on the flushing thread.
+  int flush_threads = 4;
+
+  // Number of threads that merge one large compaction.  1 merges on the
+  // compacting thread.
+  int compaction_threads = 4;
+
+  // A compaction whose newer table holds at least this many bytes is split
+  // into key ranges that compaction_threads threads merge in parallel.
+  size_t parallel_compaction_size = 16 * 1024 * 1024;
+
   // -------------------
   // Parameters that affect behavior
 
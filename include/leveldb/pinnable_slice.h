@@ -0,0 +1,52 @@
+// Add by MioDB
+// A value that DB::Get() hands out without copying it.  The slice points
+// at the value bytes in the table that holds them, and pins what keeps
+// them in place until it is reset.
+
+#ifndef STORAGE_LEVELDB_INCLUDE_PINNABLE_SLICE_H_
+#define STORAGE_LEVELDB_INCLUDE_PINNABLE_SLICE_H_
+
+#include <string>
+
+#include "leveldb/export.h"
+#include "leveldb/slice.h"
+
+namespace leveldb {
+
+class LEVELDB_EXPORT PinnableSlice : public Slice {
+ public:
+  PinnableSlice();
+  ~PinnableSlice();
+
+  PinnableSlice(const PinnableSlice&) = delete;
+  PinnableSlice& operator=(const PinnableSlice&) = delete;
+
+  // Whether the slice points into the database rather than at a copy
+  bool IsPinned() const { return num_cleanups_ > 0; }
+
+  // Release the pin, the slice is empty after it
+  void Reset();
+
+  // For DB implementations.  PinSlice() points at "s", which stays valid
+  // until the cleanup functions registered for it run on Reset() or
+  // destruction, at most two of them.  PinSelf() copies "s" instead.
+  using CleanupFunction = void (*)(void* arg1, void* arg2);
+  void PinSlice(const Slice& s) { Slice::operator=(s); }
+  void PinSelf(const Slice& s);
+  void RegisterCleanup(CleanupFunction function, void* arg1, void* arg2);
+
+ private:
+  struct Cleanup {
+    CleanupFunction function;
+    void* arg1;
+    void* arg2;
+  };
+
+  Cleanup cleanups_[2];
+  int num_cleanups_;
+  std::string self_;  // The copy PinSelf() makes
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_INCLUDE_PINNABLE_SLICE_H_
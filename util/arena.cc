@@ -17,12 +17,48 @@ Arena::Arena()
 Arena::Arena(const size_t size)
     : alloc_ptr_(nullptr), alloc_bytes_remaining_(0), memory_usage_(0), IsMemTable(true), Transfer(false), kMemSize(size) {}
 
-Arena::Arena(const Arena* a): memory_usage_(0), IsMemTable(false), Transfer(false) {
+Arena::Arena(const size_t block_size, const bool memtable)
+    : alloc_ptr_(nullptr), alloc_bytes_remaining_(0), memory_usage_(0), IsMemTable(memtable), Transfer(false), kMemSize(block_size) {}
+
+Arena::Arena(const std::vector<NvmRegion>& regions, const size_t block_size)
+    : alloc_ptr_(nullptr), alloc_bytes_remaining_(0), memory_usage_(0), IsMemTable(false), Transfer(false), kMemSize(block_size) {
+  assert(nvm_pool != nullptr);
+  for (size_t i = 0; i < regions.size(); i++) {
+    char* block = nvm_pool->Reserve(regions[i]);
+    if (block == nullptr) {
+      status_ = Status::Corruption(
+          "datatable block is outside the nvm pool or overlaps another one");
+      break;
+    }
+    memory_usage_.fetch_add(regions[i].size + sizeof(char*),
+                            std::memory_order_relaxed);
+    blocks_.push_back(block);
+    block_size_.push_back(regions[i].size);
+  }
+  if (!status_.ok() || blocks_.empty()) {
+    if (status_.ok()) {
+      status_ = Status::Corruption("datatable has no blocks");
+    }
+    for (size_t i = 0; i < blocks_.size(); i++) {
+      nvm_pool->Free(blocks_[i], block_size_[i]);
+    }
+    blocks_.clear();
+    block_size_.clear();
+    memory_usage_.store(0, std::memory_order_relaxed);
+    // A zeroed head, which has no links, reads as an empty table
+    char* head = new char[kBlockSize]();
+    blocks_.push_back(head);
+    block_size_.push_back(kBlockSize);
+  }
+}
+
+Arena::Arena(const Arena* a, WorkerPool* workers): memory_usage_(0), IsMemTable(false), Transfer(false), kMemSize(kBlockSize) {
   assert(a->blocks_.size() == 1); //memtable only has one block
+  assert(a->MemoryUsage() <= a->Capacity());
 
   alloc_ptr_ = AllocateNewBlock(a->MemoryUsage());
   
-  memcpy(alloc_ptr_, a->blocks_[0], a->MemoryUsage());
+  workers->Copy(alloc_ptr_, a->blocks_[0], a->MemoryUsage());
   alloc_ptr_ += a->MemoryUsage();
   alloc_bytes_remaining_ = 0;
 } 
@@ -36,7 +72,13 @@ Arena::~Arena() {
   } else if (!Transfer) {
     int j = 0;
     for (size_t i = 0; i < blocks_.size(); i++) {
+      if (nvm_pool != nullptr && nvm_pool->Contains(blocks_[i])) {
+        nvm_pool->Free(blocks_[i], block_size_[i]);
+      } else if (nvm_pool != nullptr) {
+        delete[] blocks_[i];  // The pool was full
+      } else {
         numa_free(blocks_[i], block_size_[i]);
+      }
     }
 
   } else {
@@ -45,8 +87,13 @@ Arena::~Arena() {
 }
 
 char* Arena::AllocateFallback(size_t bytes) {
-  // MemTable only alloc one large block (6MB)
+  // MemTable only alloc one large block (6MB).  A flush copies just that
+  // block, MakeRoomForWrite() switches memtables before it runs out.
   if (IsMemTable) {
+    if (!blocks_.empty() || bytes > static_cast<size_t>(kMemSize)) {
+      assert(false);
+      return nullptr;
+    }
     alloc_ptr_ = AllocateNewBlock(kMemSize);
     alloc_bytes_remaining_ = kMemSize;
 
@@ -60,14 +107,14 @@ char* Arena::AllocateFallback(size_t bytes) {
 
   // DataTale alloc smaller block after initialization
   } else {
-    if (bytes > kBlockSize / 4) {
+    if (bytes > kMemSize / 4) {
     // Object is more than a quarter of our block size.  Allocate it separately
     // to avoid wasting too much space in leftover bytes.
     char* result = AllocateNewBlock(bytes);
     return result;
     }
-    alloc_ptr_ = AllocateNewBlock(kBlockSize);
-    alloc_bytes_remaining_ = kBlockSize;
+    alloc_ptr_ = AllocateNewBlock(kMemSize);
+    alloc_bytes_remaining_ = kMemSize;
 
     char* result = alloc_ptr_;
     alloc_ptr_ += bytes;
@@ -100,10 +147,50 @@ char* Arena::AllocateAligned(size_t bytes) {
   return result;
 }
 
+char* Arena::AllocateAlignedConcurrently(size_t bytes) {
+  const int align = (sizeof(void*) > 8) ? sizeof(void*) : 8;
+  return AllocateShared(bytes, align);
+}
+
+// The memtable owns a single block and memory_usage_ counts every byte
+// handed out from it, so memory_usage_ doubles as the allocation cursor.
+char* Arena::AllocateShared(size_t bytes, size_t align) {
+  assert(IsMemTable && !blocks_.empty());
+  char* const base = blocks_[0];
+  size_t used = memory_usage_.load(std::memory_order_relaxed);
+  while (true) {
+    const size_t current_mod = reinterpret_cast<uintptr_t>(base + used) & (align - 1);
+    const size_t slop = (current_mod == 0 ? 0 : align - current_mod);
+    const size_t needed = bytes + slop;
+    if (used + needed > static_cast<size_t>(kMemSize)) {
+      // A flush copies only this block, MakeRoomForWrite() lets in no
+      // more than it holds
+      assert(false);
+      return nullptr;
+    }
+    if (memory_usage_.compare_exchange_weak(used, used + needed,
+                                            std::memory_order_relaxed)) {
+      return base + used + slop;
+    }
+  }
+}
+
 char* Arena::AllocateNewBlock(size_t block_bytes) {
   char* result;
   if (IsMemTable) {
     result = new char[block_bytes];
+  } else if (nvm_pool != nullptr) {
+    result = nvm_pool->Allocate(block_bytes);
+    if (result == nullptr) {
+      // Finish the table in DRAM, the caller finds the error in status()
+      if (status_.ok()) {
+        status_ = Status::IOError("nvm pool is full");
+      }
+      result = new char[block_bytes];
+    }
+    memory_usage_.fetch_add(block_bytes + sizeof(char*),
+                              std::memory_order_relaxed);
+    block_size_.push_back(block_bytes);
   } else {
     NvmNodeSizeRecord(block_bytes);
     result = (char*)numa_alloc_onnode(block_bytes, nvm_node);
@@ -123,4 +210,11 @@ void Arena::ReceiveArena(Arena* a) {
   }
 }
 
+void Arena::GetRegions(std::vector<NvmRegion>* regions) const {
+  assert(nvm_pool != nullptr);
+  for (size_t i = 0; i < blocks_.size(); i++) {
+    regions->push_back(NvmRegion(nvm_pool->Offset(blocks_[i]), block_size_[i]));
+  }
+}
+
 }  // namespace leveldb
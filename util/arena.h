@@ -12,6 +12,9 @@
 #include <vector>
 #include <numa.h>
 #include "leveldb/options.h"
+#include "leveldb/status.h"
+#include "util/nvm_pool.h"
+#include "util/worker_pool.h"
 
 namespace leveldb {
 
@@ -19,8 +22,15 @@ class Arena {
  public:
   Arena();
   Arena(const size_t size);
-  Arena(const Arena*);
-  
+  // Copy of a memtable's arena on the nvm node, copied by "workers"
+  Arena(const Arena*, WorkerPool* workers);
+  // Arena on the nvm node that allocates blocks of "block_size" bytes
+  Arena(const size_t block_size, const bool memtable);
+  // Arena that adopts regions of the nvm pool recorded in the MANIFEST.
+  // If one of them is not free in the pool, status() is a corruption and
+  // the arena holds an empty table instead.
+  Arena(const std::vector<NvmRegion>& regions, const size_t block_size);
+
   Arena(const Arena&) = delete;
   Arena& operator=(const Arena&) = delete;
 
@@ -32,6 +42,14 @@ class Arena {
   // Allocate memory with the normal alignment guarantees provided by malloc.
   char* AllocateAligned(size_t bytes);
 
+  // Variants of Allocate() and AllocateAligned() that may be called by
+  // several threads at once.  They bump a shared cursor in the memtable's
+  // block with a compare-and-swap.
+  // REQUIRES: memtable arena whose block has been allocated and has room
+  // for "bytes", and no concurrent calls of the single threaded variants.
+  char* AllocateConcurrently(size_t bytes) { return AllocateShared(bytes, 1); }
+  char* AllocateAlignedConcurrently(size_t bytes);
+
   // Returns an estimate of the total memory usage of data allocated
   // by the arena.
   size_t MemoryUsage() const {
@@ -46,6 +64,9 @@ class Arena {
 	}
   }
 
+  // Size of a memtable arena's single block
+  size_t Capacity() const { return kMemSize; }
+
   char* GetHead() {
     assert(blocks_.size() > 0);
     return blocks_[0];
@@ -57,11 +78,21 @@ class Arena {
 
   void ReceiveArena(Arena* a);
 
+  // Append the pool regions holding this arena's blocks to *regions.
+  // REQUIRES: blocks were allocated from nvm_pool
+  void GetRegions(std::vector<NvmRegion>* regions) const;
+
+  // Not OK if the MANIFEST regions could not be adopted or the nvm pool
+  // ran out of space.  Blocks the pool did not have come from DRAM, a
+  // table in such an arena must not be recorded in the MANIFEST.
+  Status status() const { return status_; }
+
  private:
   bool IsMemTable;
   bool Transfer;
   char* AllocateFallback(size_t bytes);
   char* AllocateNewBlock(size_t block_bytes);
+  char* AllocateShared(size_t bytes, size_t align);
 
   // Allocation state
   char* alloc_ptr_;
@@ -80,6 +111,7 @@ class Arena {
  private:
   std::atomic<size_t> memory_usage_;
   int kMemSize;
+  Status status_;
 };
 
 inline char* Arena::Allocate(size_t bytes) {
@@ -0,0 +1,250 @@
+// Add by MioDB
+
+#include "util/cuckoofilter.h"
+
+#include <cstring>
+#include <thread>
+
+#include "numa.h"
+#include "db/global.h"
+#include "util/coding.h"
+#include "util/mutexlock.h"
+
+namespace leveldb {
+
+namespace {
+
+const int kSlots = 4;  // Fingerprints per bucket
+
+// Filters are kept at most this full, inserts start failing beyond it
+const double kMaxLoad = 0.9;
+
+// Kicks before a fingerprint is given up
+const int kMaxKicks = 500;
+
+// A persisted filter is its buckets followed by the magic, whether it
+// overflowed and its number of keys
+const uint32_t kPersistedMagic = 0xc0c0f117;
+const size_t kTrailerSize = 16;
+
+const uint64_t kLanes = 0x0001000100010001ull;
+const uint64_t kHighBits = 0x8000800080008000ull;
+
+// Whether one of the fingerprints in "word" is 0
+inline bool HasZeroLane(uint64_t word) {
+  return ((word - kLanes) & ~word & kHighBits) != 0;
+}
+
+size_t BucketsFor(size_t keys) {
+  size_t n = 1;
+  while (n * kSlots * kMaxLoad < keys) {
+    n <<= 1;
+  }
+  return n;
+}
+
+}  // namespace
+
+CuckooFilter::CuckooFilter(size_t keys, int dram_node)
+    : num_buckets_(BucketsFor(keys)),
+      buckets_(reinterpret_cast<uint64_t*>(numa_alloc_onnode(
+          num_buckets_ * sizeof(uint64_t), dram_node))),
+      kicks_(0),
+      overflowed_(false),
+      num_keys_(0),
+      rnd_(0x12345678),
+      persisted_(nullptr) {}
+
+CuckooFilter::CuckooFilter(size_t num_buckets, int dram_node, size_t keys,
+                           bool overflowed)
+    : num_buckets_(num_buckets),
+      buckets_(reinterpret_cast<uint64_t*>(numa_alloc_onnode(
+          num_buckets_ * sizeof(uint64_t), dram_node))),
+      kicks_(0),
+      overflowed_(overflowed),
+      num_keys_(keys),
+      rnd_(0x12345678),
+      persisted_(nullptr) {}
+
+CuckooFilter::~CuckooFilter() {
+  numa_free(buckets_, num_buckets_ * sizeof(uint64_t));
+  if (persisted_ != nullptr) {
+    nvm_pool->Free(persisted_, num_buckets_ * sizeof(uint64_t) + kTrailerSize);
+  }
+}
+
+uint16_t CuckooFilter::Fingerprint(uint32_t hash) {
+  // The bucket comes from the low bits of hash, take these from all of it
+  const uint16_t fp = (hash * 0x9e3779b97f4a7c15ull) >> 48;
+  return fp == 0 ? 1 : fp;
+}
+
+size_t CuckooFilter::AltIndex(size_t i, uint16_t fp) const {
+  return (i ^ (fp * 0x5bd1e995u)) & (num_buckets_ - 1);
+}
+
+uint64_t CuckooFilter::Word(size_t i) const {
+  return __atomic_load_n(&buckets_[i], __ATOMIC_ACQUIRE);
+}
+
+bool CuckooFilter::Contains(size_t i, uint16_t fp) const {
+  return HasZeroLane(Word(i) ^ (fp * kLanes));
+}
+
+bool CuckooFilter::Insert(size_t i, uint16_t fp) {
+  const uint64_t word = Word(i);
+  for (int slot = 0; slot < kSlots; slot++) {
+    if (((word >> (16 * slot)) & 0xffff) == 0) {
+      __atomic_store_n(&buckets_[i], word | (uint64_t{fp} << (16 * slot)),
+                       __ATOMIC_RELEASE);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool CuckooFilter::Remove(size_t i, uint16_t fp) {
+  const uint64_t word = Word(i);
+  for (int slot = 0; slot < kSlots; slot++) {
+    if (((word >> (16 * slot)) & 0xffff) == fp) {
+      __atomic_store_n(&buckets_[i], word & ~(uint64_t{0xffff} << (16 * slot)),
+                       __ATOMIC_RELEASE);
+      return true;
+    }
+  }
+  return false;
+}
+
+void CuckooFilter::Add(uint32_t hash) {
+  uint16_t fp = Fingerprint(hash);
+  size_t i = hash & (num_buckets_ - 1);
+  MutexLock l(&mu_);
+  num_keys_++;
+  if (Insert(i, fp) || Insert(AltIndex(i, fp), fp)) {
+    return;
+  }
+
+  // Move fingerprints to their other bucket until one finds room
+  kicks_.store(kicks_.load(std::memory_order_relaxed) + 1,
+               std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  bool placed = false;
+  for (int n = 0; n < kMaxKicks && !placed; n++) {
+    rnd_ = rnd_ * 1103515245 + 12345;
+    const int slot = (rnd_ >> 16) % kSlots;
+    const uint64_t word = Word(i);
+    const uint16_t victim = (word >> (16 * slot)) & 0xffff;
+    __atomic_store_n(&buckets_[i],
+                     (word & ~(uint64_t{0xffff} << (16 * slot))) |
+                         (uint64_t{fp} << (16 * slot)),
+                     __ATOMIC_RELAXED);
+    fp = victim;
+    i = AltIndex(i, fp);
+    placed = Insert(i, fp);
+  }
+  if (!placed) {
+    overflowed_.store(true, std::memory_order_release);
+  }
+  kicks_.store(kicks_.load(std::memory_order_relaxed) + 1,
+               std::memory_order_release);
+}
+
+void CuckooFilter::Delete(uint32_t hash) {
+  const uint16_t fp = Fingerprint(hash);
+  const size_t i = hash & (num_buckets_ - 1);
+  MutexLock l(&mu_);
+  if (Remove(i, fp) || Remove(AltIndex(i, fp), fp)) {
+    num_keys_--;
+  }
+}
+
+bool CuckooFilter::KeyMayMatch(uint32_t hash) const {
+  const uint16_t fp = Fingerprint(hash);
+  const size_t i1 = hash & (num_buckets_ - 1);
+  const size_t i2 = AltIndex(i1, fp);
+  while (true) {
+    uint64_t version;
+    while ((version = kicks_.load(std::memory_order_acquire)) & 1) {
+      std::this_thread::yield();
+    }
+    if (Contains(i1, fp) || Contains(i2, fp)) {
+      return true;
+    }
+    if (overflowed_.load(std::memory_order_acquire)) {
+      return true;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (kicks_.load(std::memory_order_relaxed) == version) {
+      return false;
+    }
+  }
+}
+
+void CuckooFilter::Prefetch(uint32_t hash) const {
+  const size_t i = hash & (num_buckets_ - 1);
+  __builtin_prefetch(&buckets_[i]);
+  __builtin_prefetch(&buckets_[AltIndex(i, Fingerprint(hash))]);
+}
+
+bool CuckooFilter::HasRoomFor(size_t keys) {
+  MutexLock l(&mu_);
+  return !overflowed_.load(std::memory_order_relaxed) &&
+         num_keys_ + keys <= num_buckets_ * kSlots * kMaxLoad;
+}
+
+size_t CuckooFilter::NumKeys() {
+  MutexLock l(&mu_);
+  return num_keys_;
+}
+
+CuckooFilter* CuckooFilter::Load(const NvmRegion& region, int dram_node) {
+  if (region.size <= kTrailerSize) {
+    return nullptr;
+  }
+  const size_t size = region.size - kTrailerSize;
+  const size_t num_buckets = size / sizeof(uint64_t);
+  if (size % sizeof(uint64_t) != 0 ||
+      (num_buckets & (num_buckets - 1)) != 0) {
+    return nullptr;
+  }
+  char* persisted = nvm_pool->Reserve(region);
+  if (persisted == nullptr) {
+    return nullptr;
+  }
+  if (DecodeFixed32(persisted + size) != kPersistedMagic) {
+    nvm_pool->Free(persisted, region.size);
+    return nullptr;
+  }
+  CuckooFilter* filter = new CuckooFilter(
+      num_buckets, dram_node, DecodeFixed64(persisted + size + 8),
+      DecodeFixed32(persisted + size + 4) != 0);
+  filter->persisted_ = persisted;
+  std::memcpy(filter->buckets_, persisted, size);
+  return filter;
+}
+
+void CuckooFilter::Persist() {
+  const size_t size = num_buckets_ * sizeof(uint64_t);
+  if (persisted_ == nullptr) {
+    persisted_ = nvm_pool->Allocate(size + kTrailerSize);
+    if (persisted_ == nullptr) {
+      return;  // pool is full, the filter is rebuilt when the DB is reopened
+    }
+    EncodeFixed32(persisted_ + size, kPersistedMagic);
+  }
+  std::memcpy(persisted_, buckets_, size);
+  EncodeFixed32(persisted_ + size + 4,
+                overflowed_.load(std::memory_order_relaxed) ? 1 : 0);
+  EncodeFixed64(persisted_ + size + 8, NumKeys());
+  nvm_pool->Sync(persisted_, size + kTrailerSize);
+}
+
+NvmRegion CuckooFilter::PersistedRegion() const {
+  if (persisted_ == nullptr) {
+    return NvmRegion();
+  }
+  return NvmRegion(nvm_pool->Offset(persisted_),
+                   num_buckets_ * sizeof(uint64_t) + kTrailerSize);
+}
+
+}  // namespace leveldb
@@ -0,0 +1,86 @@
+// Add by MioDB
+// Cuckoo filter of the last table.  Compactions delete keys from the last
+// table, which a bloom filter cannot follow, a cuckoo filter can.
+
+#ifndef STORAGE_LEVELDB_UTIL_CUCKOOFILTER_H_
+#define STORAGE_LEVELDB_UTIL_CUCKOOFILTER_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "port/port.h"
+#include "port/thread_annotations.h"
+#include "util/nvm_pool.h"
+
+namespace leveldb {
+
+// Every key leaves a 16 bit fingerprint in one of two buckets of four,
+// so a probe reads two words.  Keys are given by their
+// MergeableBloom::BloomHash().  Add() and Delete() may run on several
+// threads at once, KeyMayMatch() needs no synchronization with them.
+class CuckooFilter {
+ public:
+  // A filter with room for "keys" keys, allocated on "dram_node"
+  CuckooFilter(size_t keys, int dram_node);
+
+  CuckooFilter(const CuckooFilter&) = delete;
+  CuckooFilter& operator=(const CuckooFilter&) = delete;
+
+  ~CuckooFilter();
+
+  // A key added n times is in the filter until it is deleted n times.
+  // REQUIRES: the key was added before it is deleted
+  void Add(uint32_t hash);
+  void Delete(uint32_t hash);
+
+  bool KeyMayMatch(uint32_t hash) const;
+  // Start loading the buckets that KeyMayMatch(hash) reads
+  void Prefetch(uint32_t hash) const;
+
+  // Whether "keys" more keys can be added without making the filter
+  // useless.  A filter that ran out of room matches every key.
+  bool HasRoomFor(size_t keys);
+  size_t NumKeys();
+
+  // Load the filter persisted in "region" of the nvm pool onto
+  // "dram_node".  Returns nullptr if there is none.
+  static CuckooFilter* Load(const NvmRegion& region, int dram_node);
+
+  // Copy the filter to the nvm pool so that it survives a restart.
+  // REQUIRES: no Add() or Delete() runs at the same time
+  void Persist();
+
+  // Region of the nvm pool holding the persisted filter, size 0 if none.
+  NvmRegion PersistedRegion() const;
+
+ private:
+  CuckooFilter(size_t num_buckets, int dram_node, size_t keys,
+               bool overflowed);
+
+  static uint16_t Fingerprint(uint32_t hash);
+  size_t AltIndex(size_t i, uint16_t fp) const;
+  uint64_t Word(size_t i) const;
+  bool Contains(size_t i, uint16_t fp) const;
+  // Put fp in a free slot of bucket i if it has one
+  bool Insert(size_t i, uint16_t fp) EXCLUSIVE_LOCKS_REQUIRED(mu_);
+  bool Remove(size_t i, uint16_t fp) EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  const size_t num_buckets_;  // A power of two
+  uint64_t* const buckets_;   // Four fingerprints each, 0 is a free slot
+
+  // Odd while Add() kicks fingerprints to their other bucket.  One of them
+  // is in neither bucket then, so readers that miss check it.
+  std::atomic<uint64_t> kicks_;
+  std::atomic<bool> overflowed_;  // A fingerprint was dropped
+
+  port::Mutex mu_;  // Serializes the writers
+  size_t num_keys_ GUARDED_BY(mu_);
+  uint32_t rnd_ GUARDED_BY(mu_);  // Picks the slots to kick from
+
+  char* persisted_;  // Copy of buckets_ in the nvm pool, or nullptr
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_UTIL_CUCKOOFILTER_H_
@@ -0,0 +1,170 @@
+// Add by MioDB
+
+#include "util/cuckoofilter.h"
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "db/global.h"
+#include "leveldb/env.h"
+#include "util/coding.h"
+#include "util/mergeablebloom.h"
+#include "util/testutil.h"
+
+namespace leveldb {
+
+static const int kKeys = 10000;
+
+static uint32_t KeyHash(int i) {
+  char buf[4];
+  EncodeFixed32(buf, i);
+  return MergeableBloom::BloomHash(Slice(buf, sizeof(buf)));
+}
+
+// Share of the keys in [kKeys, 2 * kKeys) that the filter lets through
+static double FalsePositiveRate(const CuckooFilter& filter) {
+  int matches = 0;
+  for (int i = kKeys; i < 2 * kKeys; i++) {
+    if (filter.KeyMayMatch(KeyHash(i))) matches++;
+  }
+  return matches / static_cast<double>(kKeys);
+}
+
+TEST(CuckooFilterTest, EmptyFilter) {
+  CuckooFilter filter(kKeys, 0);
+  ASSERT_EQ(0, FalsePositiveRate(filter));
+  ASSERT_TRUE(filter.HasRoomFor(kKeys));
+}
+
+TEST(CuckooFilterTest, AddedKeysMatch) {
+  CuckooFilter filter(kKeys, 0);
+  for (int i = 0; i < kKeys; i++) {
+    filter.Add(KeyHash(i));
+  }
+  for (int i = 0; i < kKeys; i++) {
+    ASSERT_TRUE(filter.KeyMayMatch(KeyHash(i))) << i;
+  }
+  ASSERT_EQ(kKeys, filter.NumKeys());
+  ASSERT_LT(FalsePositiveRate(filter), 0.001);
+}
+
+TEST(CuckooFilterTest, DeletedKeysGo) {
+  CuckooFilter filter(2 * kKeys, 0);
+  for (int i = 0; i < 2 * kKeys; i++) {
+    filter.Add(KeyHash(i));
+  }
+  for (int i = kKeys; i < 2 * kKeys; i++) {
+    filter.Delete(KeyHash(i));
+  }
+  ASSERT_EQ(kKeys, filter.NumKeys());
+  for (int i = 0; i < kKeys; i++) {
+    ASSERT_TRUE(filter.KeyMayMatch(KeyHash(i))) << i;
+  }
+  ASSERT_LT(FalsePositiveRate(filter), 0.001);
+
+  // A key added twice stays until it is deleted twice
+  filter.Add(KeyHash(kKeys));
+  filter.Add(KeyHash(kKeys));
+  filter.Delete(KeyHash(kKeys));
+  ASSERT_TRUE(filter.KeyMayMatch(KeyHash(kKeys)));
+  filter.Delete(KeyHash(kKeys));
+  ASSERT_LT(FalsePositiveRate(filter), 0.001);
+}
+
+TEST(CuckooFilterTest, Overflow) {
+  CuckooFilter filter(kKeys / 8, 0);
+  ASSERT_FALSE(filter.HasRoomFor(kKeys));
+  for (int i = 0; i < kKeys; i++) {
+    filter.Add(KeyHash(i));
+  }
+  // Keys it had no room for are not lost, everything matches
+  for (int i = 0; i < kKeys; i++) {
+    ASSERT_TRUE(filter.KeyMayMatch(KeyHash(i))) << i;
+  }
+  ASSERT_FALSE(filter.HasRoomFor(0));
+}
+
+// A filter read back from the pool matches what the persisted one did
+TEST(CuckooFilterTest, PersistAndLoad) {
+  std::string fname;
+  ASSERT_LEVELDB_OK(Env::Default()->GetTestDirectory(&fname));
+  fname += "/cuckoofilter_test.pool";
+  Env::Default()->RemoveFile(fname);
+  ASSERT_LEVELDB_OK(NvmPool::Open(fname, 1 << 20, true, &nvm_pool));
+
+  NvmRegion region;
+  {
+    CuckooFilter filter(kKeys, 0);
+    for (int i = 0; i < kKeys; i++) {
+      filter.Add(KeyHash(i));
+    }
+    filter.Persist();
+    region = filter.PersistedRegion();
+    ASSERT_GT(region.size, 0);
+  }
+  // Freeing only returns the space to this process, the bytes stay
+  delete nvm_pool;
+
+  ASSERT_LEVELDB_OK(NvmPool::Open(fname, 1 << 20, false, &nvm_pool));
+  CuckooFilter* filter = CuckooFilter::Load(region, 0);
+  ASSERT_TRUE(filter != nullptr);
+  for (int i = 0; i < kKeys; i++) {
+    ASSERT_TRUE(filter->KeyMayMatch(KeyHash(i))) << i;
+  }
+  ASSERT_EQ(kKeys, filter->NumKeys());
+  ASSERT_LT(FalsePositiveRate(*filter), 0.001);
+  ASSERT_EQ(region.offset, filter->PersistedRegion().offset);
+  delete filter;
+
+  delete nvm_pool;
+  nvm_pool = nullptr;
+  Env::Default()->RemoveFile(fname);
+}
+
+// Readers never miss a key while writers kick fingerprints around
+TEST(CuckooFilterTest, Concurrent) {
+  CuckooFilter filter(4 * kKeys, 0);
+  std::atomic<int> added(0);
+  std::atomic<bool> stop(false);
+  std::atomic<int> bad(0);
+
+  std::vector<std::thread> readers;
+  for (int t = 0; t < 2; t++) {
+    readers.emplace_back([&] {
+      while (!stop.load(std::memory_order_acquire)) {
+        const int n = added.load(std::memory_order_acquire);
+        for (int i = 0; i < n; i += 7) {
+          if (!filter.KeyMayMatch(KeyHash(i))) bad++;
+        }
+      }
+    });
+  }
+  std::thread deleter([&] {
+    // Keys past the ones readers check come and go
+    for (int i = 0; i < 2 * kKeys; i++) {
+      filter.Add(KeyHash(8 * kKeys + i));
+      filter.Delete(KeyHash(8 * kKeys + i));
+    }
+  });
+  for (int i = 0; i < 3 * kKeys; i++) {
+    filter.Add(KeyHash(i));
+    added.store(i + 1, std::memory_order_release);
+  }
+  deleter.join();
+  stop.store(true, std::memory_order_release);
+  for (std::thread& t : readers) {
+    t.join();
+  }
+  ASSERT_EQ(0, bad.load());
+  ASSERT_EQ(3 * kKeys, filter.NumKeys());
+}
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
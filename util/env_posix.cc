@@ -12,6 +12,7 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <atomic>
 #include <cerrno>
 #include <cstddef>
@@ -26,6 +27,7 @@
 #include <thread>
 #include <type_traits>
 #include <utility>
+#include <vector>
 
 #include "leveldb/env.h"
 #include "leveldb/slice.h"
@@ -663,6 +665,8 @@ class PosixEnv : public Env {
   void Schedule(void (*background_work_function)(void* background_work_arg, int level),
                 void* background_work_arg, int level) override;
 
+  void SetBackgroundThreads(int number) override;
+
   void StartThread(void (*thread_main)(void* thread_main_arg),
                    void* thread_main_arg) override {
     std::thread new_thread(thread_main, thread_main_arg);
@@ -717,12 +721,24 @@ class PosixEnv : public Env {
   }
 
  private:
-  void BackgroundThreadMain(int level);
+  void BackgroundThreadMain(int worker);
 
-  static void BackgroundThreadEntryPoint(PosixEnv* env, int level) {
-    env->BackgroundThreadMain(level);
+  static void BackgroundThreadEntryPoint(PosixEnv* env, int worker) {
+    env->BackgroundThreadMain(worker);
   }
 
+  // Start threads until there are background_threads_ of them.
+  void StartBackgroundThreads()
+      EXCLUSIVE_LOCKS_REQUIRED(background_work_mutex_);
+
+  // Wake an idle worker, if there is one, for work just queued.
+  void WakeBackgroundThread()
+      EXCLUSIVE_LOCKS_REQUIRED(background_work_mutex_);
+
+  // Return the lowest level with queued work, or -1 if there is none.
+  int NextBackgroundLevel() const
+      EXCLUSIVE_LOCKS_REQUIRED(background_work_mutex_);
+
   // Stores the work item data in a Schedule() call.
   //
   // Instances are constructed on the thread calling Schedule() and used on the
@@ -738,10 +754,26 @@ class PosixEnv : public Env {
     int level;
   };
 
+  // A background thread.  Each one sleeps on its own condition variable,
+  // so that queuing work wakes a single thread.
+  struct BackgroundThread {
+    explicit BackgroundThread(port::Mutex* mu) : cv(mu), idle(false) {}
+
+    port::CondVar cv;
+    bool idle;  // Waiting on cv for work
+  };
+
   port::Mutex background_work_mutex_;
-  port::CondVar background_work_cv_ GUARDED_BY(background_work_mutex_);
-  bool started_background_thread_[config::kNumLevels] GUARDED_BY(background_work_mutex_);
 
+  // Threads started so far, never destroyed.  Only the first
+  // background_threads_ of them take work.
+  std::vector<BackgroundThread*> background_threads_started_
+      GUARDED_BY(background_work_mutex_);
+  int background_threads_ GUARDED_BY(background_work_mutex_);
+
+  // The work queue shared by all threads, kept as one FIFO per level.  A
+  // thread takes the work of the lowest level, so flushes go before merges
+  // of upper levels and those before the copy into the last level.
   std::queue<BackgroundWorkItem> background_work_queue_[config::kNumLevels]
       GUARDED_BY(background_work_mutex_);
 
@@ -774,47 +806,84 @@ int MaxOpenFiles() {
 }  // namespace
 
 PosixEnv::PosixEnv()
-    : background_work_cv_(&background_work_mutex_),
-      //started_background_thread_(false),
+    : background_threads_(config::kNumLevels),
       mmap_limiter_(MaxMmaps()),
-      fd_limiter_(MaxOpenFiles()) {
-  
-  for (int i = 0; i < config::kNumLevels; i++) {
-    started_background_thread_[i] = false;
-  }
-}
+      fd_limiter_(MaxOpenFiles()) {}
 
 void PosixEnv::Schedule(
     void (*background_work_function)(void* background_work_arg, int level),
     void* background_work_arg, int level) {
+  assert(level >= 0 && level < config::kNumLevels);
+  background_work_mutex_.Lock();
+
+  // Start the background threads, if we haven't done so already.
+  StartBackgroundThreads();
+
+  background_work_queue_[level].emplace(background_work_function, background_work_arg, level);
+  WakeBackgroundThread();
+  background_work_mutex_.Unlock();
+}
+
+void PosixEnv::SetBackgroundThreads(int number) {
   background_work_mutex_.Lock();
+  background_threads_ = std::max(number, 1);
+  if (!background_threads_started_.empty()) {
+    StartBackgroundThreads();
+    // Threads that may take work again have to look at the queues
+    for (int i = 0; i < background_threads_; i++) {
+      background_threads_started_[i]->cv.Signal();
+    }
+  }
+  background_work_mutex_.Unlock();
+}
 
-  // Start the background thread, if we haven't done so already.
-  if (!started_background_thread_[level]) {
-    started_background_thread_[level] = true;
-    std::thread background_thread(PosixEnv::BackgroundThreadEntryPoint, this, level);
+void PosixEnv::StartBackgroundThreads() {
+  while (static_cast<int>(background_threads_started_.size()) <
+         background_threads_) {
+    const int worker = static_cast<int>(background_threads_started_.size());
+    background_threads_started_.push_back(
+        new BackgroundThread(&background_work_mutex_));
+    std::thread background_thread(PosixEnv::BackgroundThreadEntryPoint, this,
+                                  worker);
     background_thread.detach();
   }
+}
 
-  // If the queue is empty, the background thread may be waiting for work.
-  if (background_work_queue_[level].empty()) {
-    background_work_cv_.SignalAll();
+void PosixEnv::WakeBackgroundThread() {
+  // Without an idle thread the work is taken by the next thread that
+  // finishes what it is doing.
+  for (int i = 0; i < background_threads_; i++) {
+    BackgroundThread* thread = background_threads_started_[i];
+    if (thread->idle) {
+      thread->idle = false;
+      thread->cv.Signal();
+      return;
+    }
   }
+}
 
-  background_work_queue_[level].emplace(background_work_function, background_work_arg, level);
-  background_work_mutex_.Unlock();
+int PosixEnv::NextBackgroundLevel() const {
+  for (int level = 0; level < config::kNumLevels; level++) {
+    if (!background_work_queue_[level].empty()) {
+      return level;
+    }
+  }
+  return -1;
 }
 
-void PosixEnv::BackgroundThreadMain(int level) {
+void PosixEnv::BackgroundThreadMain(int worker) {
+  background_work_mutex_.Lock();
+  BackgroundThread* self = background_threads_started_[worker];
   while (true) {
-    background_work_mutex_.Lock();
-
     // Wait until there is work to be done.
-    while (background_work_queue_[level].empty()) {
-      background_work_cv_.Wait();
+    int level;
+    while (worker >= background_threads_ ||
+           (level = NextBackgroundLevel()) < 0) {
+      self->idle = true;
+      self->cv.Wait();
     }
+    self->idle = false;
 
-    assert(!background_work_queue_[level].empty());
     auto background_work_function = background_work_queue_[level].front().function;
     void* background_work_arg = background_work_queue_[level].front().arg;
     int background_work_level = background_work_queue_[level].front().level;
@@ -822,6 +891,7 @@ void PosixEnv::BackgroundThreadMain(int level) {
 
     background_work_mutex_.Unlock();
     background_work_function(background_work_arg, background_work_level);
+    background_work_mutex_.Lock();
   }
 }
 
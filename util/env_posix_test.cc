@@ -14,6 +14,7 @@
 #include <vector>
 
 #include "gtest/gtest.h"
+#include "db/dbformat.h"
 #include "leveldb/env.h"
 #include "port/port.h"
 #include "util/env_posix_test_helper.h"
@@ -212,6 +213,70 @@ TEST_F(EnvPosixTest, TestOpenOnRead) {
   ASSERT_LEVELDB_OK(env_->RemoveFile(test_file));
 }
 
+namespace {
+
+struct ScheduleState {
+  port::Mutex mu;
+  port::CondVar cv{&mu};
+  bool blocker_started = false;
+  bool release_blocker = false;
+  std::vector<int> levels;
+};
+
+struct ScheduleArg {
+  ScheduleState* state;
+  bool blocker;
+};
+
+void ScheduleWork(void* arg, int level) {
+  ScheduleArg* work = reinterpret_cast<ScheduleArg*>(arg);
+  ScheduleState* state = work->state;
+  state->mu.Lock();
+  if (work->blocker) {
+    state->blocker_started = true;
+    state->cv.SignalAll();
+    while (!state->release_blocker) {
+      state->cv.Wait();
+    }
+  } else {
+    state->levels.push_back(level);
+    state->cv.SignalAll();
+  }
+  state->mu.Unlock();
+}
+
+}  // namespace
+
+TEST_F(EnvPosixTest, ScheduleLowerLevelsFirst) {
+  env_->SetBackgroundThreads(1);
+
+  ScheduleState state;
+  ScheduleArg blocker = {&state, true};
+  ScheduleArg work = {&state, false};
+  env_->Schedule(&ScheduleWork, &blocker, 5);
+  state.mu.Lock();
+  while (!state.blocker_started) {
+    state.cv.Wait();
+  }
+  state.mu.Unlock();
+
+  // Queued while the only thread is busy
+  env_->Schedule(&ScheduleWork, &work, 7);
+  env_->Schedule(&ScheduleWork, &work, 3);
+  env_->Schedule(&ScheduleWork, &work, 0);
+
+  state.mu.Lock();
+  state.release_blocker = true;
+  state.cv.SignalAll();
+  while (state.levels.size() < 3) {
+    state.cv.Wait();
+  }
+  state.mu.Unlock();
+  ASSERT_EQ((std::vector<int>{0, 3, 7}), state.levels);
+
+  env_->SetBackgroundThreads(config::kNumLevels);
+}
+
 #if HAVE_O_CLOEXEC
 
 TEST_F(EnvPosixTest, TestCloseOnExecSequentialFile) {
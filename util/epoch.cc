@@ -0,0 +1,93 @@
+// Add by MioDB
+
+#include "util/epoch.h"
+
+#include <thread>
+
+#include "util/mutexlock.h"
+
+namespace leveldb {
+
+// Spread the threads over the slots in the order they first read
+static int ThreadSlot(int slots) {
+  static std::atomic<int> next(0);
+  thread_local int slot = next.fetch_add(1, std::memory_order_relaxed);
+  return slot % slots;
+}
+
+// Starts at 2 so that SafeBefore() never wraps
+Epoch::Epoch() : epoch_(2) {
+  for (int i = 0; i < kSlots; i++) {
+    slots_[i].readers[0].store(0, std::memory_order_relaxed);
+    slots_[i].readers[1].store(0, std::memory_order_relaxed);
+  }
+}
+
+uint64_t Epoch::Enter() {
+  // A reader that counts itself late in a stale epoch is still safe: the
+  // epoch of the same parity that it now blocks comes after everything
+  // it can no longer reach was unlinked.
+  const uint64_t epoch = epoch_.load(std::memory_order_seq_cst);
+  const uint64_t token =
+      (epoch & 1) | (static_cast<uint64_t>(ThreadSlot(kSlots)) << 1);
+  slots_[token >> 1].readers[epoch & 1].fetch_add(1, std::memory_order_seq_cst);
+  return token;
+}
+
+void Epoch::Exit(uint64_t token) {
+  slots_[token >> 1].readers[token & 1].fetch_sub(1, std::memory_order_release);
+}
+
+uint64_t Epoch::TryAdvance() {
+  const uint64_t epoch = epoch_.load(std::memory_order_seq_cst);
+  // The epoch before this one shares its counters with the next one
+  const int parity = static_cast<int>((epoch - 1) & 1);
+  for (int i = 0; i < kSlots; i++) {
+    if (slots_[i].readers[parity].load(std::memory_order_seq_cst) != 0) {
+      return epoch;
+    }
+  }
+  epoch_.store(epoch + 1, std::memory_order_seq_cst);
+  return epoch + 1;
+}
+
+EpochLimbo::~EpochLimbo() {
+  for (const Retired& r : retired_) {
+    (*r.deleter)(r.object);
+  }
+}
+
+void EpochLimbo::Retire(void* object, void (*deleter)(void*)) {
+  MutexLock l(&mu_);
+  retired_.push_back(Retired{epoch_.Current(), object, deleter});
+  DeleteUnreachable();
+}
+
+void EpochLimbo::Drain() {
+  mu_.Lock();
+  DeleteUnreachable();
+  while (!retired_.empty()) {
+    mu_.Unlock();
+    std::this_thread::yield();
+    mu_.Lock();
+    DeleteUnreachable();
+  }
+  mu_.Unlock();
+}
+
+void EpochLimbo::DeleteUnreachable() {
+  epoch_.TryAdvance();
+  epoch_.TryAdvance();
+  const uint64_t safe = epoch_.SafeBefore();
+  size_t kept = 0;
+  for (size_t i = 0; i < retired_.size(); i++) {
+    if (retired_[i].epoch < safe) {
+      (*retired_[i].deleter)(retired_[i].object);
+    } else {
+      retired_[kept++] = retired_[i];
+    }
+  }
+  retired_.resize(kept);
+}
+
+}  // namespace leveldb
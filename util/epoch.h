@@ -0,0 +1,108 @@
+// Add by MioDB
+// Epoch based reclamation.  Readers pin the current epoch while they hold
+// pointers into a shared structure.  Memory a writer unlinks from it during
+// epoch e may still be reached by them, so it is only reused once the epoch
+// has moved on twice, which it cannot do while a reader of e is left.
+
+#ifndef STORAGE_LEVELDB_UTIL_EPOCH_H_
+#define STORAGE_LEVELDB_UTIL_EPOCH_H_
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "port/port.h"
+#include "port/thread_annotations.h"
+
+namespace leveldb {
+
+class Epoch {
+ public:
+  Epoch();
+
+  Epoch(const Epoch&) = delete;
+  Epoch& operator=(const Epoch&) = delete;
+
+  // Pin the current epoch.  Never blocks.  Pass the result to Exit().
+  uint64_t Enter();
+  void Exit(uint64_t token);
+
+  // The epoch that memory unlinked now is retired in
+  uint64_t Current() const { return epoch_.load(std::memory_order_seq_cst); }
+
+  // Move to the next epoch unless a reader that pinned the one before the
+  // current one is left.  Returns the current epoch.
+  uint64_t TryAdvance();
+
+  // Memory retired in an epoch before this one is out of reach of readers
+  uint64_t SafeBefore() const { return Current() - 1; }
+
+  // Pins the epoch for the scope of the guard
+  class Guard {
+   public:
+    explicit Guard(Epoch* epoch)
+        : epoch_(epoch), token_(epoch == nullptr ? 0 : epoch->Enter()) {}
+    ~Guard() {
+      if (epoch_ != nullptr) epoch_->Exit(token_);
+    }
+
+    Guard(const Guard&) = delete;
+    Guard& operator=(const Guard&) = delete;
+
+   private:
+    Epoch* const epoch_;
+    const uint64_t token_;
+  };
+
+ private:
+  // Readers count themselves on a slot picked by their thread, apart
+  // for even and odd epochs.  Only two epochs can have readers at once.
+  static const int kSlots = 32;
+  struct alignas(64) Slot {
+    std::atomic<int64_t> readers[2];
+  };
+
+  std::atomic<uint64_t> epoch_;
+  Slot slots_[kSlots];
+};
+
+// Objects unlinked from a shared structure whose readers pin epoch().
+// Each is deleted once the readers that could still reach it are gone.
+class EpochLimbo {
+ public:
+  EpochLimbo() = default;
+  ~EpochLimbo();  // Deletes everything retired, REQUIRES: no readers left
+
+  EpochLimbo(const EpochLimbo&) = delete;
+  EpochLimbo& operator=(const EpochLimbo&) = delete;
+
+  Epoch* epoch() { return &epoch_; }
+
+  // Delete "object" after the readers of the current epoch, and free what
+  // earlier calls retired if their readers have left.
+  template <typename T>
+  void Retire(T* object) {
+    Retire(object, [](void* p) { delete static_cast<T*>(p); });
+  }
+
+  // Delete everything retired so far, waiting for its readers to leave
+  void Drain();
+
+ private:
+  struct Retired {
+    uint64_t epoch;
+    void* object;
+    void (*deleter)(void*);
+  };
+
+  void Retire(void* object, void (*deleter)(void*));
+  void DeleteUnreachable() EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  Epoch epoch_;
+  port::Mutex mu_;
+  std::vector<Retired> retired_ GUARDED_BY(mu_);
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_UTIL_EPOCH_H_
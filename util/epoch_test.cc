@@ -0,0 +1,153 @@
+// Add by MioDB
+
+#include "util/epoch.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "util/arena.h"
+#include "util/slab_allocator.h"
+
+namespace leveldb {
+
+TEST(EpochTest, AdvanceWaitsForReaders) {
+  Epoch epoch;
+  const uint64_t start = epoch.Current();
+  const uint64_t token = epoch.Enter();
+  // The reader is in the current epoch, the next one can still begin
+  ASSERT_EQ(start + 1, epoch.TryAdvance());
+  ASSERT_EQ(start + 1, epoch.TryAdvance());
+  ASSERT_EQ(start + 1, epoch.TryAdvance());
+  epoch.Exit(token);
+  ASSERT_EQ(start + 2, epoch.TryAdvance());
+  ASSERT_EQ(start + 3, epoch.TryAdvance());
+}
+
+TEST(EpochTest, SlabReuseWaitsForReaders) {
+  Arena arena(1 << 20, false);
+  Epoch epoch;
+  SlabAllocator slab(&arena, &epoch);
+  char* p = slab.Allocate(100);
+  {
+    Epoch::Guard guard(&epoch);
+    slab.Retire(p, 100);
+    for (int i = 0; i < 3; i++) {
+      slab.Reclaim();
+    }
+    ASSERT_EQ(100, slab.RetiredBytes());
+    ASSERT_NE(p, slab.Allocate(100));
+  }
+  slab.Reclaim();
+  ASSERT_EQ(0, slab.RetiredBytes());
+  ASSERT_EQ(p, slab.Allocate(100));
+}
+
+TEST(EpochTest, LimboWaitsForReaders) {
+  struct Object {
+    explicit Object(int* deleted) : deleted(deleted) {}
+    ~Object() { (*deleted)++; }
+    int* deleted;
+  };
+  int deleted = 0;
+  {
+    EpochLimbo limbo;
+    {
+      Epoch::Guard guard(limbo.epoch());
+      limbo.Retire(new Object(&deleted));
+      limbo.Retire(new Object(&deleted));
+      ASSERT_EQ(0, deleted);
+    }
+    // Nobody can reach any of them any more
+    limbo.Retire(new Object(&deleted));
+    ASSERT_EQ(3, deleted);
+    Epoch::Guard guard(limbo.epoch());
+    limbo.Retire(new Object(&deleted));
+  }
+  ASSERT_EQ(4, deleted);
+}
+
+TEST(EpochTest, DrainWaitsForReaders) {
+  struct Object {
+    explicit Object(std::atomic<int>* deleted) : deleted(deleted) {}
+    ~Object() { deleted->fetch_add(1); }
+    std::atomic<int>* deleted;
+  };
+  std::atomic<int> deleted(0);
+  EpochLimbo limbo;
+  std::atomic<bool> pinned(false);
+  std::thread reader([&]() {
+    Epoch::Guard guard(limbo.epoch());
+    limbo.Retire(new Object(&deleted));
+    limbo.Retire(new Object(&deleted));
+    pinned.store(true);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    ASSERT_EQ(0, deleted.load());
+  });
+  while (!pinned.load()) std::this_thread::yield();
+  limbo.Drain();
+  ASSERT_EQ(2, deleted.load());
+  reader.join();
+}
+
+// Readers check that the object they reached is not reused under them
+TEST(EpochTest, Concurrent) {
+  struct Object {
+    uint64_t first;  // Overwritten by the free list link
+    uint64_t generation[8];
+  };
+  Arena arena(1 << 20, false);
+  Epoch epoch;
+  SlabAllocator slab(&arena, &epoch);
+  std::atomic<Object*> current(nullptr);
+  std::atomic<bool> stop(false);
+  std::atomic<int> bad(0);
+
+  auto publish = [&](uint64_t generation) {
+    Object* o = reinterpret_cast<Object*>(slab.Allocate(sizeof(Object)));
+    o->first = generation;
+    for (uint64_t& g : o->generation) g = generation;
+    return current.exchange(o, std::memory_order_acq_rel);
+  };
+  publish(1);
+
+  std::vector<std::thread> readers;
+  for (int t = 0; t < 4; t++) {
+    readers.emplace_back([&] {
+      while (!stop.load(std::memory_order_acquire)) {
+        Epoch::Guard guard(&epoch);
+        Object* o = current.load(std::memory_order_acquire);
+        const uint64_t generation = o->generation[0];
+        for (int i = 0; i < 100; i++) {
+          if (o->first != generation || o->generation[i % 8] != generation) {
+            bad++;
+            break;
+          }
+        }
+      }
+    });
+  }
+  for (uint64_t generation = 2; generation < 200000; generation++) {
+    Object* old = publish(generation);
+    slab.Retire(reinterpret_cast<char*>(old), sizeof(Object));
+    slab.Reclaim();
+  }
+  stop.store(true, std::memory_order_release);
+  for (std::thread& t : readers) {
+    t.join();
+  }
+  ASSERT_EQ(0, bad.load());
+  // The last objects may still wait for readers that left since
+  slab.Reclaim();
+  ASSERT_GT(slab.FreeBytes(), 0);
+}
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -3,44 +3,243 @@
 
 #include "util/mergeablebloom.h"
 
+#include <cassert>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+
+#include "db/global.h"
+#include "util/coding.h"
+
 namespace leveldb {
 
-MergeableBloom::MergeableBloom(const Options& options_): bits_per_key_(options_.bits_per_key) {    // n = highest level DataTable size / KV size, it should be a constant in miodb
-  int n = options_.keys_per_datatable;
+namespace {
+
+const size_t kBlockSize = 64;
+
+// A persisted filter ends with kBlockedMagic, k_ and num_keys_.  Its
+// number of blocks follows from its size.
+const uint32_t kBlockedMagic = 0x424c4b32;
+const size_t kTrailerSize = 16;
+
+size_t MaxKeys(const Options& options) {
+  return options.keys_per_datatable > 0 ? options.keys_per_datatable : 1;
+}
 
-  size_t bits = n * bits_per_key_;
-  if (bits < 64) bits = 64;
-  result_size_ = (bits + 7) / 8;
+// Power of two number of blocks holding "keys" keys at "bits_per_key"
+size_t BlocksFor(size_t keys, double bits_per_key) {
+  const double bits = static_cast<double>(keys) * bits_per_key;
+  size_t n = 1;
+  while (n * kBlockSize * 8 < bits) {
+    n <<= 1;
+  }
+  return n;
+}
 
+size_t ProbesFor(double bits_per_key) {
   // We intentionally round down to reduce probing cost a little bit
-  k_ = static_cast<size_t>(bits_per_key_ * 0.69);  // 0.69 =~ ln(2)
-  if (k_ < 1) k_ = 1;
-  if (k_ > 30) k_ = 30;
+  size_t k = static_cast<size_t>(bits_per_key * 0.69);  // 0.69 =~ ln(2)
+  if (k < 1) k = 1;
+  if (k > 30) k = 30;
+  return k;
+}
+
+// The j-th probe of a key with hash h tests bit (h * kProbeMul^(j+1)) >> 23
+// of its block.  The multiplier is odd, so every power of it is too.
+constexpr uint32_t kProbeMul = 0x9e3779b9;
 
+constexpr uint32_t ProbeMul(int n) {
+  return n == 0 ? 1 : kProbeMul * ProbeMul(n - 1);
+}
+
+bool ProbeBlock(const uint32_t* block, uint32_t h, size_t k) {
+  for (size_t j = 0; j < k; j++) {
+    h *= kProbeMul;
+    const uint32_t bit = h >> 23;
+    if ((block[bit >> 5] & (1u << (bit & 31))) == 0) return false;
+  }
+  return true;
+}
+
+#if defined(__x86_64__)
+
+// ProbeBlock() eight probes at a time.  The block is held in two
+// registers, every lane picks its word from both and keeps the one of the
+// half that the word index points at.
+__attribute__((target("avx2"))) bool ProbeBlockAvx2(const uint32_t* block,
+                                                    uint32_t h, size_t k) {
+  const __m256i lo =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block));
+  const __m256i hi =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + 8));
+  const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  __m256i x = _mm256_mullo_epi32(
+      _mm256_set1_epi32(static_cast<int>(h)),
+      _mm256_setr_epi32(static_cast<int>(ProbeMul(1)),
+                        static_cast<int>(ProbeMul(2)),
+                        static_cast<int>(ProbeMul(3)),
+                        static_cast<int>(ProbeMul(4)),
+                        static_cast<int>(ProbeMul(5)),
+                        static_cast<int>(ProbeMul(6)),
+                        static_cast<int>(ProbeMul(7)),
+                        static_cast<int>(ProbeMul(8))));
+  for (size_t j = 0; j < k; j += 8) {
+    const __m256i bit = _mm256_srli_epi32(x, 23);
+    const __m256i word = _mm256_srli_epi32(bit, 5);
+    const __m256i words = _mm256_castps_si256(_mm256_blendv_ps(
+        _mm256_castsi256_ps(_mm256_permutevar8x32_epi32(lo, word)),
+        _mm256_castsi256_ps(_mm256_permutevar8x32_epi32(hi, word)),
+        _mm256_castsi256_ps(_mm256_slli_epi32(word, 28))));
+    __m256i mask = _mm256_sllv_epi32(
+        _mm256_set1_epi32(1), _mm256_and_si256(bit, _mm256_set1_epi32(31)));
+    if (k - j < 8) {
+      mask = _mm256_and_si256(
+          mask, _mm256_cmpgt_epi32(_mm256_set1_epi32(static_cast<int>(k - j)),
+                                   lanes));
+    }
+    if (!_mm256_testc_si256(words, mask)) return false;
+    x = _mm256_mullo_epi32(x,
+                           _mm256_set1_epi32(static_cast<int>(ProbeMul(8))));
+  }
+  return true;
+}
+
+#endif  // defined(__x86_64__)
+
+typedef bool (*ProbeFunction)(const uint32_t*, uint32_t, size_t);
+
+ProbeFunction ChooseProbe() {
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) return &ProbeBlockAvx2;
+#endif
+  return &ProbeBlock;
+}
+
+}  // namespace
+
+MergeableBloom::MergeableBloom(const Options& options_, size_t keys,
+                               double bits_per_key)
+    : MergeableBloom(options_,
+                     BlocksFor(std::min(keys, MaxKeys(options_)), bits_per_key),
+                     ProbesFor(bits_per_key), keys) {}
+
+MergeableBloom::MergeableBloom(const Options& options_, size_t num_blocks,
+                               size_t k, size_t keys)
+    : max_keys_(MaxKeys(options_)),
+      k_(k),
+      num_keys_(keys),
+      num_blocks_(num_blocks),
+      result_size_(num_blocks * kBlockSize),
+      persisted_(nullptr) {
   result_ = (char*)numa_alloc_onnode(result_size_, options_.dram_node);
 }
 
 MergeableBloom::~MergeableBloom() {
   numa_free(result_, result_size_);
+  if (persisted_ != nullptr) {
+    nvm_pool->Free(persisted_, result_size_ + kTrailerSize);
+  }
 }
 
-void MergeableBloom::AddKey(Slice& key) {
-  Slice k = key;
-  start_.push_back(keys_.size());
-  keys_.append(k.data(), k.size());
+void MergeableBloom::AddKey(const Slice& key) { AddHash(BloomHash(key)); }
+
+void MergeableBloom::AddKeyConcurrently(const Slice& key) {
+  AddHashConcurrently(BloomHash(key));
+}
+
+void MergeableBloom::AddHash(uint32_t hash) {
+  uint32_t* block = Block(hash);
+  uint32_t h = hash;
+  for (size_t j = 0; j < k_; j++) {
+    h *= kProbeMul;
+    const uint32_t bit = h >> 23;
+    block[bit >> 5] |= 1u << (bit & 31);
+  }
 }
 
-void MergeableBloom::Finish() {
-  if (!start_.empty()) {
-    GenerateFilter();
+void MergeableBloom::AddHashConcurrently(uint32_t hash) {
+  // Gather the bits word by word, so that a word takes one atomic OR at
+  // most, none if its bits are set already
+  uint32_t masks[kBlockSize / 4] = {0};
+  uint32_t h = hash;
+  for (size_t j = 0; j < k_; j++) {
+    h *= kProbeMul;
+    const uint32_t bit = h >> 23;
+    masks[bit >> 5] |= 1u << (bit & 31);
+  }
+  uint32_t* block = Block(hash);
+  for (size_t w = 0; w < kBlockSize / 4; w++) {
+    if (masks[w] != 0 &&
+        (__atomic_load_n(&block[w], __ATOMIC_RELAXED) & masks[w]) != masks[w]) {
+      __atomic_fetch_or(&block[w], masks[w], __ATOMIC_RELAXED);
+    }
   }
 }
 
 void MergeableBloom::Merge(MergeableBloom* bloom) {
+  assert(bloom->k_ >= k_);
   const char* c = bloom->GetResult();
-  for (int i = 0; i < result_size_; i++) {
-    result_[i] |= c[i];
+  if (bloom->num_blocks_ <= num_blocks_) {
+    // Unfold: block b of "bloom" covers our blocks [b*r, (b+1)*r)
+    const size_t r = num_blocks_ / bloom->num_blocks_;
+    for (size_t i = 0; i < num_blocks_; i++) {
+      char* dst = result_ + i * kBlockSize;
+      const char* src = c + (i / r) * kBlockSize;
+      for (size_t j = 0; j < kBlockSize; j++) {
+        dst[j] |= src[j];
+      }
+    }
+  } else {
+    // Fold: r blocks of "bloom" land in one of ours
+    const size_t r = bloom->num_blocks_ / num_blocks_;
+    for (size_t i = 0; i < bloom->num_blocks_; i++) {
+      char* dst = result_ + (i / r) * kBlockSize;
+      const char* src = c + i * kBlockSize;
+      for (size_t j = 0; j < kBlockSize; j++) {
+        dst[j] |= src[j];
+      }
+    }
+  }
+  num_keys_ += bloom->num_keys_;
+}
+
+bool MergeableBloom::CanAbsorb(const MergeableBloom* bloom,
+                               double bits_per_key) const {
+  if (bloom->k_ < k_) {
+    return false;
   }
+  const size_t keys = std::min(num_keys_ + bloom->num_keys_, max_keys_);
+  return num_blocks_ >= BlocksFor(keys, bits_per_key);
+}
+
+MergeableBloom* MergeableBloom::Union(const Options& options_,
+                                      double bits_per_key, MergeableBloom* a,
+                                      MergeableBloom* b) {
+  const size_t keys = std::min(a->num_keys_ + b->num_keys_, MaxKeys(options_));
+  // Bits set by fewer probes than ours would not be found
+  const size_t k = std::min({ProbesFor(bits_per_key), a->k_, b->k_});
+  MergeableBloom* bloom = new MergeableBloom(
+      options_, BlocksFor(keys, bits_per_key), k, 0);
+  bloom->Merge(a);
+  bloom->Merge(b);
+  return bloom;
+}
+
+MergeableBloom* MergeableBloom::Resize(const Options& options_,
+                                       double bits_per_key,
+                                       MergeableBloom* bloom, size_t keys) {
+  const size_t k = std::min(ProbesFor(bits_per_key), bloom->k_);
+  MergeableBloom* resized = new MergeableBloom(
+      options_, BlocksFor(std::min(keys, MaxKeys(options_)), bits_per_key), k,
+      0);
+  resized->Merge(bloom);
+  resized->num_keys_ = keys;
+  return resized;
 }
 
 const char* MergeableBloom::GetResult() {
@@ -48,57 +247,68 @@ const char* MergeableBloom::GetResult() {
 }
 
 bool MergeableBloom::KeyMayMatch(Slice& key) {
-  if (result_size_ < 2) return false;
+  return KeyMayMatch(BloomHash(key));
+}
 
-  const size_t bits = result_size_ * 8;
+bool MergeableBloom::KeyMayMatch(uint32_t hash) const {
+  static const ProbeFunction probe = ChooseProbe();
+  return (*probe)(Block(hash), hash, k_);
+}
 
-  uint32_t h = BloomHash(key);
-  const uint32_t delta = (h >> 17) | (h << 15);  // Rotate right 17 bits
-  for (size_t j = 0; j < k_; j++) {
-    const uint32_t bitpos = h % bits;
-    if ((result_[bitpos / 8] & (1 << (bitpos % 8))) == 0) return false;
-    h += delta;
-  }
-  return true;
+void MergeableBloom::Prefetch(uint32_t hash) const {
+  __builtin_prefetch(Block(hash));
 }
 
-void MergeableBloom::GenerateFilter() {
-  const size_t num_keys = start_.size();
-  if (num_keys == 0) {
-    return;
-  }
+uint32_t* MergeableBloom::Block(uint32_t hash) const {
+  const size_t i = (static_cast<uint64_t>(hash) * num_blocks_) >> 32;
+  return reinterpret_cast<uint32_t*>(result_ + i * kBlockSize);
+}
 
-  // Make list of keys from flattened key structure
-  start_.push_back(keys_.size());  // Simplify length computation
-  tmp_keys_.resize(num_keys);
-  for (size_t i = 0; i < num_keys; i++) {
-    const char* base = keys_.data() + start_[i];
-    size_t length = start_[i + 1] - start_[i];
-    tmp_keys_[i] = Slice(base, length);
+MergeableBloom* MergeableBloom::Load(const Options& options_,
+                                     const NvmRegion& region) {
+  if (region.size <= kTrailerSize) {
+    return nullptr;
   }
+  const size_t size = region.size - kTrailerSize;
+  const size_t num_blocks = size / kBlockSize;
+  if (size % kBlockSize != 0 || (num_blocks & (num_blocks - 1)) != 0) {
+    return nullptr;
+  }
+  char* persisted = nvm_pool->Reserve(region);
+  if (persisted == nullptr) {
+    return nullptr;
+  }
+  const uint32_t k = DecodeFixed32(persisted + size + 4);
+  if (DecodeFixed32(persisted + size) != kBlockedMagic || k < 1 || k > 30) {
+    nvm_pool->Free(persisted, region.size);
+    return nullptr;
+  }
+  MergeableBloom* bloom = new MergeableBloom(
+      options_, num_blocks, k, DecodeFixed64(persisted + size + 8));
+  bloom->persisted_ = persisted;
+  memcpy(bloom->result_, persisted, size);
+  return bloom;
+}
 
-  // Generate filter for current set of keys and append to result_.
-  CreateFilter(&tmp_keys_[0], static_cast<int>(num_keys));
-  
-  tmp_keys_.clear();
-  keys_.clear();
-  start_.clear();
-}
-
-void MergeableBloom::CreateFilter(const Slice* keys, int n) {
-  size_t bits = result_size_ * 8;
-
-  for (int i = 0; i < n; i++) {
-    // Use double-hashing to generate a sequence of hash values.
-    // See analysis in [Kirsch,Mitzenmacher 2006].
-    uint32_t h = BloomHash(keys[i]);
-    const uint32_t delta = (h >> 17) | (h << 15);  // Rotate right 17 bits
-    for (size_t j = 0; j < k_; j++) {
-      const uint32_t bitpos = h % bits;
-      result_[bitpos / 8] |= (1 << (bitpos % 8));
-      h += delta;
+void MergeableBloom::Persist() {
+  if (persisted_ == nullptr) {
+    persisted_ = nvm_pool->Allocate(result_size_ + kTrailerSize);
+    if (persisted_ == nullptr) {
+      return;  // pool is full, the filter is rebuilt when the DB is reopened
     }
+    EncodeFixed32(persisted_ + result_size_, kBlockedMagic);
+    EncodeFixed32(persisted_ + result_size_ + 4, static_cast<uint32_t>(k_));
+  }
+  memcpy(persisted_, result_, result_size_);
+  EncodeFixed64(persisted_ + result_size_ + 8, num_keys_);
+  nvm_pool->Sync(persisted_, result_size_ + kTrailerSize);
+}
+
+NvmRegion MergeableBloom::PersistedRegion() const {
+  if (persisted_ == nullptr) {
+    return NvmRegion();
   }
+  return NvmRegion(nvm_pool->Offset(persisted_), result_size_ + kTrailerSize);
 }
 
 uint32_t MergeableBloom::BloomHash(const Slice& key) {
@@ -1,44 +1,90 @@
 // Add by MioDB
 // Mergeable bloom filters can accelerate datatables' query requests
 
-#include <string>
-#include <vector>
 #include "leveldb/slice.h"
 #include "leveldb/options.h"
 #include "numa.h"
 #include "util/hash.h"
+#include "util/nvm_pool.h"
 
 #ifndef STORAGE_LEVELDB_DB_MERGEABLE_BLOOM_H_
 #define STORAGE_LEVELDB_DB_MERGEABLE_BLOOM_H_
 
 namespace leveldb{
 
+// Every key sets k_ bits of one 64 byte block, so that a probe reads a
+// single cache line.  The number of blocks is a power of two and a key's
+// block is picked by the top bits of its hash, so a filter merges into
+// one of another size: block b of the smaller one covers the same keys
+// as r consecutive blocks of one r times larger.
 class MergeableBloom {
  public:
-  explicit MergeableBloom(const Options& options_);
+  // A filter for "keys" keys at "bits_per_key" bits each, never larger
+  // than one for options_.keys_per_datatable keys
+  MergeableBloom(const Options& options_, size_t keys, double bits_per_key);
   MergeableBloom(const MergeableBloom&) = delete;
   MergeableBloom& operator=(const MergeableBloom&) = delete;
 
   ~MergeableBloom();
 
-  void AddKey(Slice& key);
-  void Finish();
+  void AddKey(const Slice& key);
+  // AddKey() that is safe to call from several threads at once
+  void AddKeyConcurrently(const Slice& key);
+  // AddKey() and AddKeyConcurrently() for a key whose BloomHash() is "hash"
+  void AddHash(uint32_t hash);
+  void AddHashConcurrently(uint32_t hash);
+  // OR the keys of "bloom" into this filter.
+  // REQUIRES: bloom->NumProbes() >= NumProbes()
   void Merge(MergeableBloom* bloom);
+  // Whether Merge(bloom) keeps at least "bits_per_key" bits for every key
+  // of both filters, or this one is as large as options allow already
+  bool CanAbsorb(const MergeableBloom* bloom, double bits_per_key) const;
+  // A new filter sized for the keys of "a" and "b" holding both
+  static MergeableBloom* Union(const Options& options_, double bits_per_key,
+                               MergeableBloom* a, MergeableBloom* b);
+  // A new filter sized for "keys" keys holding those of "bloom", which
+  // has that many but may have been sized for more or fewer
+  static MergeableBloom* Resize(const Options& options_, double bits_per_key,
+                                MergeableBloom* bloom, size_t keys);
   const char* GetResult();
   bool KeyMayMatch(Slice& key);
+  // KeyMayMatch() for a key whose BloomHash() is "hash"
+  bool KeyMayMatch(uint32_t hash) const;
+  // Start loading the bits that KeyMayMatch(hash) tests
+  void Prefetch(uint32_t hash) const;
+
+  // Keys the filter was sized for plus those merged into it
+  size_t NumKeys() const { return num_keys_; }
+  size_t NumProbes() const { return k_; }
+  size_t ByteSize() const { return result_size_; }
+
+  static uint32_t BloomHash(const Slice& key);
+
+  // Load the filter persisted in "region" of the nvm pool.  Returns
+  // nullptr if there is none.
+  static MergeableBloom* Load(const Options& options_,
+                              const NvmRegion& region);
+
+  // Copy the filter to the nvm pool so that it survives a restart.
+  void Persist();
+
+  // Region of the nvm pool holding the persisted filter, size 0 if none.
+  NvmRegion PersistedRegion() const;
   
  private:
-  void GenerateFilter();
-  void CreateFilter(const Slice* keys, int n);
-  uint32_t BloomHash(const Slice& key);
+  MergeableBloom(const Options& options_, size_t num_blocks, size_t k,
+                 size_t keys);
+
+  // The block of the key with BloomHash() "hash"
+  uint32_t* Block(uint32_t hash) const;
 
-  size_t bits_per_key_;
+  size_t max_keys_;   // options_.keys_per_datatable
   size_t k_;
-  std::string keys_;             // Flattened key contents
-  std::vector<size_t> start_;    // Starting index in keys_ of each key
+  size_t num_keys_;
+  size_t num_blocks_;
   size_t result_size_;
   char* result_;           // Filter data computed so far
-  std::vector<Slice> tmp_keys_;
+  char* persisted_;        // Copy of result_ in the nvm pool, or nullptr
 };
 
 }   // namespace leveldb
@@ -0,0 +1,174 @@
+// Add by MioDB
+
+#include "util/mergeablebloom.h"
+
+#include <cstring>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "util/coding.h"
+
+namespace leveldb {
+
+static const int kKeys = 10000;
+static const double kBitsPerKey = 16;
+
+class MergeableBloomTest : public testing::Test {
+ public:
+  MergeableBloomTest() { options_.keys_per_datatable = kKeys; }
+
+  static std::string Key(int i) {
+    char buf[4];
+    EncodeFixed32(buf, i);
+    return std::string(buf, sizeof(buf));
+  }
+
+  static bool Matches(MergeableBloom* bloom, int i) {
+    std::string key = Key(i);
+    Slice s(key);
+    return bloom->KeyMayMatch(s);
+  }
+
+  // Add the keys in [begin, end) to *bloom
+  static void AddKeys(MergeableBloom* bloom, int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      std::string key = Key(i);
+      bloom->AddKeyConcurrently(key);
+    }
+  }
+
+  // Share of the keys in [kKeys, 2 * kKeys) that the filter lets through
+  static double FalsePositiveRate(MergeableBloom* bloom) {
+    int matches = 0;
+    for (int i = kKeys; i < 2 * kKeys; i++) {
+      if (Matches(bloom, i)) matches++;
+    }
+    return matches / static_cast<double>(kKeys);
+  }
+
+  Options options_;
+};
+
+TEST_F(MergeableBloomTest, EmptyFilter) {
+  MergeableBloom bloom(options_, kKeys, kBitsPerKey);
+  ASSERT_EQ(0, FalsePositiveRate(&bloom));
+}
+
+TEST_F(MergeableBloomTest, AddedKeysMatch) {
+  MergeableBloom bloom(options_, kKeys, kBitsPerKey);
+  MergeableBloom concurrent(options_, kKeys, kBitsPerKey);
+  for (int i = 0; i < kKeys; i++) {
+    std::string key = Key(i);
+    Slice s(key);
+    bloom.AddKey(s);
+    concurrent.AddKeyConcurrently(s);
+  }
+  for (int i = 0; i < kKeys; i++) {
+    ASSERT_TRUE(Matches(&bloom, i)) << i;
+    ASSERT_TRUE(Matches(&concurrent, i)) << i;
+    std::string key = Key(i);
+    ASSERT_TRUE(bloom.KeyMayMatch(MergeableBloom::BloomHash(key)));
+  }
+  ASSERT_LT(FalsePositiveRate(&bloom), 0.01);
+  ASSERT_EQ(0, memcmp(bloom.GetResult(), concurrent.GetResult(),
+                      bloom.ByteSize()));
+}
+
+TEST_F(MergeableBloomTest, MergeKeepsBothSets) {
+  MergeableBloom even(options_, kKeys, kBitsPerKey);
+  MergeableBloom odd(options_, kKeys, kBitsPerKey);
+  for (int i = 0; i < kKeys; i++) {
+    std::string key = Key(i);
+    Slice s(key);
+    (i % 2 == 0 ? even : odd).AddKeyConcurrently(s);
+  }
+  even.Merge(&odd);
+  for (int i = 0; i < kKeys; i++) {
+    ASSERT_TRUE(Matches(&even, i)) << i;
+  }
+  ASSERT_LT(FalsePositiveRate(&even), 0.01);
+}
+
+TEST_F(MergeableBloomTest, SizedForKeys) {
+  MergeableBloom small(options_, kKeys / 16, kBitsPerKey);
+  MergeableBloom full(options_, kKeys, kBitsPerKey);
+  MergeableBloom capped(options_, 16 * kKeys, kBitsPerKey);
+  ASSERT_LE(16 * small.ByteSize(), full.ByteSize());
+  ASSERT_GE(8 * full.ByteSize(), kKeys * kBitsPerKey);
+  ASSERT_EQ(full.ByteSize(), capped.ByteSize());
+
+  // Fewer bits per key give fewer probes
+  MergeableBloom sparse(options_, kKeys, kBitsPerKey / 2);
+  ASSERT_LT(sparse.ByteSize(), full.ByteSize());
+  ASSERT_LT(sparse.NumProbes(), full.NumProbes());
+}
+
+TEST_F(MergeableBloomTest, UnfoldIntoLarger) {
+  MergeableBloom small(options_, kKeys / 8, kBitsPerKey);
+  MergeableBloom large(options_, kKeys, kBitsPerKey);
+  AddKeys(&small, 0, kKeys / 8);
+  AddKeys(&large, kKeys / 8, kKeys);
+  large.Merge(&small);
+  ASSERT_EQ(kKeys / 8 + kKeys, large.NumKeys());
+  for (int i = 0; i < kKeys; i++) {
+    ASSERT_TRUE(Matches(&large, i)) << i;
+  }
+  ASSERT_LT(FalsePositiveRate(&large), 0.01);
+}
+
+TEST_F(MergeableBloomTest, FoldIntoSmaller) {
+  MergeableBloom small(options_, kKeys / 4, kBitsPerKey);
+  MergeableBloom large(options_, kKeys, kBitsPerKey);
+  AddKeys(&large, 0, kKeys / 4);
+  small.Merge(&large);
+  for (int i = 0; i < kKeys / 4; i++) {
+    ASSERT_TRUE(Matches(&small, i)) << i;
+  }
+  ASSERT_LT(FalsePositiveRate(&small), 0.01);
+}
+
+// A filter filled before its keys were counted folds into the one that
+// would have been built for them
+TEST_F(MergeableBloomTest, ResizeToKeys) {
+  MergeableBloom oversized(options_, 16 * kKeys, kBitsPerKey);
+  MergeableBloom direct(options_, kKeys / 4, kBitsPerKey);
+  AddKeys(&oversized, 0, kKeys / 4);
+  AddKeys(&direct, 0, kKeys / 4);
+  MergeableBloom* resized =
+      MergeableBloom::Resize(options_, kBitsPerKey, &oversized, kKeys / 4);
+  ASSERT_EQ(kKeys / 4, resized->NumKeys());
+  ASSERT_EQ(direct.ByteSize(), resized->ByteSize());
+  ASSERT_EQ(0, memcmp(direct.GetResult(), resized->GetResult(),
+                      direct.ByteSize()));
+  delete resized;
+}
+
+TEST_F(MergeableBloomTest, UnionGrows) {
+  MergeableBloom a(options_, kKeys / 2, kBitsPerKey);
+  MergeableBloom b(options_, kKeys / 2, kBitsPerKey);
+  AddKeys(&a, 0, kKeys / 2);
+  AddKeys(&b, kKeys / 2, kKeys);
+  ASSERT_FALSE(a.CanAbsorb(&b, kBitsPerKey));
+  ASSERT_TRUE(a.CanAbsorb(&b, kBitsPerKey / 2));
+
+  MergeableBloom* both = MergeableBloom::Union(options_, kBitsPerKey, &a, &b);
+  ASSERT_EQ(kKeys, both->NumKeys());
+  ASSERT_GT(both->ByteSize(), a.ByteSize());
+  for (int i = 0; i < kKeys; i++) {
+    ASSERT_TRUE(Matches(both, i)) << i;
+  }
+  ASSERT_LT(FalsePositiveRate(both), 0.01);
+
+  // A filter with fewer probes cannot take the bits of one with more
+  MergeableBloom sparse(options_, kKeys, kBitsPerKey / 2);
+  ASSERT_FALSE(both->CanAbsorb(&sparse, kBitsPerKey / 2));
+  ASSERT_TRUE(sparse.CanAbsorb(both, kBitsPerKey / 2));
+  delete both;
+}
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
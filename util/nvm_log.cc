@@ -0,0 +1,219 @@
+// Add by MioDB
+// NvmLogFile appends log records to a memory-mapped file on NVM
+
+#include "util/nvm_log.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+namespace leveldb {
+
+namespace {
+
+const size_t kCacheLineSize = 64;
+const size_t kPageSize = 4096;
+
+Status LogError(const std::string& fname, int error_number) {
+  return Status::IOError(fname, std::strerror(error_number));
+}
+
+// Map "size" bytes of "fd".  Prefers a synchronous mapping, which the
+// kernel only grants on a DAX file system, and reports in *dax whether
+// it got one.
+char* MapLog(int fd, size_t size, bool* dax) {
+  void* p;
+#if defined(MAP_SYNC) && defined(MAP_SHARED_VALIDATE)
+  p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+             MAP_SHARED_VALIDATE | MAP_SYNC | MAP_POPULATE, fd, 0);
+  if (p != MAP_FAILED) {
+    *dax = true;
+    return reinterpret_cast<char*>(p);
+  }
+#endif
+  *dax = false;
+  p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+             fd, 0);
+  return p == MAP_FAILED ? nullptr : reinterpret_cast<char*>(p);
+}
+
+// Make sure the file has "size" bytes of allocated, zeroed space.
+int Preallocate(int fd, size_t size) {
+  int error = ::posix_fallocate(fd, 0, size);
+  if (error == EINVAL || error == EOPNOTSUPP) {
+    error = ::ftruncate(fd, size) == 0 ? 0 : errno;
+  }
+  return error;
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("clwb"))) void WriteBackClwb(const char* p,
+                                                   const char* limit) {
+  for (; p < limit; p += kCacheLineSize) {
+    _mm_clwb(const_cast<char*>(p));
+  }
+}
+
+__attribute__((target("clflushopt"))) void WriteBackClflushopt(
+    const char* p, const char* limit) {
+  for (; p < limit; p += kCacheLineSize) {
+    _mm_clflushopt(const_cast<char*>(p));
+  }
+}
+
+void WriteBackClflush(const char* p, const char* limit) {
+  for (; p < limit; p += kCacheLineSize) {
+    _mm_clflush(p);
+  }
+}
+
+typedef void (*WriteBackFunction)(const char*, const char*);
+
+// clwb keeps the line cached, clflushopt at least does not serialize
+// like clflush does.  Pick the best one this CPU has.
+WriteBackFunction ChooseWriteBack() {
+  unsigned int eax, ebx, ecx, edx;
+  if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+    if (ebx & (1u << 24)) return &WriteBackClwb;
+    if (ebx & (1u << 23)) return &WriteBackClflushopt;
+  }
+  return &WriteBackClflush;
+}
+
+#endif  // defined(__x86_64__)
+
+}  // namespace
+
+NvmLogFile::NvmLogFile(const std::string& fname, int fd, char* base,
+                       size_t capacity, bool dax)
+    : fname_(fname),
+      fd_(fd),
+      base_(base),
+      capacity_(capacity),
+      pos_(0),
+      synced_(0),
+      dax_(dax) {
+#if !defined(__x86_64__)
+  dax_ = false;  // No cache line write back, use msync()
+#endif
+}
+
+NvmLogFile::~NvmLogFile() {
+  if (fd_ >= 0) {
+    // Ignoring any potential errors
+    Close();
+  }
+}
+
+Status NvmLogFile::Open(const std::string& fname, size_t capacity,
+                        WritableFile** result) {
+  *result = nullptr;
+  capacity = (capacity + kPageSize - 1) / kPageSize * kPageSize;
+  int fd = ::open(fname.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return LogError(fname, errno);
+  }
+  int error = Preallocate(fd, capacity);
+  if (error != 0) {
+    ::close(fd);
+    return LogError(fname, error);
+  }
+  bool dax;
+  char* base = MapLog(fd, capacity, &dax);
+  if (base == nullptr) {
+    error = errno;
+    ::close(fd);
+    return LogError(fname, error);
+  }
+  *result = new NvmLogFile(fname, fd, base, capacity, dax);
+  return Status::OK();
+}
+
+Status NvmLogFile::Grow(size_t bytes) {
+  size_t capacity = capacity_ * 2;
+  while (capacity < pos_ + bytes) {
+    capacity *= 2;
+  }
+  int error = Preallocate(fd_, capacity);
+  if (error != 0) {
+    return LogError(fname_, error);
+  }
+  // The old mapping stays in place until the new one is there, so a
+  // failure leaves the log as it was.  Lines that are not written back
+  // yet stay in the cache, which is indexed by physical address, so
+  // Sync() reaches them through the new mapping.
+  bool dax;
+  char* base = MapLog(fd_, capacity, &dax);
+  if (base == nullptr) {
+    return LogError(fname_, errno);
+  }
+  ::munmap(base_, capacity_);
+  base_ = base;
+  capacity_ = capacity;
+  dax_ = dax;
+  return Status::OK();
+}
+
+Status NvmLogFile::Append(const Slice& data) {
+  if (pos_ + data.size() > capacity_) {
+    Status s = Grow(data.size());
+    if (!s.ok()) {
+      return s;
+    }
+  }
+  std::memcpy(base_ + pos_, data.data(), data.size());
+  pos_ += data.size();
+  return Status::OK();
+}
+
+Status NvmLogFile::Flush() { return Status::OK(); }
+
+Status NvmLogFile::Sync() {
+  if (synced_ == pos_) {
+    return Status::OK();
+  }
+#if defined(__x86_64__)
+  if (dax_) {
+    static const WriteBackFunction write_back = ChooseWriteBack();
+    const uintptr_t start =
+        reinterpret_cast<uintptr_t>(base_ + synced_) & ~(kCacheLineSize - 1);
+    write_back(reinterpret_cast<const char*>(start), base_ + pos_);
+    _mm_sfence();
+    synced_ = pos_;
+    return Status::OK();
+  }
+#endif
+  const size_t start = synced_ / kPageSize * kPageSize;
+  if (::msync(base_ + start, pos_ - start, MS_SYNC) != 0) {
+    return LogError(fname_, errno);
+  }
+  synced_ = pos_;
+  return Status::OK();
+}
+
+Status NvmLogFile::Close() {
+  Status s;
+  // Drop the preallocated tail so that readers see just the records
+  if (::ftruncate(fd_, pos_) != 0) {
+    s = LogError(fname_, errno);
+  }
+  ::munmap(base_, capacity_);
+  if (::close(fd_) != 0 && s.ok()) {
+    s = LogError(fname_, errno);
+  }
+  fd_ = -1;
+  base_ = nullptr;
+  return s;
+}
+
+}  // namespace leveldb
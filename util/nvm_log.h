@@ -0,0 +1,58 @@
+// Add by MioDB
+// NvmLogFile is the write-ahead log on byte-addressable NVM.  Records are
+// copied into a preallocated, memory-mapped file and made durable by
+// writing back the dirty cache lines instead of calling fsync().
+
+#ifndef STORAGE_LEVELDB_UTIL_NVM_LOG_H_
+#define STORAGE_LEVELDB_UTIL_NVM_LOG_H_
+
+#include <cstddef>
+#include <string>
+
+#include "leveldb/env.h"
+#include "leveldb/status.h"
+
+namespace leveldb {
+
+class NvmLogFile : public WritableFile {
+ public:
+  // Create the log "fname" with room for "capacity" bytes, growing it if
+  // more is appended.  The unused tail of the file reads as zeros, which
+  // log::Reader skips, so a log that was not closed can still be read.
+  static Status Open(const std::string& fname, size_t capacity,
+                     WritableFile** result);
+
+  NvmLogFile(const NvmLogFile&) = delete;
+  NvmLogFile& operator=(const NvmLogFile&) = delete;
+
+  ~NvmLogFile() override;
+
+  Status Append(const Slice& data) override;
+  // Truncate the file to the bytes appended and unmap it.
+  Status Close() override;
+  // Appended bytes are in the mapping already, nothing to do.
+  Status Flush() override;
+  // Write back the cache lines appended since the last Sync().
+  Status Sync() override;
+
+ private:
+  NvmLogFile(const std::string& fname, int fd, char* base, size_t capacity,
+             bool dax);
+
+  // Map a larger file so that "bytes" more bytes fit.
+  Status Grow(size_t bytes);
+
+  const std::string fname_;
+  int fd_;
+  char* base_;
+  size_t capacity_;
+  size_t pos_;     // bytes appended
+  size_t synced_;  // bytes known to be durable
+  // True if the mapping is synchronous (MAP_SYNC on a DAX file system) and
+  // flushing the CPU caches makes data durable.  Otherwise msync() is used.
+  bool dax_;
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_UTIL_NVM_LOG_H_
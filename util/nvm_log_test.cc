@@ -0,0 +1,106 @@
+// Add by MioDB
+
+#include "util/nvm_log.h"
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "db/log_reader.h"
+#include "db/log_writer.h"
+#include "leveldb/env.h"
+#include "util/random.h"
+#include "util/testutil.h"
+
+namespace leveldb {
+
+class NvmLogTest : public testing::Test {
+ public:
+  NvmLogTest() {
+    std::string test_dir;
+    EXPECT_LEVELDB_OK(Env::Default()->GetTestDirectory(&test_dir));
+    fname_ = test_dir + "/nvm_log_test.log";
+    Env::Default()->RemoveFile(fname_);
+
+    Random rnd(301);
+    for (int i = 0; i < 200; i++) {
+      std::string record;
+      test::RandomString(&rnd, rnd.Skewed(14), &record);
+      records_.push_back(record);
+    }
+  }
+
+  ~NvmLogTest() { Env::Default()->RemoveFile(fname_); }
+
+  void WriteRecords(WritableFile* file) {
+    log::Writer writer(file);
+    for (size_t i = 0; i < records_.size(); i++) {
+      ASSERT_LEVELDB_OK(writer.AddRecord(records_[i]));
+      if (i % 10 == 0) {
+        ASSERT_LEVELDB_OK(file->Sync());
+      }
+    }
+    ASSERT_LEVELDB_OK(file->Sync());
+  }
+
+  // Read the log back and compare with records_
+  void CheckRecords() {
+    SequentialFile* file;
+    ASSERT_LEVELDB_OK(Env::Default()->NewSequentialFile(fname_, &file));
+    log::Reader reader(file, nullptr, true, 0);
+    std::string scratch;
+    Slice record;
+    size_t n = 0;
+    while (reader.ReadRecord(&record, &scratch)) {
+      ASSERT_LT(n, records_.size());
+      ASSERT_EQ(records_[n], record.ToString()) << n;
+      n++;
+    }
+    ASSERT_EQ(records_.size(), n);
+    delete file;
+  }
+
+  std::string fname_;
+  std::vector<std::string> records_;
+};
+
+TEST_F(NvmLogTest, CloseTruncates) {
+  WritableFile* file;
+  ASSERT_LEVELDB_OK(NvmLogFile::Open(fname_, 1 << 20, &file));
+  WriteRecords(file);
+  ASSERT_LEVELDB_OK(file->Close());
+  delete file;
+
+  uint64_t size;
+  ASSERT_LEVELDB_OK(Env::Default()->GetFileSize(fname_, &size));
+  ASSERT_LT(size, 1 << 20);
+  CheckRecords();
+}
+
+TEST_F(NvmLogTest, ReadWhileOpen) {
+  // As after a crash: the preallocated tail is still there
+  WritableFile* file;
+  ASSERT_LEVELDB_OK(NvmLogFile::Open(fname_, 1 << 20, &file));
+  WriteRecords(file);
+  uint64_t size;
+  ASSERT_LEVELDB_OK(Env::Default()->GetFileSize(fname_, &size));
+  ASSERT_EQ(1 << 20, size);
+  CheckRecords();
+  delete file;
+}
+
+TEST_F(NvmLogTest, Grow) {
+  WritableFile* file;
+  ASSERT_LEVELDB_OK(NvmLogFile::Open(fname_, 4096, &file));
+  WriteRecords(file);
+  ASSERT_LEVELDB_OK(file->Close());
+  delete file;
+  CheckRecords();
+}
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
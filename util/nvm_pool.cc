@@ -0,0 +1,375 @@
+// Add by MioDB
+// NvmPool carves PMTable blocks out of one memory-mapped file
+
+#include "util/nvm_pool.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <iterator>
+#include <vector>
+
+#include "util/mutexlock.h"
+
+namespace leveldb {
+
+namespace {
+
+const char kMagic[8] = {'M', 'I', 'O', 'N', 'V', 'M', 'P', 'L'};
+const uint64_t kFormatVersion = 3;
+const int kMaxJournals = 16;  // More than the merges that run at once
+
+// The header occupies the first page, blocks are handed out in pages so
+// that every block can be msync()ed on its own.
+const size_t kPageSize = 4096;
+const size_t kHeaderSize = kPageSize;
+
+Status PoolError(const std::string& fname, int error_number) {
+  return Status::IOError(fname, std::strerror(error_number));
+}
+
+}  // namespace
+
+struct NvmPool::Header {
+  char magic[8];
+  uint64_t version;
+  uint64_t size;                    // size of the pool file
+  uint64_t journals[kMaxJournals];  // first blocks of the journals, or 0
+};
+
+namespace {
+
+// A journal is a chain of blocks, zeroed when they are allocated, that
+// each start with a JournalBlock.  Entry i of the journal is entry
+// i % kEntriesPerBlock of block i / kEntriesPerBlock.
+const size_t kJournalBlockSize = 256 << 10;
+const size_t kMaxJournalBlocks = 16384;  // 4GB of entries
+
+struct JournalBlock {
+  uint64_t next;      // offset of the next block, 0 for the last one
+  uint64_t absorbed;  // first block only: arguments of BeginUpdate()
+  uint64_t target;
+  uint64_t overflow;  // first block only: non-zero if entries were lost
+};
+
+// "offset" is stored after "value", an entry whose offset is 0 is unused
+struct JournalEntry {
+  std::atomic<uint64_t> offset;
+  uint64_t value;
+};
+
+const size_t kEntriesPerBlock =
+    (kJournalBlockSize - sizeof(JournalBlock)) / sizeof(JournalEntry);
+
+JournalBlock* BlockHeader(char* block) {
+  return reinterpret_cast<JournalBlock*>(block);
+}
+
+JournalEntry* Entry(char* block, uint64_t index) {
+  return reinterpret_cast<JournalEntry*>(block + sizeof(JournalBlock)) +
+         index % kEntriesPerBlock;
+}
+
+}  // namespace
+
+NvmJournal::NvmJournal(NvmPool* pool, int slot, char* root)
+    : pool_(pool),
+      slot_(slot),
+      entries_(0),
+      num_blocks_(1),
+      blocks_(new std::atomic<char*>[kMaxJournalBlocks]) {
+  blocks_[0].store(root, std::memory_order_relaxed);
+  for (size_t i = 1; i < kMaxJournalBlocks; i++) {
+    blocks_[i].store(nullptr, std::memory_order_relaxed);
+  }
+}
+
+NvmJournal::~NvmJournal() = default;
+
+void NvmJournal::Record(const void* word) {
+  const uint64_t index = entries_.fetch_add(1, std::memory_order_relaxed);
+  char* block = Block(index);
+  if (block == nullptr) {
+    return;
+  }
+  JournalEntry* entry = Entry(block, index);
+  entry->value = *reinterpret_cast<const uint64_t*>(word);
+  entry->offset.store(pool_->Offset(reinterpret_cast<const char*>(word)),
+                      std::memory_order_release);
+}
+
+char* NvmJournal::Block(uint64_t index) {
+  const uint64_t b = index / kEntriesPerBlock;
+  if (b < kMaxJournalBlocks) {
+    char* block = blocks_[b].load(std::memory_order_acquire);
+    if (block != nullptr) {
+      return block;
+    }
+  }
+  MutexLock l(&mu_);
+  while (num_blocks_ <= b) {
+    char* block = (num_blocks_ < kMaxJournalBlocks)
+                      ? pool_->Allocate(kJournalBlockSize)
+                      : nullptr;
+    char* root = blocks_[0].load(std::memory_order_relaxed);
+    if (block == nullptr) {
+      BlockHeader(root)->overflow = 1;
+      return nullptr;
+    }
+    std::memset(block, 0, kJournalBlockSize);
+    // Chained before any of its entries is written
+    char* last = blocks_[num_blocks_ - 1].load(std::memory_order_relaxed);
+    BlockHeader(last)->next = pool_->Offset(block);
+    blocks_[num_blocks_].store(block, std::memory_order_release);
+    num_blocks_++;
+  }
+  return blocks_[b].load(std::memory_order_relaxed);
+}
+
+NvmPool::NvmPool(int fd, char* base, size_t size, bool is_new)
+    : fd_(fd), base_(base), size_(size), is_new_(is_new), journals_(0) {
+  free_[kHeaderSize] = size_ - kHeaderSize;
+  for (int i = 0; i < kMaxJournals; i++) {
+    if (header()->journals[i] != 0) {
+      journals_ |= 1u << i;  // Left for Recover()
+    }
+  }
+}
+
+NvmPool::~NvmPool() {
+  ::munmap(base_, size_);
+  ::close(fd_);
+}
+
+size_t NvmPool::Align(size_t bytes) {
+  return (bytes + kPageSize - 1) / kPageSize * kPageSize;
+}
+
+Status NvmPool::Open(const std::string& fname, size_t size, bool reset,
+                     NvmPool** result) {
+  *result = nullptr;
+  int fd = ::open(fname.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return PoolError(fname, errno);
+  }
+
+  Header h;
+  bool create = reset;
+  if (!create) {
+    ssize_t n = ::pread(fd, &h, sizeof(h), 0);
+    if (n == 0) {
+      create = true;  // Empty file
+    } else if (n != sizeof(h) ||
+               std::memcmp(h.magic, kMagic, sizeof(kMagic)) != 0 ||
+               h.version != kFormatVersion) {
+      ::close(fd);
+      return Status::Corruption(fname, "not an nvm pool");
+    }
+  }
+
+  if (create) {
+    size = Align(size);
+    if (size <= kHeaderSize) {
+      ::close(fd);
+      return Status::InvalidArgument(fname, "nvm pool is too small");
+    }
+    // Drop any previous contents before growing the file to its new size.
+    if (::ftruncate(fd, 0) != 0 || ::ftruncate(fd, size) != 0) {
+      Status s = PoolError(fname, errno);
+      ::close(fd);
+      return s;
+    }
+    std::memcpy(h.magic, kMagic, sizeof(kMagic));
+    h.version = kFormatVersion;
+    h.size = size;
+    std::memset(h.journals, 0, sizeof(h.journals));
+  }
+
+  // Tables only hold relative links, the pool can be mapped anywhere
+  void* addr = ::mmap(nullptr, h.size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      fd, 0);
+  if (addr == MAP_FAILED) {
+    Status s = PoolError(fname, errno);
+    ::close(fd);
+    return s;
+  }
+
+  if (create) {
+    std::memcpy(addr, &h, sizeof(h));
+    ::msync(addr, sizeof(h), MS_SYNC);
+  }
+  NvmPool* pool = new NvmPool(fd, reinterpret_cast<char*>(addr), h.size, create);
+  *result = pool;
+  return Status::OK();
+}
+
+char* NvmPool::Allocate(size_t bytes) {
+  bytes = Align(bytes);
+  MutexLock l(&mu_);
+  for (auto it = free_.begin(); it != free_.end(); ++it) {
+    if (it->second >= bytes) {
+      const uint64_t offset = it->first;
+      const uint64_t remaining = it->second - bytes;
+      free_.erase(it);
+      if (remaining > 0) {
+        free_[offset + bytes] = remaining;
+      }
+      return base_ + offset;
+    }
+  }
+  return nullptr;
+}
+
+void NvmPool::Free(char* block, size_t bytes) {
+  MutexLock l(&mu_);
+  AddFree(Offset(block), Align(bytes));
+}
+
+char* NvmPool::Reserve(const NvmRegion& region) {
+  const uint64_t offset = region.offset;
+  const uint64_t bytes = Align(region.size);
+  MutexLock l(&mu_);
+  auto it = free_.upper_bound(offset);
+  if (it == free_.begin()) {
+    return nullptr;
+  }
+  --it;
+  const uint64_t start = it->first;
+  const uint64_t limit = it->first + it->second;
+  if (offset + bytes > limit) {
+    return nullptr;
+  }
+  free_.erase(it);
+  if (offset > start) {
+    free_[start] = offset - start;
+  }
+  if (offset + bytes < limit) {
+    free_[offset + bytes] = limit - offset - bytes;
+  }
+  return base_ + offset;
+}
+
+void NvmPool::AddFree(uint64_t offset, uint64_t size) {
+  auto next = free_.lower_bound(offset);
+  if (next != free_.end() && offset + size == next->first) {
+    size += next->second;
+    next = free_.erase(next);
+  }
+  if (next != free_.begin()) {
+    auto prev = std::prev(next);
+    if (prev->first + prev->second == offset) {
+      prev->second += size;
+      return;
+    }
+  }
+  free_[offset] = size;
+}
+
+void NvmPool::Sync(const char* p, size_t bytes) {
+  uintptr_t start = reinterpret_cast<uintptr_t>(p) & ~(kPageSize - 1);
+  uintptr_t limit = reinterpret_cast<uintptr_t>(p) + bytes;
+  ::msync(reinterpret_cast<void*>(start), limit - start, MS_SYNC);
+}
+
+Status NvmPool::BeginUpdate(uint64_t absorbed, uint64_t target,
+                            NvmJournal** journal) {
+  *journal = nullptr;
+  char* root = Allocate(kJournalBlockSize);
+  if (root == nullptr) {
+    return Status::IOError("nvm pool is full");
+  }
+  std::memset(root, 0, kJournalBlockSize);
+  BlockHeader(root)->absorbed = absorbed;
+  BlockHeader(root)->target = target;
+  Sync(root, sizeof(JournalBlock));
+
+  MutexLock l(&mu_);
+  int slot = 0;
+  while (slot < kMaxJournals && (journals_ & (1u << slot)) != 0) {
+    slot++;
+  }
+  if (slot == kMaxJournals) {
+    AddFree(Offset(root), kJournalBlockSize);
+    return Status::IOError("nvm pool has no room for another journal");
+  }
+  journals_ |= 1u << slot;
+  header()->journals[slot] = Offset(root);
+  Sync(base_, sizeof(Header));
+  *journal = new NvmJournal(this, slot, root);
+  return Status::OK();
+}
+
+void NvmPool::EndUpdate(NvmJournal* journal, bool installed) {
+  if (installed) {
+    journal->mu_.Lock();
+    const size_t num_blocks = journal->num_blocks_;
+    journal->mu_.Unlock();
+    MutexLock l(&mu_);
+    header()->journals[journal->slot_] = 0;
+    Sync(base_, sizeof(Header));
+    journals_ &= ~(1u << journal->slot_);
+    for (size_t i = 0; i < num_blocks; i++) {
+      AddFree(Offset(journal->blocks_[i].load(std::memory_order_relaxed)),
+              kJournalBlockSize);
+    }
+  }
+  delete journal;
+}
+
+Status NvmPool::Recover(const std::set<uint64_t>& live,
+                        std::set<uint64_t>* undone) {
+  for (int slot = 0; slot < kMaxJournals; slot++) {
+    const uint64_t root = header()->journals[slot];
+    if (root == 0) {
+      continue;
+    }
+    // Follow the chain and check every link before trusting it
+    std::vector<uint64_t> blocks;
+    for (uint64_t b = root; b != 0; b = BlockHeader(base_ + b)->next) {
+      if (b < kHeaderSize || b > size_ - kJournalBlockSize ||
+          blocks.size() == kMaxJournalBlocks) {
+        return Status::Corruption("nvm pool journal is damaged");
+      }
+      blocks.push_back(b);
+    }
+    const JournalBlock* first = BlockHeader(base_ + root);
+    if (live.count(first->absorbed) != 0) {
+      // The MANIFEST does not record the merge, restore the first value of
+      // every word by undoing the entries in reverse
+      if (first->overflow != 0) {
+        return Status::Corruption(
+            "a compaction was interrupted after its journal ran out of room");
+      }
+      for (size_t i = blocks.size(); i-- > 0;) {
+        char* block = base_ + blocks[i];
+        for (size_t e = kEntriesPerBlock; e-- > 0;) {
+          JournalEntry* entry = Entry(block, e);
+          const uint64_t offset =
+              entry->offset.load(std::memory_order_relaxed);
+          if (offset == 0) {
+            continue;
+          }
+          if (offset < kHeaderSize || offset > size_ - sizeof(uint64_t)) {
+            return Status::Corruption("nvm pool journal is damaged");
+          }
+          std::memcpy(base_ + offset, &entry->value, sizeof(uint64_t));
+        }
+      }
+      ::msync(base_, size_, MS_SYNC);
+      undone->insert(first->absorbed);
+      undone->insert(first->target);
+    }
+    // The blocks are free again, nothing in the MANIFEST refers to them
+    MutexLock l(&mu_);
+    header()->journals[slot] = 0;
+    Sync(base_, sizeof(Header));
+    journals_ &= ~(1u << slot);
+  }
+  return Status::OK();
+}
+
+}  // namespace leveldb
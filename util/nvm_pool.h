@@ -0,0 +1,151 @@
+// Add by MioDB
+// NvmPool carves PMTable blocks out of one memory-mapped file (a file on a
+// DAX mount, or a plain tmpfs/ext4 file for testing), so that DataTables
+// survive a restart and can be remapped instead of rebuilt.
+//
+// Only the pool header and the journals of running merges are persistent
+// bookkeeping.  Which ranges are in use is recorded by the MANIFEST (see
+// DataTableLayout); the free space map is kept in DRAM and rebuilt from the
+// MANIFEST when the DB is reopened.
+
+#ifndef STORAGE_LEVELDB_UTIL_NVM_POOL_H_
+#define STORAGE_LEVELDB_UTIL_NVM_POOL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+
+#include "leveldb/status.h"
+#include "port/port.h"
+#include "port/thread_annotations.h"
+
+namespace leveldb {
+
+// A range of the pool, addressed by its offset from the start of the file.
+struct NvmRegion {
+  NvmRegion() : offset(0), size(0) {}
+  NvmRegion(uint64_t o, uint64_t s) : offset(o), size(s) {}
+
+  uint64_t offset;
+  uint64_t size;
+};
+
+class NvmPool;
+
+// The words that a merge overwrites in tables the MANIFEST refers to, saved
+// before it overwrites them, so that NvmPool::Recover() can roll back a
+// merge the MANIFEST never recorded.  Stores reach the pool file in program
+// order when the process dies, which is what the journal relies on; it does
+// not order them against a power failure.
+class NvmJournal {
+ public:
+  NvmJournal(const NvmJournal&) = delete;
+  NvmJournal& operator=(const NvmJournal&) = delete;
+
+  // Save the 8 bytes at "word", which lies in the pool.  May be called from
+  // several threads at once, but not for the same word.
+  void Record(const void* word);
+
+ private:
+  friend class NvmPool;
+
+  NvmJournal(NvmPool* pool, int slot, char* root);
+  ~NvmJournal();
+
+  // The block that holds entry "index", allocated if need be, or nullptr if
+  // the pool is full, in which case the journal is marked as incomplete
+  char* Block(uint64_t index);
+
+  NvmPool* const pool_;
+  const int slot_;  // Index of the journal in the pool header
+  std::atomic<uint64_t> entries_;  // Entries handed out so far
+
+  port::Mutex mu_;
+  size_t num_blocks_ GUARDED_BY(mu_);
+  std::unique_ptr<std::atomic<char*>[]> blocks_;
+};
+
+class NvmPool {
+ public:
+  // Map the pool stored in "fname".  If "reset" is true or the file does
+  // not hold a pool yet, a new pool of "size" bytes is created and any
+  // previous contents are discarded.
+  static Status Open(const std::string& fname, size_t size, bool reset,
+                     NvmPool** result);
+
+  NvmPool(const NvmPool&) = delete;
+  NvmPool& operator=(const NvmPool&) = delete;
+
+  ~NvmPool();
+
+  // Return a block of at least "bytes" bytes, or nullptr if the pool is full.
+  char* Allocate(size_t bytes);
+
+  // Return a block obtained from Allocate() or Reserve() to the pool.
+  void Free(char* block, size_t bytes);
+
+  // Mark an already populated region as in use and return its address.
+  // Used at recovery for the regions recorded in the MANIFEST.
+  // Returns nullptr if the region is outside the pool or overlaps a
+  // region that is already in use.
+  char* Reserve(const NvmRegion& region);
+
+  // Write back "bytes" bytes starting at "p" to the persistent medium.
+  void Sync(const char* p, size_t bytes);
+
+  // Bracket a merge that modifies tables referenced by the MANIFEST in
+  // place (zero-copy and lazy-copy compaction).  The merge records what it
+  // overwrites in *journal.  Once it is installed the MANIFEST no longer
+  // refers to table "absorbed", the one merged into "target".
+  Status BeginUpdate(uint64_t absorbed, uint64_t target, NvmJournal** journal);
+  // Drop the journal if the merge was "installed" in the MANIFEST, or else
+  // leave it in the pool for Recover() at the next Open().
+  void EndUpdate(NvmJournal* journal, bool installed);
+
+  // Roll back the merges whose absorbed table is still among the "live"
+  // tables of the MANIFEST, and add the numbers of the tables they touched
+  // to *undone.  Call before any table is remapped.
+  Status Recover(const std::set<uint64_t>& live, std::set<uint64_t>* undone);
+
+  // True if Open() created a new pool instead of mapping an existing one.
+  bool IsNew() const { return is_new_; }
+
+  // True if "p" points into the pool.
+  bool Contains(const char* p) const { return p >= base_ && p < base_ + size_; }
+
+  uint64_t Offset(const char* p) const { return p - base_; }
+  char* Translate(uint64_t offset) const { return base_ + offset; }
+  size_t Size() const { return size_; }
+
+ private:
+  struct Header;
+
+  friend class NvmJournal;
+
+  NvmPool(int fd, char* base, size_t size, bool is_new);
+
+  // Round an allocation up to the pool's allocation granularity.
+  static size_t Align(size_t bytes);
+
+  // Insert [offset, offset + size) into free_ and coalesce with neighbours.
+  void AddFree(uint64_t offset, uint64_t size) EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  Header* header() const { return reinterpret_cast<Header*>(base_); }
+
+  const int fd_;
+  char* const base_;
+  const size_t size_;
+  const bool is_new_;
+
+  port::Mutex mu_;
+  std::map<uint64_t, uint64_t> free_ GUARDED_BY(mu_);  // offset -> size
+  uint32_t journals_ GUARDED_BY(mu_);  // Bit i is set if slot i is in use
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_UTIL_NVM_POOL_H_
@@ -0,0 +1,220 @@
+// Add by MioDB
+
+#include "util/nvm_pool.h"
+
+#include <cstring>
+#include <set>
+
+#include "gtest/gtest.h"
+#include "db/global.h"
+#include "leveldb/env.h"
+#include "util/arena.h"
+#include "util/testutil.h"
+
+namespace leveldb {
+
+class NvmPoolTest : public testing::Test {
+ public:
+  NvmPoolTest() {
+    std::string test_dir;
+    EXPECT_LEVELDB_OK(Env::Default()->GetTestDirectory(&test_dir));
+    fname_ = test_dir + "/nvm_pool_test.pool";
+    Env::Default()->RemoveFile(fname_);
+  }
+
+  ~NvmPoolTest() { Env::Default()->RemoveFile(fname_); }
+
+  std::string fname_;
+};
+
+TEST_F(NvmPoolTest, AllocateAndFree) {
+  NvmPool* pool;
+  ASSERT_LEVELDB_OK(NvmPool::Open(fname_, 1 << 20, true, &pool));
+  ASSERT_TRUE(pool->IsNew());
+
+  char* a = pool->Allocate(100);
+  char* b = pool->Allocate(5000);
+  ASSERT_TRUE(a != nullptr);
+  ASSERT_TRUE(b != nullptr);
+  ASSERT_NE(a, b);
+  ASSERT_EQ(a, pool->Translate(pool->Offset(a)));
+
+  // Freed space is handed out again
+  pool->Free(a, 100);
+  ASSERT_EQ(a, pool->Allocate(50));
+
+  // A full pool refuses instead of growing
+  ASSERT_TRUE(pool->Allocate(2 << 20) == nullptr);
+  delete pool;
+}
+
+TEST_F(NvmPoolTest, ReopenAndReserve) {
+  NvmPool* pool;
+  ASSERT_LEVELDB_OK(NvmPool::Open(fname_, 1 << 20, true, &pool));
+  char* p = pool->Allocate(4096);
+  ASSERT_TRUE(p != nullptr);
+  NvmRegion region(pool->Offset(p), 4096);
+  std::strcpy(p, "persistent");
+  pool->Sync(p, 4096);
+  delete pool;
+
+  ASSERT_LEVELDB_OK(NvmPool::Open(fname_, 1 << 20, false, &pool));
+  ASSERT_FALSE(pool->IsNew());
+  p = pool->Reserve(region);
+  ASSERT_TRUE(p != nullptr);
+  ASSERT_EQ(std::string("persistent"), std::string(p));
+  // The region is now in use
+  ASSERT_TRUE(pool->Reserve(region) == nullptr);
+  ASSERT_NE(p, pool->Allocate(4096));
+  delete pool;
+}
+
+// Overwrite the words of "table" through journal, twice each, as a merge
+// in the pool does
+static void UpdateInPlace(NvmJournal* journal, uint64_t* table, size_t words) {
+  for (int round = 1; round <= 2; round++) {
+    for (size_t i = 0; i < words; i++) {
+      journal->Record(&table[i]);
+      table[i] = round * 1000000 + i;
+    }
+  }
+}
+
+TEST_F(NvmPoolTest, InterruptedUpdateIsUndone) {
+  // Enough words for the journal to take more than one block
+  const size_t kWords = 64 << 10;
+  NvmPool* pool;
+  ASSERT_LEVELDB_OK(NvmPool::Open(fname_, 8 << 20, true, &pool));
+  char* p = pool->Allocate(kWords * sizeof(uint64_t));
+  const NvmRegion region(pool->Offset(p), kWords * sizeof(uint64_t));
+  uint64_t* table = reinterpret_cast<uint64_t*>(p);
+  for (size_t i = 0; i < kWords; i++) {
+    table[i] = i;
+  }
+  NvmJournal* journal;
+  ASSERT_LEVELDB_OK(pool->BeginUpdate(7, 5, &journal));
+  UpdateInPlace(journal, table, kWords);
+  // Not installed, like a merge the process did not finish
+  pool->EndUpdate(journal, false);
+  delete pool;
+
+  ASSERT_LEVELDB_OK(NvmPool::Open(fname_, 8 << 20, false, &pool));
+  std::set<uint64_t> undone;
+  ASSERT_LEVELDB_OK(pool->Recover({5, 7}, &undone));
+  ASSERT_EQ(std::set<uint64_t>({5, 7}), undone);
+  table = reinterpret_cast<uint64_t*>(pool->Reserve(region));
+  ASSERT_TRUE(table != nullptr);
+  for (size_t i = 0; i < kWords; i++) {
+    ASSERT_EQ(i, table[i]);
+  }
+  delete pool;
+
+  // The journal is gone
+  ASSERT_LEVELDB_OK(NvmPool::Open(fname_, 8 << 20, false, &pool));
+  undone.clear();
+  ASSERT_LEVELDB_OK(pool->Recover({5, 7}, &undone));
+  ASSERT_TRUE(undone.empty());
+  delete pool;
+}
+
+TEST_F(NvmPoolTest, InstalledUpdateIsKept) {
+  NvmPool* pool;
+  ASSERT_LEVELDB_OK(NvmPool::Open(fname_, 1 << 20, true, &pool));
+  char* p = pool->Allocate(4096);
+  const NvmRegion region(pool->Offset(p), 4096);
+  uint64_t* table = reinterpret_cast<uint64_t*>(p);
+  NvmJournal* journal;
+  ASSERT_LEVELDB_OK(pool->BeginUpdate(7, 5, &journal));
+  UpdateInPlace(journal, table, 512);
+  // The MANIFEST recorded the merge but the process died before the
+  // journal was dropped: table 7 is no longer live
+  pool->EndUpdate(journal, false);
+  delete pool;
+
+  ASSERT_LEVELDB_OK(NvmPool::Open(fname_, 1 << 20, false, &pool));
+  std::set<uint64_t> undone;
+  ASSERT_LEVELDB_OK(pool->Recover({5}, &undone));
+  ASSERT_TRUE(undone.empty());
+  table = reinterpret_cast<uint64_t*>(pool->Reserve(region));
+  for (size_t i = 0; i < 512; i++) {
+    ASSERT_EQ(2000000 + i, table[i]);
+  }
+
+  // An installed merge drops its journal right away
+  ASSERT_LEVELDB_OK(pool->BeginUpdate(5, 3, &journal));
+  UpdateInPlace(journal, table, 512);
+  pool->EndUpdate(journal, true);
+  delete pool;
+  ASSERT_LEVELDB_OK(NvmPool::Open(fname_, 1 << 20, false, &pool));
+  ASSERT_LEVELDB_OK(pool->Recover({3, 5}, &undone));
+  ASSERT_TRUE(undone.empty());
+  delete pool;
+}
+
+TEST_F(NvmPoolTest, FullJournalCannotBeUndone) {
+  NvmPool* pool;
+  ASSERT_LEVELDB_OK(NvmPool::Open(fname_, 1 << 20, true, &pool));
+  uint64_t* table = reinterpret_cast<uint64_t*>(pool->Allocate(256 << 10));
+  NvmJournal* journal;
+  ASSERT_LEVELDB_OK(pool->BeginUpdate(7, 5, &journal));
+  // Leave no room for a second journal block
+  while (pool->Allocate(4096) != nullptr) {
+  }
+  UpdateInPlace(journal, table, 32 << 10);
+  pool->EndUpdate(journal, false);
+  delete pool;
+
+  ASSERT_LEVELDB_OK(NvmPool::Open(fname_, 1 << 20, false, &pool));
+  std::set<uint64_t> undone;
+  Status s = pool->Recover({5, 7}, &undone);
+  ASSERT_TRUE(s.IsCorruption()) << s.ToString();
+  delete pool;
+}
+
+TEST_F(NvmPoolTest, ArenaReportsUnusableRegions) {
+  ASSERT_LEVELDB_OK(NvmPool::Open(fname_, 1 << 20, true, &nvm_pool));
+  char* p = nvm_pool->Allocate(8192);
+  ASSERT_TRUE(p != nullptr);
+  const NvmRegion taken(nvm_pool->Offset(p), 8192);
+  {
+    // The region is in use already
+    Arena arena(std::vector<NvmRegion>(1, taken), 4096);
+    ASSERT_TRUE(arena.status().IsCorruption()) << arena.status().ToString();
+    // An empty table stands in
+    ASSERT_TRUE(arena.GetHead() != nullptr);
+  }
+  {
+    // Past the end of the pool; the first region is released again
+    std::vector<NvmRegion> regions;
+    regions.push_back(NvmRegion(taken.offset + 8192, 4096));
+    regions.push_back(NvmRegion(2 << 20, 4096));
+    Arena arena(regions, 4096);
+    ASSERT_TRUE(arena.status().IsCorruption()) << arena.status().ToString();
+    ASSERT_TRUE(nvm_pool->Reserve(regions[0]) != nullptr);
+  }
+  delete nvm_pool;
+  nvm_pool = nullptr;
+}
+
+TEST_F(NvmPoolTest, ArenaReportsFullPool) {
+  ASSERT_LEVELDB_OK(NvmPool::Open(fname_, 1 << 20, true, &nvm_pool));
+  {
+    Arena arena(256 << 10, false);
+    for (int i = 0; i < 8; i++) {
+      char* p = arena.Allocate(200 << 10);
+      std::memset(p, i, 200 << 10);  // Still usable memory
+    }
+    ASSERT_TRUE(arena.status().IsIOError()) << arena.status().ToString();
+  }
+  // Every block, wherever it came from, is released
+  ASSERT_TRUE(nvm_pool->Allocate((1 << 20) - 4096) != nullptr);
+  delete nvm_pool;
+  nvm_pool = nullptr;
+}
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
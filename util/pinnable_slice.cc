@@ -0,0 +1,34 @@
+// Add by MioDB
+
+#include "leveldb/pinnable_slice.h"
+
+#include <cassert>
+
+namespace leveldb {
+
+PinnableSlice::PinnableSlice() : num_cleanups_(0) {}
+
+PinnableSlice::~PinnableSlice() { Reset(); }
+
+void PinnableSlice::Reset() {
+  for (int i = 0; i < num_cleanups_; i++) {
+    (*cleanups_[i].function)(cleanups_[i].arg1, cleanups_[i].arg2);
+  }
+  num_cleanups_ = 0;
+  self_.clear();
+  Slice::operator=(Slice());
+}
+
+void PinnableSlice::PinSelf(const Slice& s) {
+  self_.assign(s.data(), s.size());
+  Slice::operator=(self_);
+}
+
+void PinnableSlice::RegisterCleanup(CleanupFunction function, void* arg1,
+                                    void* arg2) {
+  assert(function != nullptr);
+  assert(num_cleanups_ < 2);
+  cleanups_[num_cleanups_++] = Cleanup{function, arg1, arg2};
+}
+
+}  // namespace leveldb
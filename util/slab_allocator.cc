@@ -0,0 +1,98 @@
+// Add by MioDB
+
+#include "util/slab_allocator.h"
+
+#include <cassert>
+
+namespace leveldb {
+
+// Small objects are rounded up to a multiple of kGranularity, larger ones
+// to an eighth of their power of two, so that no class wastes more than
+// 12.5% of an object.
+static const size_t kGranularity = 16;
+static const size_t kMaxSmall = 4096;
+
+SlabAllocator::SlabAllocator(Arena* arena, Epoch* epoch)
+    : arena_(arena), epoch_(epoch), free_bytes_(0), retired_bytes_(0) {}
+
+size_t SlabAllocator::ClassSize(size_t bytes) {
+  if (bytes <= kMaxSmall) {
+    return (bytes + kGranularity - 1) & ~(kGranularity - 1);
+  }
+  size_t power = kMaxSmall;
+  while (power * 2 < bytes) {
+    power *= 2;
+  }
+  const size_t step = power / 8;
+  return (bytes + step - 1) & ~(step - 1);
+}
+
+char* SlabAllocator::Allocate(size_t bytes) {
+  assert(bytes > 0);
+  const size_t size = ClassSize(bytes);
+  char** head = nullptr;
+  if (size <= kMaxSmall) {
+    const size_t index = size / kGranularity;
+    if (index < small_.size()) {
+      head = &small_[index];
+    }
+  } else {
+    auto it = large_.find(size);
+    if (it != large_.end()) {
+      head = &it->second;
+    }
+  }
+  if (head != nullptr && *head != nullptr) {
+    char* result = *head;
+    *head = *reinterpret_cast<char**>(result);
+    free_bytes_ -= size;
+    return result;
+  }
+  return arena_->AllocateAligned(size);
+}
+
+void SlabAllocator::Free(char* p, size_t bytes) {
+  assert(p != nullptr && bytes > 0);
+  const size_t size = ClassSize(bytes);
+  char** head;
+  if (size <= kMaxSmall) {
+    const size_t index = size / kGranularity;
+    if (index >= small_.size()) {
+      small_.resize(kMaxSmall / kGranularity + 1, nullptr);
+    }
+    head = &small_[index];
+  } else {
+    head = &large_[size];  // starts out as nullptr
+  }
+  *reinterpret_cast<char**>(p) = *head;
+  *head = p;
+  free_bytes_ += size;
+}
+
+void SlabAllocator::Retire(char* p, size_t bytes) {
+  if (epoch_ == nullptr) {
+    Free(p, bytes);
+    return;
+  }
+  Retired r = {epoch_->Current(), p, bytes};
+  retired_.push_back(r);
+  retired_bytes_ += bytes;
+}
+
+void SlabAllocator::Reclaim() {
+  if (epoch_ == nullptr || retired_.empty()) {
+    return;
+  }
+  // Twice if the readers allow, for what was retired in the current epoch
+  epoch_->TryAdvance();
+  epoch_->TryAdvance();
+  const uint64_t safe = epoch_->SafeBefore();
+  while (!retired_.empty() && retired_.front().epoch < safe) {
+    const Retired& r = retired_.front();
+    retired_bytes_ -= r.bytes;
+    Free(r.p, r.bytes);
+    retired_.pop_front();
+  }
+}
+
+}  // namespace leveldb
@@ -0,0 +1,76 @@
+// Add by MioDB
+// Size class allocator for the nodes and keys of the last datatable.  Unlike
+// the other datatables the last one is updated in place, so freed nodes are
+// kept on free lists and handed out again instead of going back to the node.
+
+#ifndef STORAGE_LEVELDB_UTIL_SLAB_ALLOCATOR_H_
+#define STORAGE_LEVELDB_UTIL_SLAB_ALLOCATOR_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <vector>
+
+#include "util/arena.h"
+#include "util/epoch.h"
+
+namespace leveldb {
+
+class SlabAllocator {
+ public:
+  // Carve new objects out of the blocks of "arena", which keeps ownership
+  // of the memory and returns it in bulk when it is destroyed.  Objects
+  // retired while readers pin "epoch" wait for them before they are reused.
+  explicit SlabAllocator(Arena* arena, Epoch* epoch = nullptr);
+
+  SlabAllocator(const SlabAllocator&) = delete;
+  SlabAllocator& operator=(const SlabAllocator&) = delete;
+
+  // Return 8-byte aligned memory for "bytes" bytes.  Reuses a freed object
+  // of the same size class if there is one.
+  // REQUIRES: bytes > 0
+  char* Allocate(size_t bytes);
+
+  // Put "p", returned by Allocate(bytes), on the free list of its class.
+  void Free(char* p, size_t bytes);
+
+  // Free(p, bytes) once no reader of the epoch can reach "p" any more.
+  // Without an epoch that is right away.
+  void Retire(char* p, size_t bytes);
+
+  // Advance the epoch and free the retired objects readers have left.
+  void Reclaim();
+
+  // Bytes sitting on the free lists
+  size_t FreeBytes() const { return free_bytes_; }
+
+  // Bytes retired and not freed yet
+  size_t RetiredBytes() const { return retired_bytes_; }
+
+  // Bytes actually taken by an object of "bytes" bytes
+  static size_t ClassSize(size_t bytes);
+
+ private:
+  struct Retired {
+    uint64_t epoch;
+    char* p;
+    size_t bytes;
+  };
+
+  Arena* const arena_;
+  Epoch* const epoch_;
+
+  // Free lists linked through the first word of every object, for classes
+  // up to kMaxSmall bytes indexed by size / kGranularity, and for the
+  // larger ones by size.  Only kept in DRAM.
+  std::vector<char*> small_;
+  std::map<size_t, char*> large_;
+  size_t free_bytes_;
+  std::deque<Retired> retired_;  // In the order of their epochs
+  size_t retired_bytes_;
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_UTIL_SLAB_ALLOCATOR_H_
@@ -0,0 +1,86 @@
+// Add by MioDB
+
+#include "util/slab_allocator.h"
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "util/arena.h"
+#include "util/random.h"
+
+namespace leveldb {
+
+TEST(SlabAllocatorTest, ClassSize) {
+  ASSERT_EQ(16, SlabAllocator::ClassSize(1));
+  ASSERT_EQ(16, SlabAllocator::ClassSize(16));
+  ASSERT_EQ(32, SlabAllocator::ClassSize(17));
+  ASSERT_EQ(4096, SlabAllocator::ClassSize(4096));
+  ASSERT_EQ(4096 + 512, SlabAllocator::ClassSize(4097));
+  ASSERT_EQ(8192, SlabAllocator::ClassSize(8000));
+  ASSERT_EQ(8192 + 1024, SlabAllocator::ClassSize(8193));
+  for (size_t n = 1; n < 100000; n += 37) {
+    size_t size = SlabAllocator::ClassSize(n);
+    ASSERT_GE(size, n);
+    ASSERT_LE(size - n, n / 8 + 15) << n;
+  }
+}
+
+TEST(SlabAllocatorTest, ReuseFreed) {
+  Arena arena(1 << 20, false);
+  SlabAllocator slab(&arena);
+  char* a = slab.Allocate(100);
+  char* b = slab.Allocate(100);
+  ASSERT_NE(a, b);
+  slab.Free(a, 100);
+  ASSERT_EQ(SlabAllocator::ClassSize(100), slab.FreeBytes());
+  // Another size of the same class takes a's place, other classes do not
+  ASSERT_NE(a, slab.Allocate(200));
+  ASSERT_EQ(a, slab.Allocate(99));
+  ASSERT_EQ(0, slab.FreeBytes());
+
+  char* large = slab.Allocate(100000);
+  slab.Free(large, 100000);
+  ASSERT_EQ(large, slab.Allocate(99999));
+}
+
+TEST(SlabAllocatorTest, Random) {
+  Arena arena(1 << 20, false);
+  SlabAllocator slab(&arena);
+  Random rnd(301);
+  std::vector<std::pair<char*, size_t>> live;
+  for (int i = 0; i < 20000; i++) {
+    if (!live.empty() && rnd.OneIn(3)) {
+      size_t index = rnd.Uniform(live.size());
+      std::pair<char*, size_t> p = live[index];
+      for (size_t b = 0; b < p.second; b++) {
+        ASSERT_EQ(static_cast<char>(p.second + b), p.first[b]);
+      }
+      slab.Free(p.first, p.second);
+      live[index] = live.back();
+      live.pop_back();
+    } else {
+      size_t size = rnd.OneIn(50) ? rnd.Uniform(20000) + 1
+                                  : rnd.Uniform(300) + 1;
+      char* p = slab.Allocate(size);
+      ASSERT_EQ(0, reinterpret_cast<uintptr_t>(p) & 7);
+      for (size_t b = 0; b < size; b++) {
+        p[b] = static_cast<char>(size + b);
+      }
+      live.push_back(std::make_pair(p, size));
+    }
+  }
+  for (size_t i = 0; i < live.size(); i++) {
+    for (size_t b = 0; b < live[i].second; b++) {
+      ASSERT_EQ(static_cast<char>(live[i].second + b), live[i].first[b]);
+    }
+  }
+}
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
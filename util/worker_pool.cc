@@ -0,0 +1,159 @@
+// Add by MioDB
+// A small pool of threads that splits one job into chunks
+
+#include "util/worker_pool.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "util/mutexlock.h"
+
+namespace leveldb {
+
+WorkerPool::WorkerPool(int threads)
+    : running_(false),
+      work_cv_(&mu_),
+      done_cv_(&mu_),
+      shutting_down_(false),
+      work_(nullptr),
+      arg_(nullptr),
+      next_(0),
+      limit_(0),
+      pending_(0) {
+  for (int i = 0; i < threads; i++) {
+    threads_.emplace_back(&WorkerPool::WorkerMain, this);
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  mu_.Lock();
+  shutting_down_ = true;
+  work_cv_.SignalAll();
+  mu_.Unlock();
+  for (size_t i = 0; i < threads_.size(); i++) {
+    threads_[i].join();
+  }
+}
+
+void WorkerPool::Drain() {
+  while (next_ < limit_) {
+    const int i = next_++;
+    void (*work)(void*, int) = work_;
+    void* arg = arg_;
+    mu_.Unlock();
+    (*work)(arg, i);
+    mu_.Lock();
+    if (--pending_ == 0) {
+      done_cv_.SignalAll();
+    }
+  }
+}
+
+void WorkerPool::WorkerMain() {
+  MutexLock l(&mu_);
+  while (true) {
+    while (!shutting_down_ && next_ >= limit_) {
+      work_cv_.Wait();
+    }
+    if (shutting_down_) {
+      return;
+    }
+    Drain();
+  }
+}
+
+void WorkerPool::Run(int n, void (*work)(void* arg, int i), void* arg) {
+  if (n <= 0) {
+    return;
+  }
+  if (threads_.empty() || n == 1 ||
+      running_.exchange(true, std::memory_order_acquire)) {
+    for (int i = 0; i < n; i++) {
+      (*work)(arg, i);
+    }
+    return;
+  }
+
+  MutexLock l(&mu_);
+  work_ = work;
+  arg_ = arg;
+  next_ = 0;
+  limit_ = n;
+  pending_ = n;
+  work_cv_.SignalAll();
+  Drain();
+  while (pending_ > 0) {
+    done_cv_.Wait();
+  }
+  work_ = nullptr;
+  arg_ = nullptr;
+  next_ = limit_ = 0;
+  running_.store(false, std::memory_order_release);
+}
+
+namespace {
+
+// Chunks are large enough to amortize the hand-off, and a multiple of the
+// cache line size so that every chunk starts aligned if the buffer does.
+const size_t kCopyChunk = 1 << 20;
+
+struct CopyJob {
+  char* dst;
+  const char* src;
+  size_t n;
+};
+
+void CopyChunk(void* arg, int i) {
+  CopyJob* job = reinterpret_cast<CopyJob*>(arg);
+  const size_t offset = static_cast<size_t>(i) * kCopyChunk;
+  const size_t bytes = std::min(kCopyChunk, job->n - offset);
+  NonTemporalCopy(job->dst + offset, job->src + offset, bytes);
+}
+
+}  // namespace
+
+void WorkerPool::Copy(char* dst, const char* src, size_t n) {
+  CopyJob job = {dst, src, n};
+  Run(static_cast<int>((n + kCopyChunk - 1) / kCopyChunk), &CopyChunk, &job);
+}
+
+void NonTemporalCopy(char* dst, const char* src, size_t n) {
+#if defined(__SSE2__)
+  // Bring the destination to a 16 byte boundary with an ordinary copy
+  size_t head = (16 - (reinterpret_cast<uintptr_t>(dst) & 15)) & 15;
+  if (head > n) head = n;
+  std::memcpy(dst, src, head);
+  dst += head;
+  src += head;
+  n -= head;
+
+  __m128i* d = reinterpret_cast<__m128i*>(dst);
+  const __m128i* s = reinterpret_cast<const __m128i*>(src);
+  for (size_t i = 0; i < n / 64; i++) {
+    __m128i a = _mm_loadu_si128(s);
+    __m128i b = _mm_loadu_si128(s + 1);
+    __m128i c = _mm_loadu_si128(s + 2);
+    __m128i e = _mm_loadu_si128(s + 3);
+    _mm_stream_si128(d, a);
+    _mm_stream_si128(d + 1, b);
+    _mm_stream_si128(d + 2, c);
+    _mm_stream_si128(d + 3, e);
+    d += 4;
+    s += 4;
+  }
+  const size_t done = n / 64 * 64;
+  std::memcpy(dst + done, src + done, n - done);
+  // Streaming stores are weakly ordered, make them visible before anyone
+  // reads the copy
+  _mm_sfence();
+#else
+  std::memcpy(dst, src, n);
+#endif
+}
+
+}  // namespace leveldb
@@ -0,0 +1,71 @@
+// Add by MioDB
+// A small pool of threads that splits one job into chunks, used to spread
+// a memtable flush or a large compaction over several cores.
+
+#ifndef STORAGE_LEVELDB_UTIL_WORKER_POOL_H_
+#define STORAGE_LEVELDB_UTIL_WORKER_POOL_H_
+
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+#include "port/port.h"
+#include "port/thread_annotations.h"
+
+namespace leveldb {
+
+class WorkerPool {
+ public:
+  // Start "threads" helper threads.  With 0 helpers every job runs on the
+  // calling thread.
+  explicit WorkerPool(int threads);
+
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+
+  ~WorkerPool();
+
+  // Number of threads that run a job, including the caller.
+  int Parallelism() const { return static_cast<int>(threads_.size()) + 1; }
+
+  // Call (*work)(arg, i) for every i in [0, n) and return when all calls
+  // have finished.  The calling thread takes part in the work.  Only one
+  // job runs on the helpers at a time; a caller that finds them busy runs
+  // its job alone rather than waiting.
+  void Run(int n, void (*work)(void* arg, int i), void* arg);
+
+  // Copy "n" bytes from "src" to "dst" in parallel chunks, bypassing the
+  // cache for the destination where the platform allows it.
+  void Copy(char* dst, const char* src, size_t n);
+
+ private:
+  void WorkerMain();
+
+  // Run chunks of the current job until none are left.
+  // REQUIRES: mu_ held.
+  void Drain() EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  std::atomic<bool> running_;  // A job has the helpers
+
+  port::Mutex mu_;
+  port::CondVar work_cv_ GUARDED_BY(mu_);  // A job was posted, or shutdown
+  port::CondVar done_cv_ GUARDED_BY(mu_);  // A job has completed
+  bool shutting_down_ GUARDED_BY(mu_);
+  void (*work_)(void*, int) GUARDED_BY(mu_);
+  void* arg_ GUARDED_BY(mu_);
+  int next_ GUARDED_BY(mu_);     // Next chunk to hand out
+  int limit_ GUARDED_BY(mu_);    // Number of chunks in the current job
+  int pending_ GUARDED_BY(mu_);  // Chunks handed out or left, not finished
+
+  std::vector<std::thread> threads_;
+};
+
+// Copy "n" bytes with non-temporal stores so that a large copy to NVM does
+// not evict the working set of foreground reads from the last level cache.
+// Falls back to memcpy where streaming stores are not available.
+void NonTemporalCopy(char* dst, const char* src, size_t n);
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_UTIL_WORKER_POOL_H_
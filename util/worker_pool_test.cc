@@ -0,0 +1,56 @@
+// Add by MioDB
+
+#include "util/worker_pool.h"
+
+#include <atomic>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "util/random.h"
+
+namespace leveldb {
+
+static void CountCall(void* arg, int i) {
+  std::atomic<int>* calls = reinterpret_cast<std::atomic<int>*>(arg);
+  calls[i].fetch_add(1, std::memory_order_relaxed);
+}
+
+TEST(WorkerPoolTest, RunCallsEveryIndexOnce) {
+  for (int threads = 0; threads < 4; threads++) {
+    WorkerPool pool(threads);
+    ASSERT_EQ(threads + 1, pool.Parallelism());
+    for (int n = 0; n < 100; n += 7) {
+      std::atomic<int> calls[100];
+      for (int i = 0; i < 100; i++) calls[i].store(0);
+      pool.Run(n, &CountCall, calls);
+      for (int i = 0; i < 100; i++) {
+        ASSERT_EQ(i < n ? 1 : 0, calls[i].load()) << threads << " " << n;
+      }
+    }
+  }
+}
+
+TEST(WorkerPoolTest, Copy) {
+  WorkerPool pool(3);
+  Random rnd(301);
+  std::string src;
+  for (int i = 0; i < (3 << 20) + 1000; i++) {
+    src.push_back(static_cast<char>(rnd.Uniform(256)));
+  }
+  // Sizes around the chunk size and destinations that are not aligned
+  const size_t sizes[] = {0, 1, 15, 64, 1000, 1 << 20, (1 << 20) + 7, 3 << 20};
+  for (size_t size : sizes) {
+    for (size_t shift = 0; shift < 3; shift++) {
+      std::string dst(size + shift, '\0');
+      pool.Copy(&dst[shift], src.data(), size);
+      ASSERT_EQ(0, src.compare(0, size, dst, shift, size)) << size;
+    }
+  }
+}
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}